@@ -0,0 +1,8 @@
+function closeStream(stream)
+%CLOSESTREAM Close a stream.
+%
+%    bson.closeStream(stream)
+%
+% See also bson.openStream
+  libbsonmex(mfilename, stream);
+end
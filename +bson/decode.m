@@ -7,6 +7,12 @@ function value = decode(bson_value, varargin)
 %
 %    - `bson_value` BSON encoded binary.
 %
+% Options:
+%
+%    - `OID` Format of object ids: 'string' for 24-character strings,
+%            'binary' for 1-by-12 uint8 rows, or 'uint32' for 1-by-3 uint32
+%            rows. Default 'string'.
+%
 % Returns:
 %
 %    Decoded Matlab value.
@@ -0,0 +1,26 @@
+function values = decodeStream(bson_stream, varargin)
+%DECODESTREAM Deserialize concatenated BSON documents.
+%
+%    values = bson.decodeStream(bson_stream, ...)
+%
+% Parameters:
+%
+%    - `bson_stream` uint8 vector of concatenated BSON documents.
+%
+% Options:
+%
+%    - `COLUMNAR` Return a scalar struct with one column per field instead
+%                 of an array of documents. Numeric scalar columns become
+%                 double vectors with NaN for missing values, other columns
+%                 are cell arrays. Default false.
+%    - `OID` Format of object ids: 'string', 'binary' or 'uint32'. See
+%            bson.decode. Columns of binary object ids become an N-by-12
+%            or N-by-3 matrix. Default 'string'.
+%
+% Returns:
+%
+%    Decoded Matlab values.
+%
+% See also bson.encodeStream bson.decode
+  values = libbsonmex(mfilename, bson_stream, varargin{:});
+end
@@ -0,0 +1,21 @@
+function [bson_stream, offsets] = encodeStream(values, varargin)
+%ENCODESTREAM Serialize many values into a single BSON stream.
+%
+%    [bson_stream, offsets] = bson.encodeStream(values, ...)
+%
+% Parameters:
+%
+%    - `values` Cell array or struct array of documents to encode.
+%
+% Options:
+%
+%    - `QUERY` Encode each value as a query. Default false.
+%
+% Returns:
+%
+%    A uint8 row vector of concatenated BSON documents, and zero-based byte
+%    offsets of each document in the stream.
+%
+% See also bson.decodeStream bson.encode
+  [bson_stream, offsets] = libbsonmex(mfilename, values, varargin{:});
+end
@@ -0,0 +1,31 @@
+function bson_value = fromJSON(text, varargin)
+%FROMJSON Parse JSON text into BSON.
+%
+%    bson_value = bson.fromJSON(text, ...)
+%
+% Samples:
+%
+%    value = bson.decode(bson.fromJSON('{"name": "Grenny", "age": 1}'))
+%    handle = bson.lazy(bson.fromJSON(fileread('parrot.json')))
+%
+% Parameters:
+%
+%    - `text` JSON object or array as char, or UTF-8 encoded uint8.
+%
+% Options:
+%
+%    - `QUERY` Construct BSON as a query. Default false.
+%
+% Numbers become double as in bson.encode. Extended JSON values such as
+% {"$oid": "..."} and {"$date": ...} become object ids and dates.
+%
+% Returns:
+%
+%    A BSON binary.
+%
+% See also bson.toJSON bson.decode
+  if ischar(text)
+    text = unicode2native(text, 'UTF-8');
+  end
+  bson_value = libbsonmex(mfilename, uint8(text), varargin{:});
+end
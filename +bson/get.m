@@ -0,0 +1,27 @@
+function value = get(bson_value, path)
+%GET Get a field of a BSON document without decoding the rest.
+%
+%    value = bson.get(bson_value, path)
+%
+% Sample:
+%
+%    bson_value = bson.encode(struct('a', struct('b', 1), 'c', 'foo'));
+%    bson.get(bson_value, 'a.b')
+%    bson.get(bson.lazy(bson_value), 'c')
+%
+% Parameters:
+%
+%    - `bson_value` BSON encoded binary or bson.lazy handle.
+%    - `path` Dotted path to the field. Array elements are addressed by
+%      zero-based index, e.g., 'likes.0'.
+%
+% Returns:
+%
+%    Decoded Matlab value of the field.
+%
+% See also bson.lazy bson.decode
+  if isa(bson_value, 'bson.lazy')
+    bson_value = uint8(bson_value);
+  end
+  value = libbsonmex(mfilename, bson_value, path);
+end
@@ -0,0 +1,116 @@
+classdef lazy
+%LAZY Document handle that decodes fields on access.
+%
+% A lazy handle keeps an encoded BSON document and converts a field only
+% when it is accessed. Untouched fields are never decoded.
+%
+%    handle = bson.lazy(bson_value)
+%    value = handle.a.b
+%    value = bson.get(handle, 'a.b')
+%    value = decode(handle)
+%
+% Query results are returned as lazy handles with the `LAZY` option.
+%
+%    results = ejdb.find('mycoll', {}, 'LAZY');
+%    results(1).name
+%
+% See also bson.get bson.decode ejdb.find ejdb.load
+
+  properties (Access = private)
+    data % BSON encoded binary.
+  end
+
+  methods
+    function this = lazy(bson_value)
+      %LAZY Create a new lazy handle.
+      %
+      %    handle = bson.lazy(bson_value)
+      %    handles = bson.lazy({bson_value1, bson_value2, ...})
+      %
+      if nargin > 0
+        if iscell(bson_value)
+          this = repmat(this, size(bson_value));
+          for i = 1:numel(bson_value)
+            this(i).data = bson_value{i};
+          end
+        else
+          this.data = bson_value;
+        end
+      end
+    end
+
+    function varargout = subsref(this, S)
+      %SUBSREF Decode fields on dot access.
+      switch S(1).type
+        case '.'
+          if ~isscalar(this)
+            error('bson:lazy', ...
+                  'Field access requires a scalar handle, e.g., h(1).%s.', ...
+                  S(1).subs);
+          end
+          % Merge consecutive dot access into a single path.
+          keys = {};
+          while ~isempty(S) && strcmp(S(1).type, '.')
+            keys{end + 1} = S(1).subs; %#ok<AGROW>
+            S = S(2:end);
+          end
+          if strcmp(keys{1}, 'id_')
+            keys{1} = '_id';
+          end
+          path = sprintf('.%s', keys{:});
+          value = libbsonmex('get', this.data, path(2:end));
+        case '()'
+          value = builtin('subsref', this, S(1));
+          S = S(2:end);
+        otherwise
+          error('bson:lazy', '%s indexing is not supported.', S(1).type);
+      end
+      if ~isempty(S)
+        value = subsref(value, S);
+      end
+      varargout = {value};
+    end
+
+    function value = get(this, path)
+      %GET Get a field by a dotted path.
+      %
+      %    value = get(handle, 'a.b')
+      %
+      value = libbsonmex('get', this.data, path);
+    end
+
+    function value = decode(this)
+      %DECODE Decode the entire document.
+      %
+      %    value = decode(handle)
+      %
+      if isscalar(this)
+        value = libbsonmex('decode', this.data);
+      else
+        value = cell(size(this));
+        for i = 1:numel(this)
+          value{i} = libbsonmex('decode', this(i).data);
+        end
+      end
+    end
+
+    function value = uint8(this)
+      %UINT8 Get the BSON encoded binary.
+      %
+      %    bson_value = uint8(handle)
+      %
+      value = this.data;
+    end
+
+    function disp(this)
+      %DISP Display function.
+      if isscalar(this)
+        fprintf('  bson.lazy (%d bytes)\n', numel(this.data));
+      else
+        fprintf('  %s bson.lazy array\n', ...
+                regexprep(num2str(size(this)), '\s+', 'x'));
+      end
+    end
+  end
+
+end
@@ -0,0 +1,30 @@
+function stream = openStream(filename, varargin)
+%OPENSTREAM Open a file of concatenated BSON documents.
+%
+%    stream = bson.openStream(filename, ...)
+%
+% Samples:
+%
+%    stream = bson.openStream('dump/zoo/parrots.bson')
+%    stream = bson.openStream('parrots.bson', 'WRITE')
+%    stream = bson.openStream('parrots.bson', 'APPEND')
+%
+% Parameters:
+%
+%    - `filename` Path to the file, e.g., mongodump output.
+%
+% Options:
+%
+%    - `WRITE` Open for writing. The file is truncated. Default false.
+%    - `APPEND` Open for writing after existing documents. Default false.
+%
+% A stream opened for reading maps the file in memory and decodes documents
+% in chunks with bson.readStream, so that the whole file is never loaded.
+%
+% Returns:
+%
+%    Stream handle.
+%
+% See also bson.readStream bson.writeStream bson.closeStream
+  stream = libbsonmex(mfilename, filename, varargin{:});
+end
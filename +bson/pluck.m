@@ -0,0 +1,38 @@
+function values = pluck(bson_values, path, varargin)
+%PLUCK Extract a field from many BSON documents into a column.
+%
+%    values = bson.pluck(bson_values, path, ...)
+%
+% Sample:
+%
+%    bson_stream = bson.encodeStream(struct('a', {1, 2, 3}));
+%    values = bson.pluck(bson_stream, 'a')
+%
+% Parameters:
+%
+%    - `bson_values` Cell array of BSON encoded binaries, concatenated BSON
+%      documents such as from bson.encodeStream, or bson.lazy handles.
+%    - `path` Dotted path to the field, e.g., 'a.b' or 'likes.0'.
+%
+% Options:
+%
+%    - `THREADS` Number of threads to locate the field. Default to the
+%                number of processors.
+%    - `OID` Format of object ids: 'string', 'binary' or 'uint32'. Object
+%            ids become an N-by-12 uint8 or N-by-3 uint32 matrix in the
+%            binary formats. Default 'string'.
+%
+% Returns:
+%
+%    Column of the field values. Numbers become a double column with NaN
+%    for missing values, or an int32 or int64 column when all values are
+%    integers. Booleans become a logical column and strings a cellstr when
+%    no value is missing. Other values are returned in a cell array with []
+%    for missing values.
+%
+% See also bson.get bson.decodeStream
+  if isa(bson_values, 'bson.lazy')
+    bson_values = arrayfun(@uint8, bson_values, 'UniformOutput', false);
+  end
+  values = libbsonmex(mfilename, bson_values, path, varargin{:});
+end
@@ -0,0 +1,33 @@
+function values = readStream(stream, varargin)
+%READSTREAM Read the next documents from a stream.
+%
+%    values = bson.readStream(stream, count, ...)
+%
+% Samples:
+%
+%    stream = bson.openStream('parrots.bson');
+%    values = bson.readStream(stream, 1000);
+%    while ~isempty(values)
+%      ...
+%      values = bson.readStream(stream, 1000);
+%    end
+%    bson.closeStream(stream);
+%
+% Parameters:
+%
+%    - `stream` Stream handle opened by bson.openStream.
+%    - `count` Maximum number of documents to read. Default 1.
+%
+% Options:
+%
+%    - `COLUMNAR` Return a scalar struct with one column per field. See
+%                 bson.decodeStream. Default false.
+%    - `OID` Format of object ids. See bson.decodeStream. Default 'string'.
+%
+% Returns:
+%
+%    Decoded documents, or empty at the end of the stream.
+%
+% See also bson.openStream bson.decodeStream
+  values = libbsonmex(mfilename, stream, varargin{:});
+end
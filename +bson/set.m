@@ -0,0 +1,34 @@
+function bson_value = set(bson_value, path, value)
+%SET Set a field of a BSON document without decoding the rest.
+%
+%    bson_value = bson.set(bson_value, path, value)
+%
+% Sample:
+%
+%    bson_value = bson.encode(struct('a', struct('b', 1), 'c', 'foo'));
+%    bson_value = bson.set(bson_value, 'a.b', 2);
+%    bson_value = bson.set(bson_value, 'd.e', {'x', 'y'});
+%
+% Parameters:
+%
+%    - `bson_value` BSON encoded binary or bson.lazy handle.
+%    - `path` Dotted path to the field. Array elements are addressed by
+%      zero-based index, e.g., 'likes.0'. Missing intermediate fields are
+%      created as documents. An array only grows by its next index; a
+%      larger index is an error.
+%    - `value` New value of the field, encoded as in bson.encode.
+%
+% Returns:
+%
+%    Modified BSON binary, or a bson.lazy handle if a handle is given.
+%
+% See also bson.unset bson.get
+  is_lazy = isa(bson_value, 'bson.lazy');
+  if is_lazy
+    bson_value = uint8(bson_value);
+  end
+  bson_value = libbsonmex(mfilename, bson_value, path, value);
+  if is_lazy
+    bson_value = bson.lazy(bson_value);
+  end
+end
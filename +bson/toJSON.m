@@ -0,0 +1,21 @@
+function text = toJSON(value)
+%TOJSON Serialize value in JSON format.
+%
+%    text = bson.toJSON(value)
+%
+% Parameters:
+%
+%    - `value` A value to serialize, or BSON binary from bson.encode.
+%
+% Returns:
+%
+%    JSON text. Object ids, dates and 32-bit and 64-bit integers use the
+%    extended JSON notation, e.g., {"$oid": "..."}, so that bson.fromJSON
+%    restores their types.
+%
+% See also bson.fromJSON bson.encode
+  if isa(value, 'bson.lazy')
+    value = uint8(value);
+  end
+  text = native2unicode(libbsonmex(mfilename, value), 'UTF-8');
+end
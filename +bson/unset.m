@@ -0,0 +1,24 @@
+function bson_value = unset(bson_value, path)
+%UNSET Remove a field of a BSON document without decoding the rest.
+%
+%    bson_value = bson.unset(bson_value, path)
+%
+% Parameters:
+%
+%    - `bson_value` BSON encoded binary or bson.lazy handle.
+%    - `path` Dotted path to the field. A missing field is ignored.
+%
+% Returns:
+%
+%    Modified BSON binary, or a bson.lazy handle if a handle is given.
+%
+% See also bson.set bson.get
+  is_lazy = isa(bson_value, 'bson.lazy');
+  if is_lazy
+    bson_value = uint8(bson_value);
+  end
+  bson_value = libbsonmex(mfilename, bson_value, path);
+  if is_lazy
+    bson_value = bson.lazy(bson_value);
+  end
+end
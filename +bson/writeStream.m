@@ -0,0 +1,16 @@
+function writeStream(stream, values)
+%WRITESTREAM Append documents to a stream.
+%
+%    bson.writeStream(stream, values)
+%
+% Parameters:
+%
+%    - `stream` Stream handle opened by bson.openStream for writing.
+%    - `values` Cell array or struct array of documents to append.
+%
+% Documents are buffered and written to the file by bson.closeStream at the
+% latest.
+%
+% See also bson.openStream bson.closeStream
+  libbsonmex(mfilename, stream, values);
+end
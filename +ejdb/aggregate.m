@@ -0,0 +1,50 @@
+function results = aggregate(collection, query, varargin)
+%AGGREGATE Compute per-group statistics of query results.
+%
+%    results = ejdb.aggregate(collection, query, ...)
+%    results = ejdb.aggregate(collection, query, hints, ...)
+%    results = ejdb.aggregate(database, collection, query, ...)
+%    results = ejdb.aggregate(database, collection, query, hints, ...)
+%
+% Sample:
+%
+%    results = ejdb.aggregate('requests', {}, 'GROUPBY', 'site', ...
+%                             'SUM', 'bytes', 'MAX', 'latency');
+%    % results.site, results.count, results.sum_bytes, results.max_latency
+%
+% Query results are aggregated inside the database, reading only the
+% referenced fields, so only one row per group is returned to Matlab.
+%
+% Parameters:
+%
+%    - `database` Database handle. The last opened database is used when
+%      skipped.
+%    - `collection` Collection name.
+%    - `query` Query object. See ejdb.find.
+%    - `hints` Optional query hints. See ejdb.find.
+%
+% Options:
+%
+%    - `GROUPBY` Dotted path or cell array of paths to group by. Documents
+%                without the field form their own group. Default {} (one
+%                group of all results).
+%    - `COUNT` Field or fields to count the documents that have them.
+%    - `SUM` Field or fields to sum up.
+%    - `MIN` Field or fields to take the minimum.
+%    - `MAX` Field or fields to take the maximum.
+%    - `MEAN` Field or fields to average.
+%
+% SUM, MIN, MAX and MEAN skip values that are not numbers. MIN, MAX and
+% MEAN are NaN in a group without numbers.
+%
+% Returns:
+%
+%    Scalar struct of columns with one row per group in the order of first
+%    appearance: one column per GROUPBY field, the number of documents
+%    `count`, and one column per aggregate named like `sum_bytes`. Numeric
+%    group values become a double column with NaN for missing values, and
+%    others a cell array.
+%
+% See also ejdb.find ejdb.count
+  results = libejdbmex(mfilename, collection, query, varargin{:});
+end
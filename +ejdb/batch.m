@@ -0,0 +1,40 @@
+function results = batch(varargin)
+%BATCH Execute a list of operations in one call.
+%
+%    results = ejdb.batch(operations, ...)
+%    results = ejdb.batch(database, operations, ...)
+%
+% Sample:
+%
+%    results = ejdb.batch({{'save', 'parrots', parrots}, ...
+%                          {'count', 'parrots', {}}}, 'ATOMIC', true);
+%    % results{1} are the ids, results{2} is the count
+%
+% Operations run in order without returning to Matlab in between, which
+% saves the call overhead of many small operations.
+%
+% Parameters:
+%
+%    - `database` Database handle. Used for every operation. The last
+%      opened database is used when skipped.
+%    - `operations` Cell array of operations. Each operation is a cell
+%      array of the function name and its arguments, e.g.,
+%      {'load', 'parrots', id}. The database handle is not included.
+%
+% Options:
+%
+%    - `ATOMIC` Run the batch inside transactions of the collections
+%               operated on, aborted when any operation fails. Allows only
+%               save, load, remove, update, find, findOne and count.
+%               The operations run in one nested call of ejdb.batch, so
+%               that the transactions are aborted before an error is
+%               raised. Default false.
+%
+% Returns:
+%
+%    1-by-N cell array of the first output of each operation, or [] when
+%    the operation has no output.
+%
+% See also ejdb.save ejdb.load ejdb.update ejdb.find
+  results = libejdbmex(mfilename, varargin{:});
+end
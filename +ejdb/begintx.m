@@ -4,6 +4,8 @@ function begintx(collection, varargin)
 %    ejdb.begintx(collection)
 %    ejdb.begintx(database, collection)
 %
+% Transactions are not available in the WRITEBEHIND mode of ejdb.open.
+%
 % See also ejdb
   libejdbmex(mfilename, collection, varargin{:});
 end
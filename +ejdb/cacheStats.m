@@ -0,0 +1,15 @@
+function stats = cacheStats(varargin)
+%CACHESTATS Get statistics of the result caches of a database.
+%
+%    stats = ejdb.cacheStats
+%    stats = ejdb.cacheStats(database)
+%
+% Returns:
+%
+%    Struct with fields `query` and `document`, each a struct of `entries`,
+%    `bytes`, `budget`, `hits` and `misses`. All are zero for a disabled
+%    cache.
+%
+% See also ejdb.setCache
+  stats = libejdbmex(mfilename, varargin{:});
+end
@@ -0,0 +1,11 @@
+function cancel(future)
+%CANCEL Discard a query started by ejdb.findAsync.
+%
+%    ejdb.cancel(future)
+%
+% Returns immediately. A running query cannot be interrupted, so it
+% finishes in the background and its results are discarded.
+%
+% See also ejdb.findAsync ejdb.fetch
+  libejdbmex(mfilename, future);
+end
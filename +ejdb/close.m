@@ -4,6 +4,9 @@ function close(varargin)
 %    ejdb.close
 %    ejdb.close(database)
 %
+% In the WRITEBEHIND mode of ejdb.open, waits for the queued writes first.
+% A database of ejdb.openSharded closes every shard.
+%
 % See also ejdb
   libejdbmex(mfilename, varargin{:});
 end
@@ -10,6 +10,10 @@ function dropCollection(collection, varargin)
 %    ejdb.dropCollection('mycoll')
 %    ejdb.dropCollection('mycoll', 'UNLINK')
 %
+% Queued writes and running ejdb.findAsync queries of the database are
+% waited for before the collection is removed. Their futures can still be
+% fetched.
+%
 % Parameters:
 %
 %    - `database` Database handle.
@@ -0,0 +1,37 @@
+function stats = export(collection, query, varargin)
+%EXPORT Export query results to a file.
+%
+%    stats = ejdb.export(collection, query, filename, ...)
+%    stats = ejdb.export(collection, query, hints, filename, ...)
+%    stats = ejdb.export(database, collection, query, hints, filename, ...)
+%
+% Samples:
+%
+%    ejdb.export('parrots', {}, 'parrots.bson')
+%    ejdb.export('parrots', {'male', true}, 'males.jsonl', 'FORMAT', 'jsonl')
+%
+% Query results are written to the file without being converted to Matlab
+% values. Use ejdb.import or bson.openStream to read the file back.
+%
+% Parameters:
+%
+%    - `collection` Collection name.
+%    - `query` Query object. See ejdb.find.
+%    - `hints` Optional query hints. See ejdb.find.
+%    - `filename` Path to the file to write.
+%
+% Options:
+%
+%    - `FORMAT` 'bson' for concatenated BSON documents, or 'jsonl' for one
+%               JSON object per line. By default, files with .json or .jsonl
+%               extension are written as 'jsonl' and others as 'bson'.
+%
+% Returns:
+%
+%    Struct with the number of exported documents `count`, the number of
+%    bytes written `bytes`, the elapsed time `seconds`, and the throughput
+%    in documents per second `rate`.
+%
+% See also ejdb.import ejdb.find
+  stats = libejdbmex(mfilename, collection, query, varargin{:});
+end
@@ -0,0 +1,14 @@
+function results = fetch(future)
+%FETCH Get the results of a query started by ejdb.findAsync.
+%
+%    results = ejdb.fetch(future)
+%
+% Waits for the query to finish and releases the future.
+%
+% Returns:
+%
+%    Query results in the same form as ejdb.find.
+%
+% See also ejdb.findAsync ejdb.isReady ejdb.cancel
+  results = libejdbmex(mfilename, future);
+end
@@ -5,6 +5,7 @@ function results = find(collection, query, varargin)
 %    results = ejdb.find(collection, query, hints)
 %    results = ejdb.find(database, collection, query)
 %    results = ejdb.find(database, collection, query, hints)
+%    results = ejdb.find(..., optionName, optionValue, ...)
 %
 % Sample:
 %
@@ -20,6 +21,18 @@ function results = find(collection, query, varargin)
 %    - `collection` Collection name.
 %    - `query` Main query object.
 %    - `hints` Query hints. See explanations below.
+%    - `optionN` Following options can be specified.
+%
+%        LAZY - Return bson.lazy handles that decode fields on access.
+%               Default: false.
+%        FIELDS - Cell array of dotted paths to decode, e.g., {'a.b', 'c'}.
+%                 Only the given fields are decoded into a flat struct
+%                 whose field names replace dots with underscores. Missing
+%                 fields are set to []. Default: {} (decode all fields).
+%        OID - Format of object ids: 'string' for 24-character strings,
+%              'binary' for 1-by-12 uint8 rows, or 'uint32' for 1-by-3
+%              uint32 rows whose sort order follows the creation time.
+%              Default: 'string'.
 %
 % Returns:
 %
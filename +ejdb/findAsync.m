@@ -0,0 +1,32 @@
+function future = findAsync(collection, query, varargin)
+%FINDASYNC Start a query in a background thread.
+%
+%    future = ejdb.findAsync(collection, query, ...)
+%    future = ejdb.findAsync(collection, query, hints, ...)
+%    future = ejdb.findAsync(database, collection, query, ...)
+%    future = ejdb.findAsync(database, collection, query, hints, ...)
+%
+% Sample:
+%
+%    future = ejdb.findAsync('parrots', {'size', {'$gt', 10}});
+%    while ~ejdb.isReady(future)
+%      drawnow;
+%    end
+%    results = ejdb.fetch(future);
+%
+% The query runs without blocking Matlab, and several queries can run at
+% the same time. Results are converted to Matlab values in ejdb.fetch.
+% Parameters and options are the same as ejdb.find. Closing the database
+% waits for its running queries and releases their futures.
+%
+% Each query runs in its own thread, and all of them share the database
+% handle and wait on its locks, so a query waits for writes to the
+% collection and queries do not scale like separate handles would.
+%
+% Returns:
+%
+%    Query future id to pass to ejdb.isReady, ejdb.fetch or ejdb.cancel.
+%
+% See also ejdb.find ejdb.isReady ejdb.fetch ejdb.cancel
+  future = libejdbmex(mfilename, collection, query, varargin{:});
+end
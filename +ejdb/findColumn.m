@@ -0,0 +1,47 @@
+function [values, mask] = findColumn(collection, query, varargin)
+%FINDCOLUMN Query fields of matching records into typed column vectors.
+%
+%    [values, mask] = ejdb.findColumn(collection, query, field, ...)
+%    [values, mask] = ejdb.findColumn(collection, query, hints, field, ...)
+%    [values, mask] = ejdb.findColumn(database, collection, query, ...)
+%
+% Samples:
+%
+%    sizes = ejdb.findColumn('parrots', {}, 'size');
+%    [ages, has_age] = ejdb.findColumn('owls', {}, 'age', 'TYPE', 'int32');
+%    columns = ejdb.findColumn('parrots', {}, {'size', 'stats.weight'});
+%
+% Only the requested fields are fetched by the `$fields` hint, and the values
+% are decoded straight into a preallocated column without making a struct
+% per record.
+%
+% Parameters:
+%
+%    - `database` Database handle. The last opened database is used when
+%      skipped.
+%    - `collection` Collection name.
+%    - `query` Query object. See ejdb.find.
+%    - `hints` Optional query hints. See ejdb.find. `$fields` is replaced.
+%      Hints are a struct or a cell array of `$` keys, which tells them
+%      from a cell array of fields.
+%    - `field` Dotted path to the field, or a cell array of paths.
+%
+% Options:
+%
+%    - `TYPE` Class of the column: 'double', 'single', 'int8', 'uint8',
+%             'int16', 'uint16', 'int32', 'uint32', 'int64', 'uint64', or
+%             'logical'. Default 'double'.
+%
+% Returns:
+%
+%    - `values` N-by-1 column of the field. Numbers and booleans are
+%      converted to TYPE as in Matlab. Missing or non-numeric values are
+%      NaN, or 0 for integer and logical types. A scalar struct of columns
+%      is returned for a cell array of fields, with dots in the field names
+%      replaced by underscores.
+%    - `mask` N-by-1 logical column that is true where the value is present,
+%      or a scalar struct of masks for a cell array of fields.
+%
+% See also ejdb.find
+  [values, mask] = libejdbmex(mfilename, collection, query, varargin{:});
+end
@@ -0,0 +1,41 @@
+function count = import(collection, filename, varargin)
+%IMPORT Import documents from a file into the collection.
+%
+%    count = ejdb.import(collection, filename, ...)
+%    count = ejdb.import(database, collection, filename, ...)
+%
+% Samples:
+%
+%    ejdb.import('parrots', 'dump/zoo/parrots.bson')
+%    ejdb.import('parrots', 'parrots.jsonl', 'THREADS', 4)
+%
+% Documents are read from the file and saved in the collection without
+% being converted to Matlab values. If the collection does not exist it
+% will be created.
+%
+% Parameters:
+%
+%    - `collection` Collection name.
+%    - `filename` Path to the file to import.
+%
+% Options:
+%
+%    - `FORMAT` 'bson' for concatenated BSON documents such as mongodump
+%               output, or 'jsonl' for one JSON object per line. By
+%               default, files with .json or .jsonl extension are read as
+%               'jsonl' and others as 'bson'.
+%    - `BATCHSIZE` Number of documents saved in a transaction. Default
+%                  10000.
+%    - `THREADS` Number of threads to parse JSON lines. Default to the
+%                number of processors.
+%
+% JSON numbers are saved as double. Extended JSON values such as
+% {"$oid": "..."} and {"$date": ...} are saved as object ids and dates.
+%
+% Returns:
+%
+%    Number of imported documents.
+%
+% See also ejdb.save
+  count = libejdbmex(mfilename, collection, filename, varargin{:});
+end
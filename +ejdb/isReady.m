@@ -0,0 +1,12 @@
+function flag = isReady(future)
+%ISREADY Check if a query started by ejdb.findAsync has finished.
+%
+%    flag = ejdb.isReady(future)
+%
+% Returns:
+%
+%    True if ejdb.fetch returns without waiting.
+%
+% See also ejdb.findAsync ejdb.fetch
+  flag = libejdbmex(mfilename, future);
+end
@@ -0,0 +1,47 @@
+function results = join(varargin)
+%JOIN Join the results of two queries on equal field values.
+%
+%    results = ejdb.join(leftColl, leftQuery, leftKey, ...
+%                        rightColl, rightQuery, rightKey, ...)
+%    results = ejdb.join(database, leftColl, leftQuery, leftKey, ...
+%                        rightColl, rightQuery, rightKey, ...)
+%    results = ejdb.join(..., optionName, optionValue, ...)
+%
+% Samples:
+%
+%    % Parrots with the owner documents of the same owner name.
+%    results = ejdb.join('parrots', {}, 'owner', 'owners', {}, 'name');
+%    % Indices into ejdb.find('parrots', {}) and ejdb.find('owners', {}).
+%    pairs = ejdb.join('parrots', {}, 'owner', 'owners', {}, 'name', ...
+%                      'OUTPUT', 'pairs');
+%
+% A hash table is built over the raw key values of the smaller side and
+% probed with the other side inside the database, so only matched documents
+% are converted to Matlab values. Numbers match by value regardless of
+% their BSON type. Documents without the key field never match.
+%
+% Parameters:
+%
+%    - `database` Database handle. The last opened database is used when
+%      skipped.
+%    - `leftColl`, `rightColl` Collection names.
+%    - `leftQuery`, `rightQuery` Query objects. See ejdb.find.
+%    - `leftKey`, `rightKey` Dotted paths to the key fields, e.g., 'a.b'.
+%
+% Options:
+%
+%    - `OUTPUT` 'merged' for merged documents, or 'pairs' for an N-by-2
+%               matrix of indices into the left and right query results.
+%               Fields of the left document win in a merged document.
+%               Default 'merged'.
+%    - `LAZY`, `FIELDS`, `OID` Conversion of merged documents. See
+%               ejdb.find.
+%
+% Returns:
+%
+%    Merged documents or index pairs of the matches, sorted by the left and
+%    then the right index.
+%
+% See also ejdb.find
+  results = libejdbmex(mfilename, varargin{:});
+end
@@ -3,21 +3,39 @@ function value = load(collection, id, varargin)
 %
 %    value = ejdb.load(collection, id)
 %    value = ejdb.load(database, collection, id)
+%    value = ejdb.load(..., optionName, optionValue, ...)
 %
 % Sample:
 %
 %    ejdb.load('mycoll', '511c72ae7922641d00000000');
+%    ejdb.load('mycoll', '511c72ae7922641d00000000', 'FIELDS', {'a.b', 'c'});
+%
+% Decoded documents are cached when enabled by ejdb.setCache.
 %
 % Parameters:
 %
 %    - `database` Database handle. The last opened database is used when
 %      skpped.
 %    - `collection` Collection name.
-%    - `id` Document object id (`_id` property).
+%    - `id` Document object id (`_id` property), or an N-by-12 uint8 or
+%      N-by-3 uint32 matrix of object ids returned by ejdb.save.
+%    - `optionN` Following options can be specified.
+%
+%        LAZY - Return a bson.lazy handle that decodes fields on access.
+%               Default: false.
+%        FIELDS - Cell array of dotted paths to decode, e.g., {'a.b', 'c'}.
+%                 Only the given fields are decoded into a flat struct
+%                 whose field names replace dots with underscores. Missing
+%                 fields are set to []. Default: {} (decode all fields).
+%        OID - Format of object ids: 'string' for 24-character strings,
+%              'binary' for 1-by-12 uint8 rows, or 'uint32' for 1-by-3
+%              uint32 rows whose sort order follows the creation time.
+%              Default: 'string'.
 %
 % Returns:
 %
-%    A document identified by `id`.
+%    A document identified by `id`. An N-by-1 cell array of documents is
+%    returned for a matrix of object ids, with [] for missing documents.
 %
 % See also ejdb
   value = libejdbmex(mfilename, collection, id, varargin{:});
@@ -50,7 +50,7 @@ function make(varargin)
 
   for i = 1:numel(targets)
     [outdir, output] = fileparts(targets{i});
-    cmd = sprintf('mex -largeArrayDims%s %s -outdir %s -output %s %s%s -lz', ...
+    cmd = sprintf('mex -largeArrayDims%s %s -outdir %s -output %s %s%s -lz -lpthread', ...
                   sprintf(' %s', source_files{:}), ...
                   api_files{i}, ...
                   outdir, ...
@@ -0,0 +1,31 @@
+function object_ids = newId(varargin)
+%NEWID Generate object ids without accessing the database.
+%
+%    object_id = ejdb.newId
+%    object_ids = ejdb.newId(n)
+%    object_ids = ejdb.newId(n, 'OID', format)
+%
+% Sample:
+%
+%    ids = ejdb.newId(2);
+%    ejdb.save('nodes', struct('id_', ids{1}, 'next', ids{2}), ...
+%                       struct('id_', ids{2}, 'next', ids{1}));
+%
+% Ids are unique within the process, so that documents can refer to each
+% other before they are saved. They are not ordered: the counter starts at
+% a random value and wraps around.
+%
+% Parameters:
+%
+%    - `n` Number of ids. Default 1.
+%    - `format` Format of the ids: 'string', 'binary' for an N-by-12 uint8
+%      matrix, or 'uint32' for an N-by-3 uint32 matrix. Default: 'string'.
+%
+% Returns:
+%
+%    Object id string, cell array of strings, or a matrix with one row per
+%    object id.
+%
+% See also ejdb.save
+  object_ids = libejdbmex(mfilename, varargin{:});
+end
@@ -8,6 +8,8 @@ function database = open(filename, varargin)
 %    database = ejdb.open('foo')
 %    database = ejdb.open('foo', 'READER')
 %    database = ejdb.open('foo', 'WRITER', 'CREAT', 'TRUNC')
+%    database = ejdb.open('foo', 'WRITER', true, 'CREAT', true, ...
+%                         'WRITEBEHIND', true)
 %
 % Parameters:
 %    - `filename` Database file path.
@@ -20,6 +22,12 @@ function database = open(filename, varargin)
 %        NOLCK - Open without locking.
 %        LCKNB - Lock without blocking.
 %        TSYNC - Synchronize every transaction.
+%        WRITEBEHIND - Apply saves, updates and removes in a background
+%          thread. ejdb.save returns generated object ids immediately,
+%          ejdb.update returns NaN, and queries may not see writes until
+%          ejdb.sync. Write errors are raised by the next call on the
+%          database. ejdb.begintx, ejdb.commitx and ejdb.abortx raise an
+%          error.
 %
 % Returns:
 %
@@ -0,0 +1,43 @@
+function [database, shards] = openSharded(basePath, numShards, varargin)
+%OPENSHARDED Open a database hash-partitioned into several files.
+%
+%    [database, shards] = ejdb.openSharded(basePath, numShards, ...)
+%
+% Samples:
+%
+%    database = ejdb.openSharded('foo', 4);
+%    ejdb.save(database, 'parrots', struct('name', 'Polly'));
+%    [database, shards] = ejdb.openSharded('bar', 4, 'KEY', 'owner');
+%    ejdb.sync(shards(1));
+%
+% Shards are databases at basePath.0, basePath.1, ... Documents are routed
+% by the hash of the shard key, or of the object id when no key is given or
+% a document lacks the key. ejdb.save, ejdb.load and ejdb.remove go to the
+% routed shard, where loads and removes search every shard when a shard key
+% is given. ejdb.find, ejdb.findOne, ejdb.count and ejdb.aggregate query
+% the shards in parallel threads and merge the results, in the order of
+% $orderby if given. A query with a scalar equality on the shard key only
+% queries the routed shard. ejdb.sync and ejdb.close apply to every shard.
+%
+% Other functions take a shard handle, so that each shard can be synced,
+% optimized or backed up independently. A shard cannot be closed by itself.
+%
+% Parameters:
+%    - `basePath` Base path of the database files.
+%    - `numShards` Number of shards. Use the same number to reopen.
+%
+% Options:
+%    - `KEY` Dotted path to the shard key. The key must not be an array or
+%      a document. Default '' routes by object id.
+%    - `READER`, `WRITER`, `CREAT`, `TRUNC`, `NOLCK`, `LCKNB`, `TSYNC`
+%      Open mode of the shards. See ejdb.open. 'WRITER' and 'CREAT' are
+%      true by default.
+%
+% Returns:
+%
+%    Database handle, and a row vector of the shard handles.
+%
+% See also ejdb.open ejdb.close
+  [database, shards] = libejdbmex(mfilename, basePath, numShards, ...
+                                  varargin{:});
+end
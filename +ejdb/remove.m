@@ -4,6 +4,9 @@ function remove(collection, id, varargin)
 %    ejdb.remove(collection, id)
 %    ejdb.remove(database, collection, id)
 %
+% `id` is an object id string, or an N-by-12 uint8 or N-by-3 uint32 matrix
+% of object ids to remove.
+%
 % See also ejdb
   libejdbmex(mfilename, collection, id, varargin{:});
 end
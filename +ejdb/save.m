@@ -4,6 +4,7 @@ function object_id = save(collection, value, varargin)
 %    object_id = ejdb.save(collection, value, ...)
 %    object_id = ejdb.save(database, collection, value, ...)
 %    object_ids = ejdb.save(collection, value1, value2, ...)
+%    object_ids = ejdb.save(..., 'OID', format)
 %
 % Samples:
 %
@@ -19,19 +20,26 @@ function object_id = save(collection, value, varargin)
 %     document struct array will be updated with this `id`
 %     and new document record will be stored.
 % To identify and update doc it should contains `id` property.
+% Missing ids are generated before saving, see ejdb.newId. In the
+% WRITEBEHIND mode of ejdb.open, the document is queued and the id is
+% returned immediately.
 %
 % Parameters:
 %
 %    - `collection` Collection name
 %    - `value` A struct to be saved
+%    - `format` Format of the returned object ids: 'string', 'binary' for
+%      an N-by-12 uint8 matrix, or 'uint32' for an N-by-3 uint32 matrix.
+%      Default: 'string'.
 %
 % Returns:
 %
-%    Cell array of saved object ids.
+%    Cell array of saved object ids, or a matrix with one row per object id
+%    in the 'binary' or 'uint32' format.
 %
 % .. NOTE:: Object id is represented as `_id` property in the database, while in Matlab
 %        the field is renamed to `id`. Use `_id` in find().
 %
-% See also ejdb
+% See also ejdb ejdb.newId
   object_id = libejdbmex(mfilename, collection, value, varargin{:});
 end
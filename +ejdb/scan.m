@@ -0,0 +1,48 @@
+function results = scan(varargin)
+%SCAN Filter all documents of a collection in parallel threads.
+%
+%    results = ejdb.scan(collection, query)
+%    results = ejdb.scan(database, collection, query)
+%    results = ejdb.scan(..., optionName, optionValue, ...)
+%
+% Samples:
+%
+%    parrots = ejdb.scan('parrots', {'size', {'$gt', 100}});
+%    parrots = ejdb.scan('parrots', {'name', {'$begin', 'Ma'}}, ...
+%                        'THREADS', 4);
+%
+% The collection is read in one pass, and the query is evaluated over the
+% raw documents in worker threads, so only matched documents are converted
+% to Matlab values. Use ejdb.scan for filters that no index can serve.
+%
+% EJDB cannot read the records of a collection in ranges, so the raw
+% documents are read in one full-scan query on the calling thread and held
+% in memory during the scan. Ranges of them are matched in the threads and
+% the hits are merged in the collection order. No index is used; prefer
+% ejdb.find when an index serves the query.
+%
+% The query supports equality, `$gt`, `$gte`, `$lt`, `$lte`, `$bt`, `$in`,
+% `$nin`, `$exists`, `$begin`, `$not` and `$and`. Numbers compare by value
+% regardless of their BSON type, and a condition on an array field matches
+% when any element matches. Other operators raise an error; use ejdb.find
+% for such queries.
+%
+% Parameters:
+%
+%    - `database` Database handle. The last opened database is used when
+%      skipped.
+%    - `collection` Collection name.
+%    - `query` Query object. See ejdb.find.
+%
+% Options:
+%
+%    - `THREADS` Number of threads. Default the number of processors.
+%    - `LAZY`, `FIELDS`, `OID` Conversion of the results. See ejdb.find.
+%
+% Returns:
+%
+%    Matched documents in the collection order.
+%
+% See also ejdb.find
+  results = libejdbmex(mfilename, varargin{:});
+end
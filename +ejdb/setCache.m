@@ -0,0 +1,36 @@
+function setCache(varargin)
+%SETCACHE Configure the result caches of a database.
+%
+%    ejdb.setCache('QUERYBYTES', bytes, 'DOCUMENTBYTES', bytes)
+%    ejdb.setCache(database, ...)
+%
+% Sample:
+%
+%    ejdb.setCache('QUERYBYTES', 64 * 2^20);
+%    parrots = ejdb.find('parrots', {});  % Queries the database.
+%    parrots = ejdb.find('parrots', {});  % Returns a copy of the cache.
+%
+% Results of ejdb.find, ejdb.findOne and ejdb.count are cached by the
+% collection, query, hints and options. Saves, updates, removes, index
+% changes, transactions and commands on a collection invalidate its cached
+% results. Results with the LAZY option are not cached.
+%
+% Documents of ejdb.load are cached by the collection, object id and
+% options. Saves and removes invalidate the cached copies of the document,
+% and updates, imports, aborted transactions and commands invalidate the
+% documents of the collection.
+%
+% Options:
+%
+%    - `QUERYBYTES` Approximate memory budget of cached query results in
+%                   bytes. The least recently used results are evicted
+%                   over the budget. 0 disables the cache.
+%    - `DOCUMENTBYTES` Approximate memory budget of cached documents of
+%                      ejdb.load in bytes. 0 disables the cache.
+%
+% A budget not given keeps its current value. Both caches are disabled
+% when a database is opened.
+%
+% See also ejdb.find ejdb.count ejdb.load ejdb.cacheStats
+  libejdbmex(mfilename, varargin{:});
+end
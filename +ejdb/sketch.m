@@ -0,0 +1,44 @@
+function state = sketch(collection, query, varargin)
+%SKETCH Compute an approximate statistics sketch of a field.
+%
+%    state = ejdb.sketch(collection, query, field, ...)
+%    state = ejdb.sketch(collection, query, hints, field, ...)
+%    state = ejdb.sketch(database, collection, query, field, ...)
+%    state = ejdb.sketch(database, collection, query, hints, field, ...)
+%
+% Samples:
+%
+%    state = ejdb.sketch('requests', {}, 'client', 'TYPE', 'hll');
+%    num_clients = ejdb.sketchEstimate(state);
+%    state = ejdb.sketch('requests', {}, 'latency', 'TYPE', 'quantiles');
+%    p = ejdb.sketchEstimate(state, [0.5, 0.95, 0.99]);
+%
+% The sketch is computed in one pass over the query results inside the
+% database with bounded memory. The returned state can be saved and merged
+% with sketches of other databases or time windows by ejdb.sketchMerge.
+%
+% Parameters:
+%
+%    - `database` Database handle. The last opened database is used when
+%      skipped.
+%    - `collection` Collection name.
+%    - `query` Query object. See ejdb.find.
+%    - `hints` Optional query hints. See ejdb.find.
+%    - `field` Dotted path to the field.
+%
+% Options:
+%
+%    - `TYPE` 'hll' to count distinct values by HyperLogLog, or 'quantiles'
+%             for quantiles of numeric values. Default 'hll'.
+%    - `PRECISION` Number of HyperLogLog index bits between 4 and 18. The
+%                  state takes 2^PRECISION bytes and the standard error is
+%                  about 1.04/sqrt(2^PRECISION). Default 14.
+%    - `ACCURACY` Relative accuracy of quantiles. Default 0.01.
+%
+% Returns:
+%
+%    uint8 row vector of the sketch state in the host byte order.
+%
+% See also ejdb.sketchEstimate ejdb.sketchMerge
+  state = libejdbmex(mfilename, collection, query, varargin{:});
+end
@@ -0,0 +1,22 @@
+function values = sketchEstimate(state, varargin)
+%SKETCHESTIMATE Estimate statistics from a sketch.
+%
+%    count = ejdb.sketchEstimate(hll_state)
+%    values = ejdb.sketchEstimate(quantiles_state)
+%    values = ejdb.sketchEstimate(quantiles_state, probabilities)
+%
+% Parameters:
+%
+%    - `state` uint8 sketch state returned by ejdb.sketch.
+%    - `probabilities` Probabilities in [0, 1] of the quantiles. Default
+%      [0.5, 0.95, 0.99].
+%
+% Returns:
+%
+%    Estimated number of distinct values of a HyperLogLog sketch, or the
+%    quantiles of the same size as probabilities. Quantiles of an empty
+%    sketch are NaN.
+%
+% See also ejdb.sketch ejdb.sketchMerge
+  values = libejdbmex(mfilename, state, varargin{:});
+end
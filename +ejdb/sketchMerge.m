@@ -0,0 +1,16 @@
+function state = sketchMerge(varargin)
+%SKETCHMERGE Merge sketches of the same type and parameters.
+%
+%    state = ejdb.sketchMerge(state1, state2, ...)
+%
+% Parameters:
+%
+%    - `stateN` uint8 sketch states returned by ejdb.sketch.
+%
+% Returns:
+%
+%    uint8 state of the sketch of all the values.
+%
+% See also ejdb.sketch ejdb.sketchEstimate
+  state = libejdbmex(mfilename, varargin{:});
+end
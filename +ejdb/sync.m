@@ -4,6 +4,9 @@ function sync(varargin)
 %    ejdb.sync
 %    ejdb.sync(database)
 %
+% In the WRITEBEHIND mode of ejdb.open, waits for the queued writes first.
+% A database of ejdb.openSharded synchronizes every shard.
+%
 % See also ejdb
   libejdbmex(mfilename, varargin{:});
 end
@@ -8,7 +8,9 @@ function num_updates = update(collection, query, varargin)
 %
 % Returns:
 %
-%    Count of updated objects
+%    Count of updated objects. In the WRITEBEHIND mode of ejdb.open the
+%    update is queued and NaN is returned, as the count is not known
+%    until the update is applied.
 %
 %
 %    `$set` and `$inc` operations are supported:
@@ -6,6 +6,7 @@
  */
 
 #include "bsonmex.h"
+#include "bsonutil.h"
 #include <ctype.h>
 #include <mex.h>
 #include <stdbool.h>
@@ -15,7 +16,7 @@
 static bool ConvertArrayToBSON(const mxArray* input,
                                const char* name,
                                bson* output);
-static mxArray* ConvertNextToMxArray(bson_iterator* it);
+static mxArray* ConvertNextToMxArray(bson_iterator* it, int flags);
 static mxArray* Convert2DOrNDArrayToCellArray(const mxArray* input);
 
 /** Convert mxArray to BSON binary.
@@ -299,42 +300,147 @@ static bool ConvertCellArrayToBSON(const mxArray* input,
   return true;
 }
 
+/** Get the number of object ids in mxArray.
+ */
+int GetNumberOfOIDs(const mxArray* input) {
+  if (mxIsChar(input) && mxGetNumberOfElements(input) == 24)
+    return 1;
+  if (mxGetNumberOfDimensions(input) != 2)
+    return -1;
+  if (mxIsUint8(input) && mxGetN(input) == 12)
+    return mxGetM(input);
+  if (mxIsUint32(input) && mxGetN(input) == 3)
+    return mxGetM(input);
+  return -1;
+}
+
+bool ConvertMxArrayToOID(const mxArray* input, int index, bson_oid_t* oid) {
+  if (mxIsChar(input)) {
+    char value[25];
+    if (index != 0 || mxGetString(input, value, sizeof(value)) != 0)
+      return false;
+    bson_oid_from_string(oid, value);
+    return true;
+  }
+  mwSize rows = mxGetM(input);
+  if (mxIsUint8(input)) {
+    const uint8_t* data = (const uint8_t*)mxGetData(input);
+    for (int i = 0; i < 12; ++i)
+      oid->bytes[i] = data[index + i * rows];
+    return true;
+  }
+  if (mxIsUint32(input)) {
+    const uint32_t* data = (const uint32_t*)mxGetData(input);
+    // Words are big-endian so that sorting rows sorts by the timestamp.
+    for (int i = 0; i < 3; ++i) {
+      uint32_t word = data[index + i * rows];
+      oid->bytes[4 * i] = (char)(word >> 24);
+      oid->bytes[4 * i + 1] = (char)(word >> 16);
+      oid->bytes[4 * i + 2] = (char)(word >> 8);
+      oid->bytes[4 * i + 3] = (char)word;
+    }
+    return true;
+  }
+  return false;
+}
+
+mxArray* ConvertOIDsToMxArray(const bson_oid_t* oids, int size, int flags) {
+  mxArray* element = NULL;
+  if (flags & BSONMEX_DECODE_OID_UINT32) {
+    element = mxCreateNumericMatrix(size, 3, mxUINT32_CLASS, mxREAL);
+    uint32_t* data = (uint32_t*)mxGetData(element);
+    for (int i = 0; i < size; ++i) {
+      const unsigned char* bytes = (const unsigned char*)oids[i].bytes;
+      for (int j = 0; j < 3; ++j)
+        data[i + j * size] = ((uint32_t)bytes[4 * j] << 24) |
+                             ((uint32_t)bytes[4 * j + 1] << 16) |
+                             ((uint32_t)bytes[4 * j + 2] << 8) |
+                             (uint32_t)bytes[4 * j + 3];
+    }
+  }
+  else if (flags & BSONMEX_DECODE_OID_BINARY) {
+    element = mxCreateNumericMatrix(size, 12, mxUINT8_CLASS, mxREAL);
+    uint8_t* data = (uint8_t*)mxGetData(element);
+    for (int i = 0; i < size; ++i)
+      for (int j = 0; j < 12; ++j)
+        data[i + j * size] = (uint8_t)oids[i].bytes[j];
+  }
+  else if (size == 1) {
+    char oid_string[32];
+    bson_oid_to_string(&oids[0], oid_string);
+    element = mxCreateString(oid_string);
+  }
+  else {
+    element = mxCreateCellMatrix(1, size);
+    for (int i = 0; i < size; ++i) {
+      char oid_string[32];
+      bson_oid_to_string(&oids[i], oid_string);
+      mxSetCell(element, i, mxCreateString(oid_string));
+    }
+  }
+  return element;
+}
+
+int GetOIDDecodeFlags(const char* format) {
+  if (strcmp(format, "string") == 0)
+    return 0;
+  if (strcmp(format, "binary") == 0)
+    return BSONMEX_DECODE_OID_BINARY;
+  if (strcmp(format, "uint32") == 0)
+    return BSONMEX_DECODE_OID_UINT32;
+  return -1;
+}
+
 /** Check if oid is given.
  */
-static bool ConvertStringToOID(const mxArray* element,
-                               bson* output) {
-  char* value = mxArrayToString(element);
+static bool ConvertMxArrayToOIDElement(const mxArray* element,
+                                       bson* output) {
   bson_oid_t oid;
-  bson_oid_from_string(&oid, value);
-  mxFree(value);
+  if (!ConvertMxArrayToOID(element, 0, &oid))
+    return false;
   return bson_append_oid(output, "_id", &oid) == BSON_OK;
 }
 
-/** Convert struct mxArray to BSON array.
+/** Convert fields of a struct element to BSON.
+ */
+static bool ConvertStructFieldsToBSON(const mxArray* input,
+                                      mwIndex index,
+                                      bool is_document,
+                                      bson* output) {
+  int num_fields = mxGetNumberOfFields(input);
+  for (int i = 0; i < num_fields; ++i) {
+    mxArray* element = mxGetFieldByNumber(input, index, i);
+    const char* field_name = mxGetFieldNameByNumber(input, i);
+    // Convert to OID only if a top-level document with id field.
+    if (is_document &&
+        strcmp(field_name, "id_") == 0 &&
+        GetNumberOfOIDs(element) == 1) {
+      if (!ConvertMxArrayToOIDElement(element, output))
+        return false;
+    }
+    else
+      if (!ConvertArrayToBSON(element, field_name, output))
+        return false;
+  }
+  return true;
+}
+
+/** Convert struct mxArray to BSON array. A top-level document without an
+ * id_ field gets the object_id prefixed as _id when given.
  */
 static bool ConvertStructArrayToBSON(const mxArray* input,
                                      const char* name,
+                                     const bson_oid_t* object_id,
                                      bson* output) {
   size_t num_elements = mxGetNumberOfElements(input);
-  int num_fields = mxGetNumberOfFields(input);
   if (num_elements == 1) {
     if (name && bson_append_start_object(output, name) != BSON_OK)
       return false;
-    for (int i = 0; i < num_fields; ++i) {
-      mxArray* element = mxGetFieldByNumber(input, 0, i);
-      const char* field_name = mxGetFieldNameByNumber(input, i);
-      // Convert string to OID only if a scalar struct with id field.
-      if (name == NULL &&
-          strcmp(field_name, "id_") == 0 &&
-          mxIsChar(element) &&
-          mxGetNumberOfElements(element) == 12) {
-        if (!ConvertStringToOID(element, output))
-          return false;
-      }
-      else
-        if (!ConvertArrayToBSON(element, field_name, output))
-          return false;
-    }
+    if (!name && object_id && mxGetFieldNumber(input, "id_") < 0 &&
+        bson_append_oid(output, "_id", object_id) != BSON_OK)
+      return false;
+    if (!ConvertStructFieldsToBSON(input, 0, name == NULL, output))
+      return false;
     if (name && bson_append_finish_object(output) != BSON_OK)
       return false;
   }
@@ -347,12 +453,8 @@ static bool ConvertStructArrayToBSON(const mxArray* input,
         return false;
       if (bson_append_start_object(output, key) != BSON_OK)
         return false;
-      for (int i = 0; i < num_fields; ++i) {
-        mxArray* element = mxGetFieldByNumber(input, 0, i);
-        const char* field_name = mxGetFieldNameByNumber(input, i);
-        if (!ConvertArrayToBSON(element, field_name, output))
-          return false;
-      }
+      if (!ConvertStructFieldsToBSON(input, j, false, output))
+        return false;
       if (bson_append_finish_object(output) != BSON_OK)
         return false;
     }
@@ -587,7 +689,7 @@ static bool ConvertArrayToBSON(const mxArray* input,
       return ConvertDoubleArrayToBSON(array, name, output);
       break;
     case mxSTRUCT_CLASS:
-      return ConvertStructArrayToBSON(array, name, output);
+      return ConvertStructArrayToBSON(array, name, NULL, output);
       break;
     case mxCELL_CLASS:
       return ConvertCellArrayToBSON(array, name, output);
@@ -699,6 +801,72 @@ static void ScanBSONObject(bson_iterator* it,
     *array_type = mxSTRUCT_CLASS;
 }
 
+/** Check if the host byte order matches the little-endian BSON encoding.
+ */
+static bool IsLittleEndian() {
+  const uint16_t value = 1;
+  return *(const uint8_t*)&value == 1;
+}
+
+/** Copy values of a homogeneous BSON array at stride.
+ *
+ * Once ScanBSONObject has found an array of a single fixed-width type, each
+ * element is a type byte, a decimal index key, and a value. Keys have the
+ * same width within each power of ten, so the elements are read in blocks of
+ * a constant stride. Only the type byte and the key terminator are checked,
+ * since the key digits have already been validated by the scan.
+ *
+ * @param it bson iterator pointing to the beginning of the array.
+ * @param size number of elements in the array.
+ * @param type BSON_DOUBLE, BSON_INT, BSON_LONG, or BSON_BOOL.
+ * @param output output buffer of the corresponding mxArray type.
+ * @return true if success. On false, the iterator is left untouched and the
+ *         caller must fall back to the generic path.
+ */
+static bool CopyBSONArrayAtStride(bson_iterator* it,
+                                  int size,
+                                  bson_type type,
+                                  void* output) {
+  size_t value_size = (type == BSON_DOUBLE || type == BSON_LONG) ? 8 :
+                      (type == BSON_INT) ? 4 :
+                      (type == BSON_BOOL) ? 1 : 0;
+  if (!value_size || !it->first || !IsLittleEndian())
+    return false;
+  const char* input = it->cur;
+  char* output_data = (char*)output;
+  size_t key_length = 1;
+  int index = 0;
+  int block_end = 10;
+  while (index < size) {
+    if (block_end > size)
+      block_end = size;
+    size_t stride = key_length + value_size + 2;
+    const char* value = input + key_length + 2;
+    if (type == BSON_BOOL) {
+      for (; index < block_end; ++index, input += stride, value += stride) {
+        if (input[0] != type || input[key_length + 1] != '\0')
+          return false;
+        *(mxLogical*)output_data = (*value != 0);
+        output_data += sizeof(mxLogical);
+      }
+    }
+    else {
+      for (; index < block_end; ++index, input += stride, value += stride) {
+        if (input[0] != type || input[key_length + 1] != '\0')
+          return false;
+        memcpy(output_data, value, value_size);
+        output_data += value_size;
+      }
+    }
+    ++key_length;
+    block_end = (block_end > 214748364) ? size : block_end * 10;
+  }
+  if (*input != BSON_EOO)
+    return false;
+  it->cur = input;
+  return true;
+}
+
 /** Convert BSON array to double mxArray.
  */
 static mxArray* ConvertBSONArrayToDoubleArray(bson_iterator* it, int size) {
@@ -706,6 +874,8 @@ static mxArray* ConvertBSONArrayToDoubleArray(bson_iterator* it, int size) {
   if (!element)
     return NULL;
   double* output_data = mxGetPr(element);
+  if (CopyBSONArrayAtStride(it, size, BSON_DOUBLE, output_data))
+    return element;
   while (bson_iterator_more(it)) {
     bson_type type = bson_iterator_next(it);
     switch (type) {
@@ -738,6 +908,8 @@ static mxArray* ConvertBSONArrayToIntegerArray(bson_iterator* it, int size) {
   if (!element)
     return NULL;
   int32_t* output_data = (int32_t*)mxGetData(element);
+  if (CopyBSONArrayAtStride(it, size, BSON_INT, output_data))
+    return element;
   while (bson_iterator_more(it)) {
     bson_type type = bson_iterator_next(it);
     switch (type) {
@@ -770,6 +942,8 @@ static mxArray* ConvertBSONArrayToLongArray(bson_iterator* it, int size) {
   if (!element)
     return NULL;
   int64_t* output_data = (int64_t*)mxGetData(element);
+  if (CopyBSONArrayAtStride(it, size, BSON_LONG, output_data))
+    return element;
   while (bson_iterator_more(it)) {
     bson_type type = bson_iterator_next(it);
     switch (type) {
@@ -802,6 +976,8 @@ static mxArray* ConvertBSONArrayToLogicalArray(bson_iterator* it, int size) {
   if (!element)
     return NULL;
   mxLogical* output_data = mxGetLogicals(element);
+  if (CopyBSONArrayAtStride(it, size, BSON_BOOL, output_data))
+    return element;
   while (bson_iterator_more(it)) {
     bson_type type = bson_iterator_next(it);
     switch (type) {
@@ -829,14 +1005,16 @@ static mxArray* ConvertBSONArrayToLogicalArray(bson_iterator* it, int size) {
 
 /** Convert BSON array to cell mxArray.
  */
-static mxArray* ConvertBSONArrayToCellArray(bson_iterator* it, int size) {
+static mxArray* ConvertBSONArrayToCellArray(bson_iterator* it,
+                                            int size,
+                                            int flags) {
   mxArray* element = mxCreateCellMatrix(1, size);
   if (!element)
     return NULL;
   int index = 0;
   bool is_end = false;
   for (int i = 0; i < size; ++i) {
-    mxArray* sub_element = ConvertNextToMxArray(it);
+    mxArray* sub_element = ConvertNextToMxArray(it, flags);
     if (!sub_element) {
       mxDestroyArray(element);
       return NULL;
@@ -923,7 +1101,8 @@ static void DestroySafekeys(int size, char** keys) {
  */
 static mxArray* ConvertBSONArrayToStructArray(bson_iterator* it,
                                               int size,
-                                              const char** keys) {
+                                              const char** keys,
+                                              int flags) {
   char** safe_keys = CreateSafeKeys(size, keys);
   if (!safe_keys)
     return NULL;
@@ -936,7 +1115,7 @@ static mxArray* ConvertBSONArrayToStructArray(bson_iterator* it,
     return NULL;
   int index = 0;
   for (int i = 0; i < size; ++i) {
-    mxArray* sub_element = ConvertNextToMxArray(it);
+    mxArray* sub_element = ConvertNextToMxArray(it, flags);
     if (!sub_element) {
       mxDestroyArray(element);
       return NULL;
@@ -1182,7 +1361,7 @@ void TryMergeCellToNDArray(mxArray** array) {
 
 /** Convert a BSON array to an appropriate MxArray type.
  */
-mxArray* ConvertBSONIteratorToMxArray(bson_iterator* it) {
+mxArray* ConvertBSONIteratorToMxArray(bson_iterator* it, int flags) {
   mxArray* element = NULL;
   bson_iterator iterator_copy = *it;
   // Check the array type.
@@ -1208,15 +1387,15 @@ mxArray* ConvertBSONIteratorToMxArray(bson_iterator* it) {
     case mxCHAR_CLASS:
     case mxUINT8_CLASS:
       if (object_size == 1)
-        element = ConvertNextToMxArray(it);
+        element = ConvertNextToMxArray(it, flags);
       else
-        element = ConvertBSONArrayToCellArray(it, object_size);
+        element = ConvertBSONArrayToCellArray(it, object_size, flags);
       break;
     case mxCELL_CLASS:
-      element = ConvertBSONArrayToCellArray(it, object_size);
+      element = ConvertBSONArrayToCellArray(it, object_size, flags);
       break;
     case mxSTRUCT_CLASS:
-      element = ConvertBSONArrayToStructArray(it, object_size, keys);
+      element = ConvertBSONArrayToStructArray(it, object_size, keys, flags);
       break;
     default:
       break;
@@ -1230,9 +1409,15 @@ mxArray* ConvertBSONIteratorToMxArray(bson_iterator* it) {
 
 /** Proceed to next and Convert a BSON value.
  */
-static mxArray* ConvertNextToMxArray(bson_iterator* it) {
+static mxArray* ConvertNextToMxArray(bson_iterator* it, int flags) {
+  if (bson_iterator_next(it) == BSON_EOO)
+    return NULL;
+  return ConvertBSONValueToMxArray(it, flags);
+}
+
+mxArray* ConvertBSONValueToMxArray(bson_iterator* it, int flags) {
   mxArray* element = NULL;
-  bson_type type = bson_iterator_next(it);
+  bson_type type = bson_iterator_type(it);
   switch (type) {
     case BSON_EOO:
       break;
@@ -1247,7 +1432,7 @@ static mxArray* ConvertNextToMxArray(bson_iterator* it) {
     case BSON_ARRAY: {
       bson_iterator sub_iterator;
       bson_iterator_subiterator(it, &sub_iterator);
-      element = ConvertBSONIteratorToMxArray(&sub_iterator);
+      element = ConvertBSONIteratorToMxArray(&sub_iterator, flags);
       break;
     }
     case BSON_BINDATA: {
@@ -1259,12 +1444,9 @@ static mxArray* ConvertNextToMxArray(bson_iterator* it) {
       memcpy(mxGetData(element), bson_iterator_bin_data(it), element_size);
       break;
     }
-    case BSON_OID: {
-      char oid_string[32];
-      bson_oid_to_string(bson_iterator_oid(it), oid_string);
-      element = mxCreateString(oid_string);
+    case BSON_OID:
+      element = ConvertOIDsToMxArray(bson_iterator_oid(it), 1, flags);
       break;
-    }
     case BSON_BOOL:
       element = mxCreateLogicalScalar(bson_iterator_bool(it));
       break;
@@ -1310,6 +1492,170 @@ static mxArray* ConvertNextToMxArray(bson_iterator* it) {
   return element;
 }
 
+mxArray* CreateProjectionStruct(int num_paths,
+                                const char** paths,
+                                mwSize size) {
+  char** safe_keys = CreateSafeKeys(num_paths, paths);
+  if (!safe_keys)
+    return NULL;
+  mxArray* element = mxCreateStructMatrix(1,
+                                          size,
+                                          num_paths,
+                                          (const char**)safe_keys);
+  DestroySafekeys(num_paths, safe_keys);
+  return element;
+}
+
+bool ConvertBSONPathsToStruct(const char* data,
+                              int num_paths,
+                              const char** paths,
+                              mxArray* output,
+                              mwIndex index,
+                              int flags) {
+  for (int i = 0; i < num_paths; ++i) {
+    bson_iterator it;
+    bson_iterator_from_buffer(&it, data);
+    mxArray* value = (FindBSONPath(&it, paths[i]) != BSON_EOO) ?
+                     ConvertBSONValueToMxArray(&it, flags) :
+                     mxCreateDoubleMatrix(0, 0, mxREAL);
+    if (!value)
+      return false;
+    mxSetFieldByNumber(output, index, i, value);
+  }
+  return true;
+}
+
+/** Stack a cell column of binary object ids to an N-by-K matrix.
+ */
+static mxArray* CollapseOIDColumn(mxArray* column, int flags) {
+  mxClassID class_id = (flags & BSONMEX_DECODE_OID_UINT32) ?
+                       mxUINT32_CLASS : mxUINT8_CLASS;
+  size_t width = (class_id == mxUINT32_CLASS) ? 3 : 12;
+  size_t element_size = (class_id == mxUINT32_CLASS) ? 4 : 1;
+  size_t size = mxGetNumberOfElements(column);
+  for (int i = 0; i < size; ++i) {
+    mxArray* value = mxGetCell(column, i);
+    if (!value ||
+        mxGetClassID(value) != class_id ||
+        mxGetM(value) != 1 ||
+        mxGetN(value) != width)
+      return NULL;
+  }
+  mxArray* new_column = mxCreateNumericMatrix(size, width, class_id, mxREAL);
+  char* output_data = (char*)mxGetData(new_column);
+  for (int i = 0; i < size; ++i) {
+    const char* value_data = (const char*)mxGetData(mxGetCell(column, i));
+    for (int j = 0; j < width; ++j)
+      memcpy(output_data + (i + j * size) * element_size,
+             value_data + j * element_size,
+             element_size);
+  }
+  return new_column;
+}
+
+mxArray* CollapseCellColumn(mxArray* column, int flags) {
+  size_t size = mxGetNumberOfElements(column);
+  if (size > 0 &&
+      (flags & (BSONMEX_DECODE_OID_BINARY | BSONMEX_DECODE_OID_UINT32))) {
+    mxArray* new_column = CollapseOIDColumn(column, flags);
+    if (new_column) {
+      mxDestroyArray(column);
+      return new_column;
+    }
+  }
+  bool is_double = true, is_logical = true, is_missing = false;
+  for (int i = 0; i < size; ++i) {
+    mxArray* value = mxGetCell(column, i);
+    if (!value) {
+      is_missing = true;
+      continue;
+    }
+    bool is_scalar = mxGetNumberOfElements(value) == 1;
+    is_double &= is_scalar && mxIsDouble(value);
+    is_logical &= is_scalar && mxIsLogical(value);
+  }
+  if (is_logical && !is_missing) {
+    mxArray* new_column = mxCreateLogicalMatrix(size, 1);
+    mxLogical* output_data = mxGetLogicals(new_column);
+    for (int i = 0; i < size; ++i)
+      output_data[i] = *mxGetLogicals(mxGetCell(column, i));
+    mxDestroyArray(column);
+    return new_column;
+  }
+  if (is_double && !is_logical) {
+    mxArray* new_column = mxCreateDoubleMatrix(size, 1, mxREAL);
+    double* output_data = mxGetPr(new_column);
+    for (int i = 0; i < size; ++i) {
+      mxArray* value = mxGetCell(column, i);
+      output_data[i] = (value) ? mxGetScalar(value) : mxGetNaN();
+    }
+    mxDestroyArray(column);
+    return new_column;
+  }
+  return column;
+}
+
+mxArray* ConvertBSONDocumentsToColumns(const char* const* documents,
+                                       int num_documents,
+                                       int flags) {
+  int num_keys = 0;
+  const char** keys = NULL;
+  mxArray** columns = NULL;
+  for (int i = 0; i < num_documents; ++i) {
+    bson_iterator it;
+    bson_iterator_from_buffer(&it, documents[i]);
+    int position = 0;
+    while (bson_iterator_next(&it) != BSON_EOO) {
+      const char* key = bson_iterator_key(&it);
+      // Documents usually share the key order, so try the same position.
+      int index = position;
+      if (index >= num_keys || strcmp(keys[index], key) != 0) {
+        for (index = 0; index < num_keys; ++index)
+          if (strcmp(keys[index], key) == 0)
+            break;
+      }
+      if (index == num_keys) {
+        keys = (const char**)mxRealloc(keys, (num_keys + 1) * sizeof(char*));
+        columns = (mxArray**)mxRealloc(columns,
+                                       (num_keys + 1) * sizeof(mxArray*));
+        keys[num_keys] = key;
+        columns[num_keys] = mxCreateCellMatrix(num_documents, 1);
+        ++num_keys;
+      }
+      position = index + 1;
+      // Keep the first value of a duplicated key.
+      if (mxGetCell(columns[index], i))
+        continue;
+      mxArray* value = ConvertBSONValueToMxArray(&it, flags);
+      if (!value) {
+        for (int j = 0; j < num_keys; ++j)
+          mxDestroyArray(columns[j]);
+        mxFree(columns);
+        mxFree(keys);
+        return NULL;
+      }
+      mxSetCell(columns[index], i, value);
+    }
+  }
+  char** safe_keys = CreateSafeKeys(num_keys, keys);
+  mxArray* element = (safe_keys) ?
+      mxCreateStructMatrix(1, 1, num_keys, (const char**)safe_keys) : NULL;
+  if (safe_keys)
+    DestroySafekeys(num_keys, safe_keys);
+  for (int j = 0; j < num_keys; ++j) {
+    if (element)
+      mxSetFieldByNumber(element,
+                         0,
+                         j,
+                         CollapseCellColumn(columns[j], flags));
+    else
+      mxDestroyArray(columns[j]);
+  }
+  mxFree(columns);
+  mxFree(keys);
+  return element;
+}
+
 bool ConvertMxArrayToBSON(const mxArray* input, int flags, bson* output) {
   if (flags & BSON_FLAG_QUERY_MODE)
     bson_init_as_query(output);
@@ -1322,9 +1668,49 @@ bool ConvertMxArrayToBSON(const mxArray* input, int flags, bson* output) {
   return bson_finish(output) == BSON_OK;
 }
 
+bool ConvertMxArrayToBSONWithId(const mxArray* input,
+                                const bson_oid_t* object_id,
+                                bson* output) {
+  bson_init(output);
+  bool success = (mxIsStruct(input) && mxGetNumberOfElements(input) == 1) ?
+      ConvertStructArrayToBSON(input, NULL, object_id, output) :
+      ConvertArrayToBSON(input, NULL, output);
+  if (!success) {
+    bson_destroy(output);
+    return false;
+  }
+  return bson_finish(output) == BSON_OK;
+}
+
+bool ConvertMxArrayToBSONElement(const mxArray* input,
+                                 const char* name,
+                                 bson* output) {
+  bson_init(output);
+  if (!ConvertArrayToBSON(input, name, output)) {
+    bson_destroy(output);
+    return false;
+  }
+  return bson_finish(output) == BSON_OK;
+}
+
+bool ConvertStructElementToBSON(const mxArray* input,
+                                mwIndex index,
+                                int flags,
+                                bson* output) {
+  if (flags & BSON_FLAG_QUERY_MODE)
+    bson_init_as_query(output);
+  else
+    bson_init(output);
+  if (!ConvertStructFieldsToBSON(input, index, true, output)) {
+    bson_destroy(output);
+    return false;
+  }
+  return bson_finish(output) == BSON_OK;
+}
+
 bool ConvertBSONToMxArray(const bson* input, mxArray** output) {
   bson_iterator it;
   bson_iterator_init(&it, input);
-  *output = ConvertBSONIteratorToMxArray(&it);
+  *output = ConvertBSONIteratorToMxArray(&it, 0);
   return *output != NULL;
 }
\ No newline at end of file
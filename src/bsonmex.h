@@ -9,6 +9,11 @@
 #include <bson.h>
 #include <matrix.h>
 
+/** Decode object ids to an N-by-12 uint8 matrix instead of strings. */
+#define BSONMEX_DECODE_OID_BINARY (1 << 0)
+/** Decode object ids to an N-by-3 big-endian uint32 matrix. */
+#define BSONMEX_DECODE_OID_UINT32 (1 << 1)
+
 /** Convert mxArray* to bson.
  * @param input mxArray to convert to bson.
  * @param flags options to change the behavior.
@@ -18,6 +23,42 @@
  * @return true if success.
  */
 EXTERN_C bool ConvertMxArrayToBSON(const mxArray* input, int flags, bson* output);
+/** Convert mxArray* to a bson document with an object id.
+ * The object id is prefixed as _id when the input is a scalar struct
+ * without an id_ field, so that the id is known before saving.
+ * @param input mxArray to convert to bson.
+ * @param object_id object id to prefix, e.g., from GenerateObjectIds().
+ * @param output bson object to be created. Caller is responsible for calling
+ *               bson_destroy() after use.
+ * @return true if success.
+ */
+EXTERN_C bool ConvertMxArrayToBSONWithId(const mxArray* input,
+                                         const bson_oid_t* object_id,
+                                         bson* output);
+/** Convert an element of struct array mxArray* to a bson document.
+ * This avoids creating a scalar struct for each element.
+ * @param input struct array to convert.
+ * @param index index of the element to convert.
+ * @param flags options to change the behavior. See ConvertMxArrayToBSON().
+ * @param output bson object to be created. Caller is responsible for calling
+ *               bson_destroy() after use.
+ * @return true if success.
+ */
+EXTERN_C bool ConvertStructElementToBSON(const mxArray* input,
+                                         mwIndex index,
+                                         int flags,
+                                         bson* output);
+/** Convert mxArray* to a document holding a single named element.
+ * The element can then be copied into another document without re-encoding.
+ * @param input mxArray to convert.
+ * @param name key of the element.
+ * @param output bson object to be created. Caller is responsible for calling
+ *               bson_destroy() after use.
+ * @return true if success.
+ */
+EXTERN_C bool ConvertMxArrayToBSONElement(const mxArray* input,
+                                          const char* name,
+                                          bson* output);
 /** Convert bson to mxArray*.
  * @param input bson object to convert to mxArray.
  * @param output mxArray to be created.
@@ -27,10 +68,100 @@ EXTERN_C bool ConvertBSONToMxArray(const bson* input, mxArray** output);
 /** Convert bson iterator to mxArray*. The iterator must be pointing to a BSON
  * array.
  * @param it bson iterator to convert to mxArray.
- * @param output mxArray to be created.
+ * @param flags decoder options, e.g., BSONMEX_DECODE_OID_BINARY.
  * @return Newly allocated mxArray, or NULL if unsuccessful.
  */
-EXTERN_C mxArray* ConvertBSONIteratorToMxArray(bson_iterator* it);
+EXTERN_C mxArray* ConvertBSONIteratorToMxArray(bson_iterator* it, int flags);
+/** Convert the BSON value at the current iterator position to mxArray*.
+ * Unlike ConvertBSONIteratorToMxArray, the iterator is not advanced, so this
+ * converts a single element found by, e.g., FindBSONPath().
+ * @param it bson iterator pointing to the element to convert.
+ * @param flags decoder options, e.g., BSONMEX_DECODE_OID_BINARY.
+ * @return Newly allocated mxArray, or NULL if unsuccessful.
+ */
+EXTERN_C mxArray* ConvertBSONValueToMxArray(bson_iterator* it, int flags);
+/** Create a struct array to hold projected fields.
+ * @param num_paths number of dotted paths.
+ * @param paths dotted paths. Field names are made matlab-safe, e.g., "a.b"
+ *              becomes "a_b" and "_id" becomes "id_".
+ * @param size number of elements in the struct array.
+ * @return Newly allocated 1-by-size struct array, or NULL if unsuccessful.
+ */
+EXTERN_C mxArray* CreateProjectionStruct(int num_paths,
+                                         const char** paths,
+                                         mwSize size);
+/** Convert only the given paths of a BSON document into a struct element.
+ * Other elements are skipped by their encoded size without conversion.
+ * Missing fields are set to [].
+ * @param data BSON data.
+ * @param num_paths number of dotted paths.
+ * @param paths dotted paths to convert.
+ * @param output struct array made by CreateProjectionStruct().
+ * @param index index of the struct element to fill.
+ * @param flags decoder options, e.g., BSONMEX_DECODE_OID_BINARY.
+ * @return true if success.
+ */
+EXTERN_C bool ConvertBSONPathsToStruct(const char* data,
+                                       int num_paths,
+                                       const char** paths,
+                                       mxArray* output,
+                                       mwIndex index,
+                                       int flags);
+/** Convert a sequence of BSON documents to a columnar struct.
+ * Each top-level key becomes a num_documents-by-1 column. Columns of double
+ * scalars become a double vector with NaN for missing values, columns of
+ * logical scalars without missing values become a logical vector, binary
+ * object ids without missing values become an N-by-12 or N-by-3 matrix, and
+ * any other column is a cell array with [] for missing values.
+ * @param documents pointers to BSON data.
+ * @param num_documents number of documents.
+ * @param flags decoder options, e.g., BSONMEX_DECODE_OID_BINARY.
+ * @return Newly allocated 1x1 struct, or NULL if unsuccessful.
+ */
+EXTERN_C mxArray* ConvertBSONDocumentsToColumns(const char* const* documents,
+                                                int num_documents,
+                                                int flags);
+/** Collapse a cell column of values to a numeric or logical column.
+ * Double scalars become a double vector with NaN for missing values,
+ * logical scalars without missing values become a logical vector, and
+ * binary object ids without missing values become an N-by-12 or N-by-3
+ * matrix. Otherwise the column is returned as is.
+ * @param column N-by-1 cell array with NULL cells for missing values. The
+ *               column is destroyed when a new array is returned.
+ * @param flags decoder options used to make the values.
+ * @return collapsed column, or the column itself.
+ */
+EXTERN_C mxArray* CollapseCellColumn(mxArray* column, int flags);
+/** Get the number of object ids in mxArray.
+ * @param input a 24-character string, an N-by-12 uint8 matrix, or an N-by-3
+ *              uint32 matrix.
+ * @return number of object ids, or -1 if input is not an object id.
+ */
+EXTERN_C int GetNumberOfOIDs(const mxArray* input);
+/** Convert an object id in mxArray to bson_oid_t.
+ * @param input mxArray accepted by GetNumberOfOIDs().
+ * @param index row of the object id.
+ * @param oid object id to be set.
+ * @return true if success.
+ */
+EXTERN_C bool ConvertMxArrayToOID(const mxArray* input,
+                                  int index,
+                                  bson_oid_t* oid);
+/** Convert object ids to mxArray*.
+ * @param oids object ids to convert.
+ * @param size number of object ids.
+ * @param flags decoder options. Without BSONMEX_DECODE_OID_BINARY or
+ *              BSONMEX_DECODE_OID_UINT32, a string or a cellstr is created.
+ * @return Newly allocated mxArray.
+ */
+EXTERN_C mxArray* ConvertOIDsToMxArray(const bson_oid_t* oids,
+                                       int size,
+                                       int flags);
+/** Get decoder flags from the name of the object id format.
+ * @param format "string", "binary", or "uint32".
+ * @return decoder flags, or -1 if the format is unknown.
+ */
+EXTERN_C int GetOIDDecodeFlags(const char* format);
 /** Try to merge cell array to N-D array in place.
  * @param array mxArray to be merged into N-D.
  */
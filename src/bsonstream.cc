@@ -0,0 +1,107 @@
+/// Memory-mapped BSON dump file reader and buffered writer.
+
+#include "bsonstream.h"
+#include "bsonutil.h"
+#include <errno.h>
+#include <string.h>
+
+namespace {
+
+/// Size of the stdio buffer used by the writer.
+const size_t kWriteBufferSize = 1 << 20;
+
+} // namespace
+
+namespace bsonmex {
+
+BSONStream::BSONStream() : position_(0), file_(NULL) {}
+
+BSONStream::~BSONStream() {
+  close();
+}
+
+bool BSONStream::open(const char* filename, bool write, bool append) {
+  if (isOpen())
+    close();
+  error_.clear();
+  position_ = 0;
+  if (write) {
+    file_ = fopen(filename, (append) ? "ab" : "wb");
+    if (!file_)
+      return setError(filename);
+    buffer_.resize(kWriteBufferSize);
+    setvbuf(file_, &buffer_[0], _IOFBF, buffer_.size());
+    if (append) {
+      fseek(file_, 0, SEEK_END);
+      position_ = ftell(file_);
+    }
+    return true;
+  }
+  if (!mapped_file_.open(filename)) {
+    error_ = mapped_file_.errorMessage();
+    return false;
+  }
+  return true;
+}
+
+bool BSONStream::isOpen() const {
+  return mapped_file_.isOpen() || file_ != NULL;
+}
+
+bool BSONStream::close() {
+  bool success = true;
+  mapped_file_.close();
+  if (file_) {
+    success = (fclose(file_) == 0);
+    if (!success)
+      setError("Failed to close");
+    file_ = NULL;
+    buffer_.clear();
+  }
+  return success;
+}
+
+bool BSONStream::read(int count, std::vector<const char*>* documents) {
+  documents->clear();
+  if (!mapped_file_.isOpen()) {
+    error_ = "Stream is not open for reading.";
+    return false;
+  }
+  // Documents handed out last time are no longer referenced.
+  mapped_file_.release(position_);
+  const char* data = mapped_file_.data();
+  size_t size = mapped_file_.size();
+  while (documents->size() < static_cast<size_t>(count) && position_ < size) {
+    if (!CheckBSONBuffer(data + position_, size - position_)) {
+      char message[64];
+      snprintf(message, sizeof(message),
+               "Invalid BSON document at byte %lu.",
+               static_cast<unsigned long>(position_));
+      error_ = message;
+      return false;
+    }
+    int32_t document_size;
+    bson_little_endian32(&document_size, data + position_);
+    documents->push_back(data + position_);
+    position_ += document_size;
+  }
+  return true;
+}
+
+bool BSONStream::write(const char* data, size_t size) {
+  if (!file_) {
+    error_ = "Stream is not open for writing.";
+    return false;
+  }
+  if (fwrite(data, 1, size, file_) != size)
+    return setError("Failed to write");
+  position_ += size;
+  return true;
+}
+
+bool BSONStream::setError(const char* message) {
+  error_ = std::string(message) + ": " + strerror(errno);
+  return false;
+}
+
+} // namespace bsonmex
@@ -0,0 +1,71 @@
+/// Memory-mapped BSON dump file reader and buffered writer.
+
+#ifndef __BSONSTREAM_H__
+#define __BSONSTREAM_H__
+
+#include "mappedfile.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace bsonmex {
+
+/// Stream of concatenated BSON documents in a file, e.g., mongodump output.
+/// A reader maps the file in memory and hands out pointers to documents in
+/// place. Pages already consumed are released on the next read, so that a
+/// sequential scan runs in constant resident memory. A writer appends
+/// documents through a stdio buffer.
+class BSONStream {
+public:
+  /// Empty constructor.
+  BSONStream();
+  /// Destructor. Closes the stream if open.
+  virtual ~BSONStream();
+  /// Open a file for reading, or for writing when write is true.
+  /// @param filename path to the file.
+  /// @param write open for writing.
+  /// @param append keep existing documents when writing.
+  /// @return true if success.
+  bool open(const char* filename, bool write, bool append);
+  /// Check if open.
+  bool isOpen() const;
+  /// Check if open for writing.
+  bool isWriter() const { return file_ != NULL; }
+  /// Close the stream. Buffered documents are flushed.
+  /// @return true if success.
+  bool close();
+  /// Read the next documents.
+  /// @param count maximum number of documents to read.
+  /// @param documents pointers to the documents in the mapped file. Valid
+  ///                  until the next call to read() or close().
+  /// @return true if success, false if a malformed document is found.
+  bool read(int count, std::vector<const char*>* documents);
+  /// Append a document.
+  /// @param data BSON document.
+  /// @param size size of the document in bytes.
+  /// @return true if success.
+  bool write(const char* data, size_t size);
+  /// Byte offset of the next document to read, or bytes written so far.
+  size_t position() const { return position_; }
+  /// Last error message.
+  const char* errorMessage() const { return error_.c_str(); }
+
+private:
+  /// Set the error message from errno.
+  bool setError(const char* message);
+
+  /// Mapped file of the reader.
+  MappedFile mapped_file_;
+  /// Current position in bytes.
+  size_t position_;
+  /// File handle of the writer.
+  FILE* file_;
+  /// Write buffer attached to file_.
+  std::vector<char> buffer_;
+  /// Last error message.
+  std::string error_;
+};
+
+} // namespace bsonmex
+
+#endif // __BSONSTREAM_H__
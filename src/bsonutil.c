@@ -0,0 +1,509 @@
+/** Raw BSON buffer utilities implementation.
+ */
+
+#include "bsonutil.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Maximum nesting level of documents to check.
+ */
+#define MAX_BSON_DEPTH 128
+
+/** Read a little-endian int32 value.
+ */
+static int32_t ReadInt32(const char* data) {
+  int32_t value;
+  bson_little_endian32(&value, data);
+  return value;
+}
+
+/** Check a length-prefixed, null-terminated string value.
+ */
+static bool CheckBSONString(const char* data, size_t length, size_t* size) {
+  if (length < 5)
+    return false;
+  int32_t string_size = ReadInt32(data);
+  if (string_size < 1 || (size_t)string_size > length - 4 ||
+      data[4 + string_size - 1] != '\0')
+    return false;
+  *size = 4 + string_size;
+  return true;
+}
+
+static bool CheckBSONDocument(const char* data, size_t length, int depth);
+
+/** Check the value of an element and compute its size.
+ */
+static bool CheckBSONValue(int type,
+                           const char* data,
+                           size_t length,
+                           int depth,
+                           size_t* size) {
+  switch (type) {
+    case BSON_DOUBLE:
+    case BSON_DATE:
+    case BSON_TIMESTAMP:
+    case BSON_LONG:
+      *size = 8;
+      break;
+    case BSON_INT:
+      *size = 4;
+      break;
+    case BSON_BOOL:
+      *size = 1;
+      break;
+    case BSON_NULL:
+    case BSON_UNDEFINED:
+      *size = 0;
+      break;
+    case BSON_OID:
+      *size = 12;
+      break;
+    case BSON_STRING:
+    case BSON_CODE:
+    case BSON_SYMBOL:
+      return CheckBSONString(data, length, size);
+    case BSON_OBJECT:
+    case BSON_ARRAY:
+      if (!CheckBSONDocument(data, length, depth + 1))
+        return false;
+      *size = ReadInt32(data);
+      break;
+    case BSON_BINDATA: {
+      if (length < 5)
+        return false;
+      int32_t binary_size = ReadInt32(data);
+      if (binary_size < 0)
+        return false;
+      *size = 5 + (size_t)binary_size;
+      break;
+    }
+    case BSON_REGEX: {
+      const char* pattern_end = memchr(data, '\0', length);
+      if (!pattern_end)
+        return false;
+      const char* options = pattern_end + 1;
+      const char* options_end = memchr(options,
+                                       '\0',
+                                       length - (options - data));
+      if (!options_end)
+        return false;
+      *size = options_end + 1 - data;
+      break;
+    }
+    case BSON_DBREF:
+      if (!CheckBSONString(data, length, size))
+        return false;
+      *size += 12;
+      break;
+    case BSON_CODEWSCOPE: {
+      if (length < 4)
+        return false;
+      int32_t total_size = ReadInt32(data);
+      size_t string_size;
+      if (total_size < 14 || (size_t)total_size > length ||
+          !CheckBSONString(data + 4, total_size - 4, &string_size) ||
+          !CheckBSONDocument(data + 4 + string_size,
+                             total_size - 4 - string_size,
+                             depth + 1))
+        return false;
+      *size = total_size;
+      break;
+    }
+    default:
+      return false;
+  }
+  return *size <= length;
+}
+
+/** Check a document within the given length.
+ */
+static bool CheckBSONDocument(const char* data, size_t length, int depth) {
+  if (length < 5 || depth > MAX_BSON_DEPTH)
+    return false;
+  int32_t document_size = ReadInt32(data);
+  if (document_size < 5 || (size_t)document_size > length ||
+      data[document_size - 1] != '\0')
+    return false;
+  const char* cursor = data + 4;
+  const char* end = data + document_size - 1;
+  while (cursor < end) {
+    int type = (unsigned char)*cursor++;
+    const char* key_end = memchr(cursor, '\0', end - cursor);
+    if (!key_end)
+      return false;
+    cursor = key_end + 1;
+    size_t value_size;
+    if (!CheckBSONValue(type, cursor, end - cursor, depth, &value_size))
+      return false;
+    cursor += value_size;
+  }
+  return cursor == end;
+}
+
+bool CheckBSONBuffer(const char* data, size_t length) {
+  return data != NULL && CheckBSONDocument(data, length, 0);
+}
+
+/** Check the framing of a document, without its elements.
+ */
+static bool CheckBSONFrame(const char* data, size_t length) {
+  if (length < 5)
+    return false;
+  int32_t document_size = ReadInt32(data);
+  return document_size >= 5 && (size_t)document_size <= length &&
+         data[document_size - 1] == '\0';
+}
+
+bool CheckBSONPath(const char* data, size_t length, const char* path) {
+  if (!data || !CheckBSONFrame(data, length))
+    return false;
+  int depth = 0;
+  while (true) {
+    const char* separator = strchr(path, '.');
+    size_t key_length = (separator) ? (size_t)(separator - path) :
+                                      strlen(path);
+    const char* cursor = data + 4;
+    const char* end = data + ReadInt32(data) - 1;
+    const char* found = NULL;
+    int found_type = BSON_EOO;
+    while (cursor < end) {
+      int type = (unsigned char)*cursor++;
+      const char* key = cursor;
+      const char* key_end = memchr(cursor, '\0', end - cursor);
+      if (!key_end)
+        return false;
+      cursor = key_end + 1;
+      bool matched = (size_t)(key_end - key) == key_length &&
+                     strncmp(key, path, key_length) == 0;
+      size_t value_size;
+      if (type == BSON_OBJECT || type == BSON_ARRAY) {
+        // Skipped documents are walked by their size alone.
+        if (!CheckBSONFrame(cursor, end - cursor))
+          return false;
+        value_size = ReadInt32(cursor);
+        if (matched && !separator &&
+            !CheckBSONDocument(cursor, value_size, depth + 1))
+          return false;
+      }
+      else if (!CheckBSONValue(type, cursor, end - cursor, depth, &value_size))
+        return false;
+      if (matched && !found) {
+        found = cursor;
+        found_type = type;
+      }
+      cursor += value_size;
+    }
+    if (cursor != end)
+      return false;
+    if (!found || !separator)
+      return true;
+    if (found_type != BSON_OBJECT && found_type != BSON_ARRAY)
+      return true;
+    data = found;
+    length = ReadInt32(found);
+    path = separator + 1;
+    if (++depth > MAX_BSON_DEPTH)
+      return false;
+  }
+}
+
+/** Find a key in the current document level.
+ */
+static bson_type FindBSONKey(bson_iterator* it,
+                             const char* key,
+                             size_t key_length) {
+  bson_type type;
+  while ((type = bson_iterator_next(it)) != BSON_EOO) {
+    const char* element_key = bson_iterator_key(it);
+    if (strncmp(element_key, key, key_length) == 0 &&
+        element_key[key_length] == '\0')
+      return type;
+  }
+  return BSON_EOO;
+}
+
+bson_type FindBSONPath(bson_iterator* it, const char* path) {
+  bson_type type = BSON_EOO;
+  while (true) {
+    const char* separator = strchr(path, '.');
+    size_t key_length = (separator) ? separator - path : strlen(path);
+    type = FindBSONKey(it, path, key_length);
+    if (type == BSON_EOO || !separator)
+      break;
+    if (type != BSON_OBJECT && type != BSON_ARRAY)
+      return BSON_EOO;
+    bson_iterator sub_iterator;
+    bson_iterator_subiterator(it, &sub_iterator);
+    *it = sub_iterator;
+    path = separator + 1;
+  }
+  return type;
+}
+
+/** Growable output of a document splice.
+ */
+typedef struct {
+  char* data;
+  size_t size;
+  size_t capacity;
+} SpliceBuffer;
+
+/** Append bytes to the splice buffer.
+ */
+static bool AppendSplice(SpliceBuffer* buffer, const void* data, size_t size) {
+  if (buffer->size + size > buffer->capacity) {
+    size_t capacity = (buffer->capacity) ? buffer->capacity : 256;
+    while (capacity < buffer->size + size)
+      capacity *= 2;
+    char* new_data = (char*)realloc(buffer->data, capacity);
+    if (!new_data)
+      return false;
+    buffer->data = new_data;
+    buffer->capacity = capacity;
+  }
+  memcpy(buffer->data + buffer->size, data, size);
+  buffer->size += size;
+  return true;
+}
+
+/** Write a little-endian int32 value at the offset of the splice buffer.
+ */
+static void WriteSpliceInt32(SpliceBuffer* buffer,
+                             size_t offset,
+                             int32_t value) {
+  bson_little_endian32(buffer->data + offset, &value);
+}
+
+/** Copy the document to the buffer with the element at the path replaced by
+ * the given value, or removed when value is NULL.
+ */
+static bool SpliceBSONPath(const char* data,
+                           bool is_array,
+                           const char* path,
+                           bson_type type,
+                           const char* value,
+                           size_t value_size,
+                           SpliceBuffer* buffer) {
+  static const char kEmptyDocument[5] = {5, 0, 0, 0, 0};
+  const char* separator = strchr(path, '.');
+  size_t key_length = (separator) ? (size_t)(separator - path) : strlen(path);
+  if (key_length == 0)
+    return false;
+  size_t start = buffer->size;
+  if (!AppendSplice(buffer, kEmptyDocument, 4))
+    return false;
+  bool found = false;
+  int count = 0;
+  bson_iterator it;
+  bson_iterator_from_buffer(&it, data);
+  bson_type element_type;
+  while ((element_type = bson_iterator_next(&it)) != BSON_EOO) {
+    ++count;
+    const char* element = it.cur;
+    const char* key = bson_iterator_key(&it);
+    bson_iterator next = it;
+    bson_iterator_next(&next);
+    if (found || strncmp(key, path, key_length) != 0 ||
+        key[key_length] != '\0') {
+      if (!AppendSplice(buffer, element, next.cur - element))
+        return false;
+      continue;
+    }
+    found = true;
+    if (!separator) {
+      if (!value)
+        continue;
+      char value_type = type;
+      if (!AppendSplice(buffer, &value_type, 1) ||
+          !AppendSplice(buffer, key, key_length + 1) ||
+          !AppendSplice(buffer, value, value_size))
+        return false;
+    }
+    else if (element_type != BSON_OBJECT && element_type != BSON_ARRAY) {
+      // Nothing to unset below a non-document element.
+      if (value || !AppendSplice(buffer, element, next.cur - element))
+        return false;
+    }
+    else {
+      if (!AppendSplice(buffer, element, 1 + key_length + 1) ||
+          !SpliceBSONPath(bson_iterator_value(&it),
+                          element_type == BSON_ARRAY,
+                          separator + 1,
+                          type,
+                          value,
+                          value_size,
+                          buffer))
+        return false;
+    }
+  }
+  if (!found && value) {
+    // Arrays only grow by the next index to stay contiguous.
+    char index[16];
+    if (is_array &&
+        ((size_t)snprintf(index, sizeof(index), "%d", count) != key_length ||
+         strncmp(index, path, key_length) != 0))
+      return false;
+    char element_type = (separator) ? BSON_OBJECT : type;
+    if (!AppendSplice(buffer, &element_type, 1) ||
+        !AppendSplice(buffer, path, key_length) ||
+        !AppendSplice(buffer, kEmptyDocument + 4, 1))
+      return false;
+    if (separator) {
+      if (!SpliceBSONPath(kEmptyDocument,
+                          false,
+                          separator + 1,
+                          type,
+                          value,
+                          value_size,
+                          buffer))
+        return false;
+    }
+    else if (!AppendSplice(buffer, value, value_size))
+      return false;
+  }
+  if (!AppendSplice(buffer, kEmptyDocument + 4, 1))
+    return false;
+  WriteSpliceInt32(buffer, start, (int32_t)(buffer->size - start));
+  return true;
+}
+
+bool SetBSONPath(const char* data,
+                 const char* path,
+                 bson_type type,
+                 const char* value,
+                 size_t value_size,
+                 char** output,
+                 size_t* output_size) {
+  SpliceBuffer buffer = {NULL, 0, 0};
+  if (!SpliceBSONPath(data, false, path, type, value, value_size, &buffer)) {
+    free(buffer.data);
+    return false;
+  }
+  *output = buffer.data;
+  *output_size = buffer.size;
+  return true;
+}
+
+bool UnsetBSONPath(const char* data,
+                   const char* path,
+                   char** output,
+                   size_t* output_size) {
+  SpliceBuffer buffer = {NULL, 0, 0};
+  if (!SpliceBSONPath(data, false, path, BSON_EOO, NULL, 0, &buffer)) {
+    free(buffer.data);
+    return false;
+  }
+  *output = buffer.data;
+  *output_size = buffer.size;
+  return true;
+}
+
+/** Check if the document has an element of the key at the top level.
+ */
+static bool HasBSONKey(const char* data, const char* key) {
+  bson_iterator it;
+  bson_iterator_from_buffer(&it, data);
+  return FindBSONKey(&it, key, strlen(key)) != BSON_EOO;
+}
+
+bool MergeBSONDocuments(const char* left,
+                        const char* right,
+                        char** output,
+                        size_t* output_size) {
+  static const char kEmptyDocument[5] = {5, 0, 0, 0, 0};
+  SpliceBuffer buffer = {NULL, 0, 0};
+  int32_t left_size;
+  bson_little_endian32(&left_size, left);
+  // Copy the elements of the left document without its terminator.
+  bool success = AppendSplice(&buffer, left, left_size - 1);
+  bson_iterator it;
+  bson_iterator_from_buffer(&it, right);
+  while (success && bson_iterator_next(&it) != BSON_EOO) {
+    const char* element = it.cur;
+    bson_iterator next = it;
+    bson_iterator_next(&next);
+    if (!HasBSONKey(left, bson_iterator_key(&it)))
+      success = AppendSplice(&buffer, element, next.cur - element);
+  }
+  if (success)
+    success = AppendSplice(&buffer, kEmptyDocument + 4, 1);
+  if (!success) {
+    free(buffer.data);
+    return false;
+  }
+  WriteSpliceInt32(&buffer, 0, (int32_t)buffer.size);
+  *output = buffer.data;
+  *output_size = buffer.size;
+  return true;
+}
+
+/** Random value of the process used in generated object ids.
+ */
+static uint64_t GetProcessRandom(void) {
+  static volatile uint64_t process_random = 0;
+  if (!process_random) {
+    // splitmix64 of the time and the process id.
+    uint64_t value = ((uint64_t)time(NULL) << 32) ^
+                     (uint64_t)getpid() ^
+                     (uint64_t)(size_t)&process_random;
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    value ^= value >> 31;
+    __sync_bool_compare_and_swap(&process_random, 0, value | 1);
+  }
+  return process_random;
+}
+
+void GenerateObjectIds(bson_oid_t* object_ids, int size) {
+  static volatile uint32_t counter = 0;
+  if (size <= 0)
+    return;
+  uint64_t random = GetProcessRandom();
+  uint32_t first = __sync_fetch_and_add(&counter, (uint32_t)size) +
+                   (uint32_t)(random >> 40);
+  uint32_t seconds = (uint32_t)time(NULL);
+  for (int i = 0; i < size; ++i) {
+    unsigned char* bytes = (unsigned char*)object_ids[i].bytes;
+    uint32_t count = first + (uint32_t)i;
+    bytes[0] = (unsigned char)(seconds >> 24);
+    bytes[1] = (unsigned char)(seconds >> 16);
+    bytes[2] = (unsigned char)(seconds >> 8);
+    bytes[3] = (unsigned char)seconds;
+    for (int j = 0; j < 5; ++j)
+      bytes[4 + j] = (unsigned char)(random >> (8 * j));
+    bytes[9] = (unsigned char)(count >> 16);
+    bytes[10] = (unsigned char)(count >> 8);
+    bytes[11] = (unsigned char)count;
+  }
+}
+
+bool SetBSONObjectId(bson* value, bson_oid_t* object_id) {
+  bson_iterator it;
+  bson_type type = bson_find(&it, value, "_id");
+  if (type == BSON_OID) {
+    *object_id = *bson_iterator_oid(&it);
+    return true;
+  }
+  if (type != BSON_EOO)
+    return false;
+  GenerateObjectIds(object_id, 1);
+  bson output;
+  bson_init(&output);
+  bool success = bson_append_oid(&output, "_id", object_id) == BSON_OK;
+  bson_iterator_init(&it, value);
+  while (success && bson_iterator_next(&it) != BSON_EOO)
+    success = bson_append_element(&output, NULL, &it) == BSON_OK;
+  if (!success || bson_finish(&output) != BSON_OK) {
+    bson_destroy(&output);
+    return false;
+  }
+  bson_destroy(value);
+  *value = output;
+  return true;
+}
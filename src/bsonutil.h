@@ -0,0 +1,125 @@
+/** Raw BSON buffer utilities.
+ *
+ * The functions here work directly on encoded BSON without converting it to
+ * mxArray, and are safe to call outside of the Matlab thread.
+ */
+
+#ifndef __BSONUTIL_H__
+#define __BSONUTIL_H__
+
+#include <bson.h>
+#include <stddef.h>
+#ifndef __cplusplus
+#include <stdbool.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Check if the buffer holds a well-formed BSON document.
+ * Every element, including nested documents, is checked to lie within the
+ * buffer, so that the document can be safely iterated in place.
+ * @param data buffer to check.
+ * @param length length of the buffer in bytes. Trailing bytes after the
+ *               document are allowed.
+ * @return true if the document is valid.
+ */
+bool CheckBSONBuffer(const char* data, size_t length);
+
+/** Check the elements of a document that FindBSONPath() walks for a path.
+ * Each document on the path is checked to be framed within its parent, the
+ * elements before the match are checked by their size alone, and the found
+ * element is checked in full. Other elements are not checked.
+ * @param data buffer to check.
+ * @param length length of the buffer in bytes.
+ * @param path dotted path to the element.
+ * @return true if the walked elements are valid, also when not found.
+ */
+bool CheckBSONPath(const char* data, size_t length, const char* path);
+
+/** Find an element by a dotted path, e.g., "a.b.0.c".
+ * Elements before the match are skipped by their encoded size without
+ * decoding. Array elements are addressed by their decimal index.
+ * @param it bson iterator at the beginning of a document. On success, the
+ *           iterator points to the found element.
+ * @param path dotted path to the element.
+ * @return type of the found element, or BSON_EOO if not found.
+ */
+bson_type FindBSONPath(bson_iterator* it, const char* path);
+
+/** Set an element at a dotted path in a copy of the document.
+ * Elements are located by walking their encoded sizes. The new value is
+ * spliced in and the length prefixes of the enclosing documents are fixed
+ * up. Missing intermediate documents are created as objects. A missing
+ * array element can only be added at the next index.
+ * @param data BSON document, checked by CheckBSONBuffer().
+ * @param path dotted path to the element.
+ * @param type BSON type of the new value.
+ * @param value encoded value without the type and the key.
+ * @param value_size size of the encoded value.
+ * @param output new document to be created. Must be freed with free().
+ * @param output_size size of the new document.
+ * @return true if success, false if the path crosses a non-document element
+ *         or an array index beyond the end.
+ */
+bool SetBSONPath(const char* data,
+                 const char* path,
+                 bson_type type,
+                 const char* value,
+                 size_t value_size,
+                 char** output,
+                 size_t* output_size);
+
+/** Remove an element at a dotted path in a copy of the document.
+ * A missing element leaves the copy unchanged.
+ * @param data BSON document, checked by CheckBSONBuffer().
+ * @param path dotted path to the element.
+ * @param output new document to be created. Must be freed with free().
+ * @param output_size size of the new document.
+ * @return true if success.
+ */
+bool UnsetBSONPath(const char* data,
+                   const char* path,
+                   char** output,
+                   size_t* output_size);
+
+/** Merge the top-level elements of two documents into a new document.
+ * Elements of the right document whose key is in the left document are
+ * skipped, so the left document wins, including its _id.
+ * @param left BSON document, checked by CheckBSONBuffer().
+ * @param right BSON document, checked by CheckBSONBuffer().
+ * @param output new document to be created. Must be freed with free().
+ * @param output_size size of the new document.
+ * @return true if success.
+ */
+bool MergeBSONDocuments(const char* left,
+                        const char* right,
+                        char** output,
+                        size_t* output_size);
+
+/** Generate object ids without calling the database.
+ * Ids follow the standard layout of a 4-byte big-endian timestamp in
+ * seconds, a 5-byte random value per process and a 3-byte big-endian
+ * counter. The counter is reserved atomically for the whole range, so that
+ * ids are unique across threads.
+ * @param object_ids object ids to generate.
+ * @param size number of object ids.
+ */
+void GenerateObjectIds(bson_oid_t* object_ids, int size);
+
+/** Get the object id of a document, generating one when missing.
+ * A generated _id is prepended to the document, so that the document can be
+ * saved with a known id without a round trip to the database.
+ * @param value finished bson document. Replaced with a new document when
+ *              the _id is generated.
+ * @param object_id object id of the document.
+ * @return true if success, false if _id is not an object id.
+ */
+bool SetBSONObjectId(bson* value, bson_oid_t* object_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BSONUTIL_H__ */
@@ -3,13 +3,977 @@
 /// Kota Yamaguchi 2013
 
 #include "bsonmex.h"
+#include "bsonstream.h"
+#include "bsonutil.h"
 #include "ejdb.h"
 #include "ejdbmex.h"
+#include "jsonbson.h"
+#include "mappedfile.h"
+#include "parallel.h"
+#include "predicate.h"
+#include "resultcache.h"
+#include "sketch.h"
+#include "writequeue.h"
+#include <algorithm>
+#include <limits>
+#include <math.h>
 #include <mex.h>
+#include <string.h>
+#include <sys/time.h>
+
+using bsonmex::BSONStream;
+using bsonmex::HyperLogLog;
+using bsonmex::MappedFile;
+using bsonmex::QuantileSketch;
+using bsonmex::ThreadGroup;
+using ejdbmex::Aggregate;
+
+namespace {
+
+/// Batch of JSON lines to be parsed in worker threads.
+struct JSONBatch {
+  /// Release parsed documents.
+  void clear() {
+    for (int i = 0; i < documents.size(); ++i)
+      if (!errors[i])
+        bson_destroy(&documents[i]);
+    lines.clear();
+    lengths.clear();
+    line_numbers.clear();
+    documents.clear();
+    errors.clear();
+  }
+  /// Beginning of each line.
+  vector<const char*> lines;
+  /// Length of each line.
+  vector<size_t> lengths;
+  /// One-based line number of each line.
+  vector<int> line_numbers;
+  /// Parsed documents.
+  vector<bson> documents;
+  /// Parse error of each line, or NULL.
+  vector<const char*> errors;
+};
+
+/// Collect the next non-blank lines into the batch.
+/// @return offset after the collected lines.
+size_t ReadJSONLines(const MappedFile& file,
+                     size_t offset,
+                     int batch_size,
+                     int* line_number,
+                     JSONBatch* batch) {
+  const char* data = file.data();
+  size_t size = file.size();
+  while (offset < size && batch->lines.size() < batch_size) {
+    const char* line = data + offset;
+    const char* end = static_cast<const char*>(
+        memchr(line, '\n', size - offset));
+    if (!end)
+      end = data + size;
+    offset = end - data + 1;
+    ++(*line_number);
+    const char* cur = line;
+    while (cur < end && (*cur == ' ' || *cur == '\t' || *cur == '\r'))
+      ++cur;
+    if (cur == end)
+      continue;
+    batch->lines.push_back(line);
+    batch->lengths.push_back(end - line);
+    batch->line_numbers.push_back(*line_number);
+  }
+  batch->documents.resize(batch->lines.size());
+  batch->errors.resize(batch->lines.size());
+  return std::min(offset, size);
+}
+
+/// Parse a range of JSON lines. Called in worker threads.
+void ParseJSONLines(size_t begin, size_t end, void* context) {
+  JSONBatch* batch = static_cast<JSONBatch*>(context);
+  for (size_t i = begin; i < end; ++i) {
+    batch->errors[i] = NULL;
+    if (!ConvertJSONToBSON(batch->lines[i],
+                           batch->lengths[i],
+                           0,
+                           &batch->documents[i],
+                           &batch->errors[i],
+                           NULL) && !batch->errors[i])
+      batch->errors[i] = "Failed to parse.";
+  }
+}
+
+/// Save BSON documents in a transaction.
+/// @return index of the failed document, or -1 if success.
+int SaveDocuments(EJCOLL* collection, vector<bson*>* documents) {
+  if (!ejdbtranbegin(collection))
+    return 0;
+  for (int i = 0; i < documents->size(); ++i) {
+    bson_oid_t oid;
+    if (!ejdbsavebson(collection, (*documents)[i], &oid)) {
+      ejdbtranabort(collection);
+      return i;
+    }
+  }
+  return (ejdbtrancommit(collection)) ? -1 : 0;
+}
+
+/// Raw BSON results of a query.
+class QueryResults {
+public:
+  /// Empty results.
+  QueryResults() : query_(NULL), results_(NULL), size_(0) {}
+  /// Release the results.
+  ~QueryResults() {
+    if (results_)
+      ejdbqresultdispose(results_);
+    if (query_)
+      ejdbquerydel(query_);
+  }
+  /// Execute a query.
+  /// @param flags query search mode: JBQRYCOUNT or JBQRYFINDONE.
+  bool execute(EJDB* database,
+               EJCOLL* collection,
+               bson* query,
+               bson* hints,
+               int flags = 0) {
+    query_ = ejdbcreatequery(database, query, NULL, 0, hints);
+    if (!query_)
+      return false;
+    results_ = ejdbqryexecute(collection, query_, &size_, flags, NULL);
+    return results_ != NULL || flags == JBQRYCOUNT;
+  }
+  /// Number of results, or the count of a JBQRYCOUNT query.
+  int size() const { return size_; }
+  /// BSON data of the result at the index.
+  const char* data(int index) const {
+    int size = 0;
+    return static_cast<const char*>(
+        ejdbqresultbsondata(results_, index, &size));
+  }
+
+private:
+  /// Disabled copy constructor.
+  QueryResults(const QueryResults&);
+  /// Disabled assignment.
+  QueryResults& operator=(const QueryResults&);
+  /// Query object.
+  EJQ* query_;
+  /// Result list.
+  EJQRESULT results_;
+  /// Number of results.
+  uint32_t size_;
+};
+
+/// Key value of a document to join on.
+struct JoinKey {
+  /// BSON type of the value. Integral numbers are normalized to BSON_LONG
+  /// and other numbers to BSON_DOUBLE.
+  bson_type type;
+  /// Encoded value, or NULL for numbers.
+  const char* data;
+  /// Size of the encoded value.
+  int size;
+  /// Numeric value of BSON_DOUBLE.
+  double number;
+  /// Numeric value of BSON_LONG, kept exact beyond 2^53.
+  int64_t integer;
+  /// FNV-1a hash of the type and the value.
+  uint32_t hash;
+};
+
+/// Update FNV-1a hash with bytes.
+uint32_t HashBytes(uint32_t hash, const void* data, size_t size) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i)
+    hash = (hash ^ bytes[i]) * 16777619u;
+  return hash;
+}
+
+/// Get the key value at the iterator.
+/// @return false if the type is BSON_EOO, in which case the key is set to a
+///         missing value.
+bool MakeJoinKey(const bson_iterator* it, bson_type type, JoinKey* key) {
+  key->type = BSON_EOO;
+  key->data = NULL;
+  key->size = 0;
+  key->number = 0;
+  key->integer = 0;
+  key->hash = 0;
+  switch (type) {
+    case BSON_EOO:
+      return false;
+    case BSON_DOUBLE:
+      key->number = bson_iterator_double(it);
+      // Integral doubles equal the integers of the same value.
+      if (key->number == floor(key->number) &&
+          key->number >= -9223372036854775808.0 &&
+          key->number < 9223372036854775808.0) {
+        key->integer = static_cast<int64_t>(key->number);
+        key->type = BSON_LONG;
+      }
+      else
+        key->type = BSON_DOUBLE;
+      break;
+    case BSON_INT:
+      key->integer = bson_iterator_int(it);
+      key->type = BSON_LONG;
+      break;
+    case BSON_LONG:
+      key->integer = bson_iterator_long(it);
+      key->type = BSON_LONG;
+      break;
+    default: {
+      bson_iterator next = *it;
+      bson_iterator_next(&next);
+      key->data = bson_iterator_value(it);
+      key->size = next.cur - key->data;
+      key->type = type;
+      break;
+    }
+  }
+  char type_byte = key->type;
+  key->hash = HashBytes(2166136261u, &type_byte, 1);
+  if (key->data)
+    key->hash = HashBytes(key->hash, key->data, key->size);
+  else if (key->type == BSON_LONG)
+    key->hash = HashBytes(key->hash, &key->integer, sizeof(key->integer));
+  else
+    key->hash = HashBytes(key->hash, &key->number, sizeof(key->number));
+  return true;
+}
+
+/// Get the key value at the path without decoding the document.
+/// @return false if the document does not have the key, in which case the
+///         key is set to a missing value of BSON_EOO type.
+bool GetJoinKey(const char* document, const char* path, JoinKey* key) {
+  bson_iterator it;
+  bson_type type = BSON_EOO;
+  if (document) {
+    bson_iterator_from_buffer(&it, document);
+    type = FindBSONPath(&it, path);
+  }
+  return MakeJoinKey(&it, type, key);
+}
+
+/// Check if two join keys are equal.
+bool EqualJoinKeys(const JoinKey& key1, const JoinKey& key2) {
+  if (key1.hash != key2.hash || key1.type != key2.type)
+    return false;
+  if (key1.type == BSON_LONG)
+    return key1.integer == key2.integer;
+  if (!key1.data)
+    return key1.number == key2.number;
+  return key1.size == key2.size &&
+         memcmp(key1.data, key2.data, key1.size) == 0;
+}
+
+/// Chained hash table of join keys to document indices.
+class JoinTable {
+public:
+  /// Create a table for the given number of keys.
+  explicit JoinTable(int capacity) : mask_(1) {
+    while (mask_ + 1 < 2 * static_cast<uint32_t>(capacity))
+      mask_ = 2 * mask_ + 1;
+    buckets_.assign(mask_ + 1, -1);
+    keys_.reserve(capacity);
+  }
+  /// Insert a key of the document index.
+  void insert(const JoinKey& key, int index) {
+    int bucket = key.hash & mask_;
+    keys_.push_back(key);
+    indices_.push_back(index);
+    next_.push_back(buckets_[bucket]);
+    buckets_[bucket] = keys_.size() - 1;
+  }
+  /// Find document indices of the key.
+  void find(const JoinKey& key, vector<int>* indices) const {
+    for (int entry = buckets_[key.hash & mask_];
+         entry >= 0;
+         entry = next_[entry])
+      if (EqualJoinKeys(keys_[entry], key))
+        indices->push_back(indices_[entry]);
+  }
+
+private:
+  /// Bucket mask, one less than a power of two.
+  uint32_t mask_;
+  /// First entry of each bucket, or -1.
+  vector<int> buckets_;
+  /// Key of each entry.
+  vector<JoinKey> keys_;
+  /// Document index of each entry.
+  vector<int> indices_;
+  /// Next entry in the bucket, or -1.
+  vector<int> next_;
+};
+
+/// Get the 64-bit hash of a join key for HyperLogLog.
+/// @param key join key to hash.
+/// @param buffer buffer to reuse for the type and the value.
+uint64_t HashJoinKey(const JoinKey& key, string* buffer) {
+  buffer->assign(1, static_cast<char>(key.type));
+  if (key.data)
+    buffer->append(key.data, key.size);
+  else if (key.type == BSON_LONG)
+    buffer->append(reinterpret_cast<const char*>(&key.integer),
+                   sizeof(key.integer));
+  else
+    buffer->append(reinterpret_cast<const char*>(&key.number),
+                   sizeof(key.number));
+  return HyperLogLog::hash(buffer->data(), buffer->size());
+}
+
+/// Hash table of groups keyed by a tuple of join keys.
+class GroupTable {
+public:
+  /// Create an empty table of keys of the given length.
+  explicit GroupTable(int num_keys) : num_keys_(num_keys), mask_(255) {
+    buckets_.assign(mask_ + 1, -1);
+  }
+  /// Find the group of the keys, adding a new group if not found.
+  /// @return group index. New groups are numbered in order.
+  int group(const JoinKey* keys) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < num_keys_; ++i)
+      hash = HashBytes(hash, &keys[i].hash, sizeof(keys[i].hash));
+    for (int entry = buckets_[hash & mask_];
+         entry >= 0;
+         entry = next_[entry])
+      if (hashes_[entry] == hash && equal(entry, keys))
+        return entry;
+    int entry = hashes_.size();
+    hashes_.push_back(hash);
+    keys_.insert(keys_.end(), keys, keys + num_keys_);
+    next_.push_back(buckets_[hash & mask_]);
+    buckets_[hash & mask_] = entry;
+    if (hashes_.size() > buckets_.size())
+      rehash();
+    return entry;
+  }
+  /// Number of groups.
+  int size() const { return hashes_.size(); }
+
+private:
+  /// Check if the group has the keys.
+  bool equal(int entry, const JoinKey* keys) const {
+    for (int i = 0; i < num_keys_; ++i)
+      if (!EqualJoinKeys(keys_[entry * num_keys_ + i], keys[i]))
+        return false;
+    return true;
+  }
+  /// Double the number of buckets.
+  void rehash() {
+    mask_ = 2 * mask_ + 1;
+    buckets_.assign(mask_ + 1, -1);
+    for (int entry = 0; entry < hashes_.size(); ++entry) {
+      next_[entry] = buckets_[hashes_[entry] & mask_];
+      buckets_[hashes_[entry] & mask_] = entry;
+    }
+  }
+  /// Number of keys in a group.
+  int num_keys_;
+  /// Bucket mask, one less than a power of two.
+  uint32_t mask_;
+  /// First entry of each bucket, or -1.
+  vector<int> buckets_;
+  /// Hash of each group.
+  vector<uint32_t> hashes_;
+  /// Keys of each group.
+  vector<JoinKey> keys_;
+  /// Next group in the bucket, or -1.
+  vector<int> next_;
+};
+
+/// Get a numeric value at the path.
+/// @return false if the value is missing or not a number.
+bool GetNumber(const char* document, const char* path, double* value) {
+  bson_iterator it;
+  bson_iterator_from_buffer(&it, document);
+  switch (FindBSONPath(&it, path)) {
+    case BSON_DOUBLE:
+      *value = bson_iterator_double(&it);
+      return true;
+    case BSON_INT:
+      *value = bson_iterator_int(&it);
+      return true;
+    case BSON_LONG:
+      *value = bson_iterator_long(&it);
+      return true;
+    default:
+      return false;
+  }
+}
+
+/// Convert a number to the column type, rounding and saturating integers
+/// as Matlab does. A logical column is true for any nonzero value, since
+/// mxLogical may be the same type as uint8.
+template <typename T>
+T ConvertNumber(double value, bool logical) {
+  if (logical)
+    return value != 0;
+  if (!numeric_limits<T>::is_integer)
+    return static_cast<T>(value);
+  if (value != value)
+    return 0;
+  if (value >= static_cast<double>(numeric_limits<T>::max()))
+    return numeric_limits<T>::max();
+  if (value <= static_cast<double>(numeric_limits<T>::min()))
+    return numeric_limits<T>::min();
+  return static_cast<T>((value < 0) ? ceil(value - 0.5) : floor(value + 0.5));
+}
+
+/// Store the value at the iterator in a typed column.
+/// @return false if the value is not a number or a boolean.
+template <typename T>
+bool StoreNumber(bson_iterator* it, bson_type type, bool logical, T* output) {
+  switch (type) {
+    case BSON_DOUBLE:
+      *output = ConvertNumber<T>(bson_iterator_double(it), logical);
+      return true;
+    case BSON_INT:
+      *output = ConvertNumber<T>(bson_iterator_int(it), logical);
+      return true;
+    case BSON_LONG:
+      // Keep the precision of 64-bit integers.
+      if (!logical &&
+          numeric_limits<T>::is_integer && sizeof(T) == sizeof(int64_t) &&
+          (numeric_limits<T>::is_signed || bson_iterator_long(it) >= 0))
+        *output = static_cast<T>(bson_iterator_long(it));
+      else
+        *output = ConvertNumber<T>(bson_iterator_long(it), logical);
+      return true;
+    case BSON_BOOL:
+      *output = bson_iterator_bool(it) ? 1 : 0;
+      return true;
+    default:
+      return false;
+  }
+}
+
+/// Fill a typed column with a field of the documents.
+template <typename T>
+void FillColumn(const QueryResults& documents,
+                const char* field,
+                T missing,
+                T* output,
+                mxLogical* mask,
+                bool logical = false) {
+  for (int i = 0; i < documents.size(); ++i) {
+    const char* data = documents.data(i);
+    bson_iterator it;
+    bson_type type = BSON_EOO;
+    if (data) {
+      bson_iterator_from_buffer(&it, data);
+      type = FindBSONPath(&it, field);
+    }
+    mask[i] = StoreNumber(&it, type, logical, &output[i]);
+    if (!mask[i])
+      output[i] = missing;
+  }
+}
+
+/// Create the output struct of an aggregate, raising an error for invalid
+/// or duplicated fields.
+mxArray* CreateAggregateStruct(const vector<string>& group_fields,
+                               const vector<Aggregate>& aggregates) {
+  static const char* kFunctionNames[] = {"count", "sum", "min", "max", "mean"};
+  int num_aggregates = aggregates.size();
+  vector<string> names(group_fields.begin(), group_fields.end());
+  names.push_back("count");
+  for (int j = 0; j < num_aggregates; ++j)
+    names.push_back(string(kFunctionNames[aggregates[j].function]) + "." +
+                    aggregates[j].field);
+  vector<const char*> name_pointers(names.size());
+  for (int j = 0; j < names.size(); ++j)
+    name_pointers[j] = names[j].c_str();
+  mxArray* results = CreateProjectionStruct(names.size(),
+                                            &name_pointers[0],
+                                            1);
+  if (!results)
+    ERROR("Invalid or duplicated aggregate fields.");
+  return results;
+}
+
+/// Group documents and fill the columns of the aggregate struct.
+/// @param documents BSON documents.
+/// @param group_fields dotted paths to group by.
+/// @param aggregates aggregates to compute.
+/// @param results struct made by CreateAggregateStruct().
+void FillAggregateStruct(const vector<const char*>& documents,
+                         const vector<string>& group_fields,
+                         const vector<Aggregate>& aggregates,
+                         mxArray* results) {
+  int num_keys = group_fields.size();
+  int num_aggregates = aggregates.size();
+  GroupTable table(num_keys);
+  vector<JoinKey> keys(num_keys + 1);
+  vector<int> first_documents;
+  vector<double> counts;
+  // Accumulated value and the number of values of each group and aggregate.
+  vector<double> values;
+  vector<double> num_values;
+  for (int i = 0; i < documents.size(); ++i) {
+    const char* data = documents[i];
+    if (!data)
+      continue;
+    for (int j = 0; j < num_keys; ++j)
+      GetJoinKey(data, group_fields[j].c_str(), &keys[j]);
+    int group = table.group(&keys[0]);
+    if (group == first_documents.size()) {
+      first_documents.push_back(i);
+      counts.push_back(0);
+      values.resize(values.size() + num_aggregates, 0);
+      num_values.resize(num_values.size() + num_aggregates, 0);
+    }
+    ++counts[group];
+    for (int j = 0; j < num_aggregates; ++j) {
+      const Aggregate& aggregate = aggregates[j];
+      int index = group * num_aggregates + j;
+      if (aggregate.function == ejdbmex::AGGREGATE_COUNT) {
+        bson_iterator it;
+        bson_iterator_from_buffer(&it, data);
+        if (FindBSONPath(&it, aggregate.field.c_str()) != BSON_EOO)
+          ++num_values[index];
+        continue;
+      }
+      double value;
+      if (!GetNumber(data, aggregate.field.c_str(), &value))
+        continue;
+      double& accumulator = values[index];
+      if (aggregate.function == ejdbmex::AGGREGATE_MIN)
+        accumulator = (num_values[index] && accumulator <= value) ?
+                      accumulator : value;
+      else if (aggregate.function == ejdbmex::AGGREGATE_MAX)
+        accumulator = (num_values[index] && accumulator >= value) ?
+                      accumulator : value;
+      else
+        accumulator += value;
+      ++num_values[index];
+    }
+  }
+  int num_groups = table.size();
+  for (int j = 0; j < num_keys; ++j) {
+    mxArray* column = mxCreateCellMatrix(num_groups, 1);
+    for (int i = 0; i < num_groups; ++i) {
+      bson_iterator it;
+      bson_iterator_from_buffer(&it, documents[first_documents[i]]);
+      if (FindBSONPath(&it, group_fields[j].c_str()) != BSON_EOO)
+        mxSetCell(column, i, ConvertBSONValueToMxArray(&it, 0));
+    }
+    mxSetFieldByNumber(results, 0, j, CollapseCellColumn(column, 0));
+  }
+  mxArray* count_column = mxCreateDoubleMatrix(num_groups, 1, mxREAL);
+  if (num_groups)
+    memcpy(mxGetPr(count_column), &counts[0], num_groups * sizeof(double));
+  mxSetFieldByNumber(results, 0, num_keys, count_column);
+  for (int j = 0; j < num_aggregates; ++j) {
+    mxArray* column = mxCreateDoubleMatrix(num_groups, 1, mxREAL);
+    double* column_data = mxGetPr(column);
+    for (int i = 0; i < num_groups; ++i) {
+      int index = i * num_aggregates + j;
+      switch (aggregates[j].function) {
+        case ejdbmex::AGGREGATE_COUNT:
+          column_data[i] = num_values[index];
+          break;
+        case ejdbmex::AGGREGATE_SUM:
+          column_data[i] = values[index];
+          break;
+        case ejdbmex::AGGREGATE_MEAN:
+          column_data[i] = (num_values[index]) ?
+              values[index] / num_values[index] : mxGetNaN();
+          break;
+        default:
+          column_data[i] = (num_values[index]) ? values[index] : mxGetNaN();
+          break;
+      }
+    }
+    mxSetFieldByNumber(results, 0, num_keys + 1 + j, column);
+  }
+}
+
+/// Query of a shard run in a worker thread.
+struct ShardQuery {
+  /// Database of the shard.
+  EJDB* database;
+  /// Collection in the shard, or NULL if the shard does not have it.
+  EJCOLL* collection;
+  /// bson query object.
+  bson* query;
+  /// bson query hint object, or NULL.
+  bson* hints;
+  /// Query search mode.
+  int flags;
+  /// Whether the query succeeded.
+  bool success;
+  /// Raw results.
+  QueryResults results;
+};
+
+/// Execute queries of a range of shards.
+void ExecuteShardQueries(size_t begin, size_t end, void* context) {
+  ShardQuery* queries = static_cast<ShardQuery*>(context);
+  for (size_t i = begin; i < end; ++i) {
+    ShardQuery& query = queries[i];
+    query.success = !query.collection ||
+                    query.results.execute(query.database,
+                                          query.collection,
+                                          query.query,
+                                          query.hints,
+                                          query.flags);
+  }
+}
+
+/// Queries of the shards, executed in a thread per shard.
+class ShardQueries {
+public:
+  /// Create queries of the given number of shards.
+  explicit ShardQueries(int size) : queries_(new ShardQuery[size]),
+                                    size_(size) {}
+  /// Release the results.
+  ~ShardQueries() { delete [] queries_; }
+  /// Query of the shard at the index.
+  ShardQuery& operator[](int index) { return queries_[index]; }
+  /// Number of shards.
+  int size() const { return size_; }
+  /// Execute the queries in parallel threads.
+  /// @return index of a failed shard, or -1 if all succeeded.
+  int execute() {
+    bsonmex::ParallelFor(size_, size_, ExecuteShardQueries, queries_);
+    for (int i = 0; i < size_; ++i)
+      if (!queries_[i].success)
+        return i;
+    return -1;
+  }
+  /// Number of results of the shards.
+  int getNumResults() const {
+    int num_results = 0;
+    for (int i = 0; i < size_; ++i)
+      num_results += queries_[i].results.size();
+    return num_results;
+  }
+
+private:
+  /// Disabled copy constructor.
+  ShardQueries(const ShardQueries&);
+  /// Disabled assignment.
+  ShardQueries& operator=(const ShardQueries&);
+  /// Queries.
+  ShardQuery* queries_;
+  /// Number of shards.
+  int size_;
+};
+
+/// Limits and sort order of a query, applied after merging the shards.
+struct ShardHints {
+  /// Number of merged results to skip.
+  int skip;
+  /// Maximum number of merged results, or -1.
+  int max;
+  /// Dotted paths and directions of $orderby.
+  vector<pair<string, int> > order;
+};
+
+/// Make query hints for each shard, where $skip is left to the merge and
+/// $max covers the skipped results.
+/// @param hints bson query hint object, or NULL.
+/// @param find_one whether only the first merged result is wanted.
+/// @param shard_hints bson query hint object of the shards to be created.
+/// @param merge limits and sort order of the merge.
+void MakeShardHints(bson* hints,
+                    bool find_one,
+                    bson* shard_hints,
+                    ShardHints* merge) {
+  merge->skip = 0;
+  merge->max = -1;
+  merge->order.clear();
+  bson_init_as_query(shard_hints);
+  if (hints) {
+    bson_iterator it;
+    bson_iterator_init(&it, hints);
+    while (bson_iterator_next(&it) != BSON_EOO) {
+      const char* key = bson_iterator_key(&it);
+      if (strcmp(key, "$skip") == 0)
+        merge->skip = std::max(0, bson_iterator_int(&it));
+      else if (strcmp(key, "$max") == 0)
+        merge->max = std::max(0, bson_iterator_int(&it));
+      else {
+        if (strcmp(key, "$orderby") == 0 &&
+            bson_iterator_type(&it) == BSON_OBJECT) {
+          bson_iterator field;
+          bson_iterator_subiterator(&it, &field);
+          while (bson_iterator_next(&field) != BSON_EOO)
+            merge->order.push_back(make_pair(
+                string(bson_iterator_key(&field)),
+                (bson_iterator_int(&field) < 0) ? -1 : 1));
+        }
+        bson_append_element(shard_hints, NULL, &it);
+      }
+    }
+  }
+  if (find_one)
+    merge->max = (merge->max < 0) ? 1 : std::min(merge->max, 1);
+  if (merge->max >= 0)
+    bson_append_int(shard_hints, "$max", merge->skip + merge->max);
+  bson_finish(shard_hints);
+}
+
+/// Compare key values as sorted results: missing values, numbers, strings,
+/// and then raw values of other types by the type.
+int CompareJoinKeys(const JoinKey& key1, const JoinKey& key2) {
+  // Integers and other numbers sort together.
+  bool is_number1 = key1.type == BSON_DOUBLE || key1.type == BSON_LONG;
+  bool is_number2 = key2.type == BSON_DOUBLE || key2.type == BSON_LONG;
+  bson_type type1 = (is_number1) ? BSON_DOUBLE : key1.type;
+  bson_type type2 = (is_number2) ? BSON_DOUBLE : key2.type;
+  if (type1 != type2)
+    return (type1 < type2) ? -1 : 1;
+  if (key1.type == BSON_LONG && key2.type == BSON_LONG)
+    return (key1.integer < key2.integer) ? -1 :
+           (key1.integer > key2.integer);
+  if (is_number1) {
+    // long double holds every int64 exactly on common platforms.
+    long double number1 = (key1.type == BSON_LONG) ?
+        static_cast<long double>(key1.integer) : key1.number;
+    long double number2 = (key2.type == BSON_LONG) ?
+        static_cast<long double>(key2.integer) : key2.number;
+    return (number1 < number2) ? -1 : (number1 > number2);
+  }
+  // Strings are compared without the length prefix.
+  int offset = (key1.type == BSON_STRING) ? 4 : 0;
+  int result = memcmp(key1.data + offset,
+                      key2.data + offset,
+                      std::min(key1.size, key2.size) - offset);
+  return (result) ? result : key1.size - key2.size;
+}
+
+/// Compare documents by the $orderby fields.
+int CompareDocuments(const char* document1,
+                     const char* document2,
+                     const vector<pair<string, int> >& order) {
+  JoinKey key1, key2;
+  for (int i = 0; i < order.size(); ++i) {
+    GetJoinKey(document1, order[i].first.c_str(), &key1);
+    GetJoinKey(document2, order[i].first.c_str(), &key2);
+    int result = CompareJoinKeys(key1, key2);
+    if (result)
+      return (result < 0) ? -order[i].second : order[i].second;
+  }
+  return 0;
+}
+
+/// Merge the results of the shards, and apply $skip and $max.
+/// Sorted results are merged in the order, taking the first shard on ties.
+void MergeShardResults(ShardQueries& queries,
+                       const ShardHints& merge,
+                       vector<const char*>* documents) {
+  documents->clear();
+  documents->reserve(queries.getNumResults());
+  vector<int> heads(queries.size(), 0);
+  while (true) {
+    int next = -1;
+    for (int i = 0; i < queries.size(); ++i) {
+      if (heads[i] >= queries[i].results.size())
+        continue;
+      if (next < 0 || (!merge.order.empty() && CompareDocuments(
+              queries[i].results.data(heads[i]),
+              queries[next].results.data(heads[next]),
+              merge.order) < 0))
+        next = i;
+    }
+    if (next < 0)
+      break;
+    documents->push_back(queries[next].results.data(heads[next]++));
+  }
+  documents->erase(documents->begin(),
+                   documents->begin() + std::min<size_t>(merge.skip,
+                                                         documents->size()));
+  if (merge.max >= 0 && documents->size() > static_cast<size_t>(merge.max))
+    documents->resize(merge.max);
+}
+
+/// Execute a query on the shards that can match it in parallel threads.
+/// @param shards shards to query.
+/// @param collection_name name of the collection.
+/// @param query bson query object.
+/// @param hints bson query hint object, or NULL.
+/// @param flags query search mode.
+/// @param queries queries of the shards.
+/// @param merge limits and sort order to apply to the merged results.
+/// @param error static error message set when unsuccessful.
+/// @return true if success.
+bool QueryShards(const ejdbmex::ShardSet& shards,
+                 const char* collection_name,
+                 bson* query,
+                 bson* hints,
+                 int flags,
+                 ShardQueries* queries,
+                 ShardHints* merge,
+                 const char** error) {
+  // JBQRYFINDONE would ignore $skip in the shards, so the first result is
+  // taken after merging instead.
+  bson shard_hints;
+  MakeShardHints(hints, flags == JBQRYFINDONE, &shard_hints, merge);
+  int target = shards.route(query);
+  bool exists = false;
+  for (int i = 0; i < shards.size(); ++i) {
+    ShardQuery& shard_query = (*queries)[i];
+    shard_query.database = shards.getShard(i)->getMutable();
+    shard_query.collection = ejdbgetcoll(shard_query.database,
+                                         collection_name);
+    exists = exists || shard_query.collection;
+    if (target >= 0 && target != i)
+      shard_query.collection = NULL;
+    shard_query.query = query;
+    shard_query.hints = &shard_hints;
+    shard_query.flags = (flags == JBQRYCOUNT) ? JBQRYCOUNT : 0;
+  }
+  int failed = (exists) ? queries->execute() : -1;
+  bson_destroy(&shard_hints);
+  if (!exists)
+    *error = ejdberrmsg(JBEINVALIDCOLNAME);
+  else if (failed >= 0)
+    *error = shards.getShard(failed)->errorMessage();
+  return exists && failed < 0;
+}
+
+/// Minimum number of documents per thread to scan.
+const size_t kScanDocumentsPerThread = 1024;
+
+/// Documents and hit flags of a scan.
+struct ScanContext {
+  /// Compiled query.
+  const bsonmex::Predicate* predicate;
+  /// BSON documents.
+  const char* const* documents;
+  /// Whether each document matches.
+  char* hits;
+};
+
+/// Match a range of documents to the predicate.
+void MatchDocuments(size_t begin, size_t end, void* context) {
+  ScanContext* scan = static_cast<ScanContext*>(context);
+  for (size_t i = begin; i < end; ++i)
+    scan->hits[i] = scan->documents[i] &&
+                    scan->predicate->match(scan->documents[i]);
+}
+
+/// Current time in seconds.
+double GetTime() {
+  struct timeval time;
+  gettimeofday(&time, NULL);
+  return time.tv_sec + 1e-6 * time.tv_usec;
+}
+
+} // namespace
 
 namespace ejdbmex {
 
-Database::Database() : database_(NULL) {}
+void DecodeOptions::getPaths(vector<const char*>* paths) const {
+  paths->resize(fields.size());
+  for (int i = 0; i < fields.size(); ++i)
+    (*paths)[i] = fields[i].c_str();
+}
+
+mxArray* ConvertResultToMxArray(const void* data,
+                                int size,
+                                const DecodeOptions& options) {
+  if (!options.fields.empty()) {
+    vector<const char*> paths;
+    options.getPaths(&paths);
+    mxArray* value = CreateProjectionStruct(paths.size(), &paths[0], 1);
+    if (value && !ConvertBSONPathsToStruct((const char*)data,
+                                           paths.size(),
+                                           &paths[0],
+                                           value,
+                                           0,
+                                           options.flags)) {
+      mxDestroyArray(value);
+      return NULL;
+    }
+    return value;
+  }
+  if (options.lazy) {
+    mxArray* value = mxCreateNumericMatrix(1, size, mxUINT8_CLASS, mxREAL);
+    memcpy(mxGetData(value), data, size);
+    return value;
+  }
+  bson_iterator it;
+  bson_iterator_from_buffer(&it, (const char*)data);
+  return ConvertBSONIteratorToMxArray(&it, options.flags);
+}
+
+void FinishResults(mxArray** results, const DecodeOptions& options) {
+  if (!options.fields.empty())
+    return;
+  if (options.lazy) {
+    mxArray* handles = NULL;
+    mexCallMATLAB(1, &handles, 1, results, "bson.lazy");
+    mxDestroyArray(*results);
+    *results = handles;
+  }
+  else
+    TryMergeCellToNDArray(results);
+}
+
+bool ConvertDocuments(const vector<const char*>& documents,
+                      const DecodeOptions& options,
+                      mxArray** results) {
+  // Projected fields are decoded straight into a struct array.
+  vector<const char*> paths;
+  options.getPaths(&paths);
+  int num_documents = documents.size();
+  *results = (paths.empty()) ?
+      mxCreateCellMatrix(1, num_documents) :
+      CreateProjectionStruct(paths.size(), &paths[0], num_documents);
+  if (!*results)
+    return false;
+  for (int i = 0; i < num_documents; ++i) {
+    const char* data = documents[i];
+    bool success = data != NULL;
+    if (success && !paths.empty())
+      success = ConvertBSONPathsToStruct(data,
+                                         paths.size(),
+                                         &paths[0],
+                                         *results,
+                                         i,
+                                         options.flags);
+    else if (success) {
+      int32_t size;
+      memcpy(&size, data, sizeof(size));
+      mxArray* value = ConvertResultToMxArray(data, size, options);
+      success = value != NULL;
+      if (success)
+        mxSetCell(*results, i, value);
+    }
+    if (!success) {
+      mxDestroyArray(*results);
+      *results = NULL;
+      return false;
+    }
+  }
+  FinishResults(results, options);
+  return true;
+}
+
+bool ConvertQueryResults(EJQRESULT result_list,
+                         int num_results,
+                         const DecodeOptions& options,
+                         mxArray** results) {
+  vector<const char*> documents(num_results);
+  for (int i = 0; i < num_results; ++i) {
+    int size = 0;
+    documents[i] = static_cast<const char*>(
+        ejdbqresultbsondata(result_list, i, &size));
+  }
+  return ConvertDocuments(documents, options, results);
+}
+
+Database::Database() :
+    database_(NULL),
+    write_queue_(NULL),
+    query_cache_(NULL),
+    document_cache_(NULL),
+    shards_(NULL),
+    base_generation_(0) {}
 
 Database::~Database() {}
 
@@ -38,6 +1002,19 @@ bool Database::isOpen() {
 }
 
 bool Database::close() {
+  if (write_queue_) {
+    delete write_queue_;
+    write_queue_ = NULL;
+    mexUnlock();
+  }
+  if (shards_) {
+    delete shards_;
+    shards_ = NULL;
+  }
+  setQueryCacheBudget(0);
+  setDocumentCacheBudget(0);
+  generations_.clear();
+  document_generations_.clear();
   if (isOpen()) {
     if (!ejdbclose(database_)) {
       return false;
@@ -47,39 +1024,181 @@ bool Database::close() {
   return true;
 }
 
+EJCOLL* Database::createCollection(const char* collection_name) {
+  EJCOLLOPTS collection_options = {false, false, 65535, 0};
+  return ejdbcreatecoll(database_, collection_name, &collection_options);
+}
+
+bool Database::startWriteBehind() {
+  if (write_queue_)
+    return true;
+  write_queue_ = new WriteQueue;
+  if (!write_queue_->start(database_)) {
+    delete write_queue_;
+    write_queue_ = NULL;
+    return false;
+  }
+  mexLock();
+  return true;
+}
+
+bool Database::takeWriteError(string* message) {
+  return write_queue_ && write_queue_->takeError(message);
+}
+
+void Database::setQueryCacheBudget(size_t budget) {
+  if (budget == 0 && query_cache_) {
+    delete query_cache_;
+    query_cache_ = NULL;
+    mexUnlock();
+  }
+  else if (budget > 0 && query_cache_)
+    query_cache_->setBudget(budget);
+  else if (budget > 0) {
+    query_cache_ = new ResultCache(budget);
+    mexLock();
+  }
+}
+
+void Database::setDocumentCacheBudget(size_t budget) {
+  if (budget == 0 && document_cache_) {
+    delete document_cache_;
+    document_cache_ = NULL;
+    mexUnlock();
+  }
+  else if (budget > 0 && document_cache_)
+    document_cache_->setBudget(budget);
+  else if (budget > 0) {
+    document_cache_ = new ResultCache(budget);
+    mexLock();
+  }
+}
+
+void Database::makeDocumentCacheKey(const EJCOLL* collection,
+                                    const bson_oid_t* object_id,
+                                    const DecodeOptions* options,
+                                    string* key) const {
+  key->assign(reinterpret_cast<const char*>(&collection), sizeof(collection));
+  key->append(object_id->bytes, sizeof(object_id->bytes));
+  if (!options)
+    return;
+  key->append(reinterpret_cast<const char*>(&options->flags),
+              sizeof(options->flags));
+  key->push_back(options->lazy);
+  for (int i = 0; i < options->fields.size(); ++i)
+    key->append(options->fields[i].c_str(), options->fields[i].size() + 1);
+}
+
+void Database::makeQueryCacheKey(const EJCOLL* collection,
+                                 const bson* query,
+                                 const bson* hints,
+                                 int flags,
+                                 const DecodeOptions& options,
+                                 string* key) const {
+  key->assign(reinterpret_cast<const char*>(&collection), sizeof(collection));
+  key->append(reinterpret_cast<const char*>(&flags), sizeof(flags));
+  key->append(reinterpret_cast<const char*>(&options.flags),
+              sizeof(options.flags));
+  int size = bson_size(query);
+  key->append(reinterpret_cast<const char*>(&size), sizeof(size));
+  key->append(bson_data(query), size);
+  size = (hints) ? bson_size(hints) : 0;
+  key->append(reinterpret_cast<const char*>(&size), sizeof(size));
+  if (hints)
+    key->append(bson_data(hints), size);
+  // Field paths cannot contain a null character.
+  for (int i = 0; i < options.fields.size(); ++i)
+    key->append(options.fields[i].c_str(), options.fields[i].size() + 1);
+}
+
+bool Database::hasPendingWrites() {
+  return write_queue_ && !write_queue_->isIdle();
+}
+
+uint64_t Database::getGeneration(const EJCOLL* collection) const {
+  map<const EJCOLL*, uint64_t>::const_iterator generation =
+      generations_.find(collection);
+  return base_generation_ +
+         ((generation == generations_.end()) ? 0 : generation->second);
+}
+
+uint64_t Database::getDocumentGeneration(const EJCOLL* collection) const {
+  map<const EJCOLL*, uint64_t>::const_iterator generation =
+      document_generations_.find(collection);
+  return base_generation_ +
+         ((generation == document_generations_.end()) ?
+          0 : generation->second);
+}
+
+void Database::touch(const EJCOLL* collection) {
+  ++generations_[collection];
+}
+
+void Database::touchDocument(const EJCOLL* collection,
+                             const bson_oid_t* object_id) {
+  touch(collection);
+  if (document_cache_) {
+    string prefix;
+    makeDocumentCacheKey(collection, object_id, NULL, &prefix);
+    document_cache_->erasePrefix(prefix);
+  }
+}
+
+void Database::touchDocuments(const EJCOLL* collection) {
+  touch(collection);
+  ++document_generations_[collection];
+}
+
+void Database::touchAll() {
+  ++base_generation_;
+  if (query_cache_)
+    query_cache_->clear();
+  if (document_cache_)
+    document_cache_->clear();
+}
+
+void Database::setShards(ShardSet* shards) {
+  delete shards_;
+  shards_ = shards;
+}
+
 const char* Database::errorMessage() {
+  if (!error_.empty())
+    return error_.c_str();
   return ejdberrmsg(ejdbecode(database_));
 }
 
+string Database::takeErrorMessage() {
+  string message = errorMessage();
+  error_.clear();
+  return message;
+}
+
 bool Database::save(const char* collection_name,
                     bson* value,
-                    string* object_id) {
-  bson_oid_t oid;
-  char buffer[1024];
-  EJCOLLOPTS collection_options = {false, false, 65535, 0};
-  EJCOLL* collection = ejdbcreatecoll(database_,
-                                      collection_name,
-                                      &collection_options);
+                    bson_oid_t* object_id) {
+  EJCOLL* collection = createCollection(collection_name);
   if (!collection)
     return false;
   // TODO: merge option.
-  if (!ejdbsavebson(collection, value, &oid))
-    return false;
-  bson_oid_to_string(&oid, buffer);
-  *object_id = buffer;
-  return true;
+  bool success = ejdbsavebson(collection, value, object_id);
+  if (success)
+    touchDocument(collection, object_id);
+  else
+    touchDocuments(collection);
+  return success;
 }
 
-bool Database::load(EJCOLL* collection, const char* object_id, bson** value) {
-  bson_oid_t oid;
-  bson_oid_from_string(&oid, object_id);
-  *value = ejdbloadbson(collection, &oid);
+bool Database::load(EJCOLL* collection,
+                    const bson_oid_t* object_id,
+                    bson** value) {
+  *value = ejdbloadbson(collection, object_id);
   return *value != NULL;
 }
 
-bool Database::remove(EJCOLL* collection, const char* object_id) {
-  bson_oid_t oid;
-  bson_oid_from_string(&oid, object_id);
+bool Database::remove(EJCOLL* collection, const bson_oid_t* object_id) {
+  touchDocument(collection, object_id);
+  bson_oid_t oid = *object_id;
   return ejdbrmbson(collection, &oid);
 }
 
@@ -87,7 +1206,8 @@ bool Database::find(EJCOLL* collection,
                     bson* query,
                     bson* hints,
                     mxArray** results,
-                    int flags) {
+                    int flags,
+                    const DecodeOptions& options) {
   EJQ* ejdb_query = ejdbcreatequery(database_, query, NULL, 0, hints);
   if (!ejdb_query)
     return false;
@@ -107,36 +1227,754 @@ bool Database::find(EJCOLL* collection,
       return false;
     }
     num_results = (flags == JBQRYFINDONE && num_results > 1) ? 1 : num_results;
-    *results = mxCreateCellMatrix(1, num_results);
-    for (int i = 0; i < num_results; ++i) {
-      int size = 0;
-      const void* result_data = ejdbqresultbsondata(result_list, i, &size);
-      if (!result_data) {
-        ejdbqresultdispose(result_list);
-        ejdbquerydel(ejdb_query);
+    bool success = ConvertQueryResults(result_list,
+                                       num_results,
+                                       options,
+                                       results);
+    ejdbqresultdispose(result_list);
+    ejdbquerydel(ejdb_query);
+    return success;
+  }
+  return true;
+}
+
+bool Database::scan(EJCOLL* collection,
+                    const bsonmex::Predicate& predicate,
+                    int num_threads,
+                    const DecodeOptions& options,
+                    mxArray** results) {
+  bson query;
+  bson_init_as_query(&query);
+  bson_finish(&query);
+  QueryResults all;
+  bool success = all.execute(database_, collection, &query, NULL);
+  bson_destroy(&query);
+  if (!success)
+    return false;
+  size_t size = all.size();
+  vector<const char*> documents(size);
+  for (size_t i = 0; i < size; ++i)
+    documents[i] = all.data(i);
+  vector<char> hits(size);
+  ScanContext context;
+  context.predicate = &predicate;
+  context.documents = (size) ? &documents[0] : NULL;
+  context.hits = (size) ? &hits[0] : NULL;
+  num_threads = std::max(1, std::min<int>(
+      num_threads, size / kScanDocumentsPerThread));
+  bsonmex::ParallelFor(size, num_threads, MatchDocuments, &context);
+  vector<const char*> matches;
+  for (size_t i = 0; i < size; ++i)
+    if (hits[i])
+      matches.push_back(documents[i]);
+  return ConvertDocuments(matches, options, results);
+}
+
+bool Database::join(EJCOLL* left_collection,
+                    bson* left_query,
+                    const char* left_key,
+                    EJCOLL* right_collection,
+                    bson* right_query,
+                    const char* right_key,
+                    JoinOutput output,
+                    const DecodeOptions& options,
+                    mxArray** results) {
+  QueryResults left, right;
+  if (!left.execute(database_, left_collection, left_query, NULL) ||
+      !right.execute(database_, right_collection, right_query, NULL))
+    return false;
+  // Build the hash table on the smaller side and probe with the other.
+  bool build_left = left.size() <= right.size();
+  const QueryResults& build = (build_left) ? left : right;
+  const QueryResults& probe = (build_left) ? right : left;
+  const char* build_key = (build_left) ? left_key : right_key;
+  const char* probe_key = (build_left) ? right_key : left_key;
+  JoinTable table(build.size());
+  JoinKey key;
+  for (int i = 0; i < build.size(); ++i)
+    if (GetJoinKey(build.data(i), build_key, &key))
+      table.insert(key, i);
+  vector<pair<int, int> > pairs;
+  vector<int> matches;
+  for (int i = 0; i < probe.size(); ++i) {
+    if (!GetJoinKey(probe.data(i), probe_key, &key))
+      continue;
+    matches.clear();
+    table.find(key, &matches);
+    for (int j = 0; j < matches.size(); ++j)
+      pairs.push_back((build_left) ? make_pair(matches[j], i) :
+                                     make_pair(i, matches[j]));
+  }
+  sort(pairs.begin(), pairs.end());
+  int num_pairs = pairs.size();
+  if (output == JOIN_PAIRS) {
+    *results = mxCreateDoubleMatrix(num_pairs, 2, mxREAL);
+    double* data = mxGetPr(*results);
+    for (int i = 0; i < num_pairs; ++i) {
+      data[i] = pairs[i].first + 1;
+      data[i + num_pairs] = pairs[i].second + 1;
+    }
+    return true;
+  }
+  vector<const char*> paths;
+  options.getPaths(&paths);
+  *results = (paths.empty()) ?
+      mxCreateCellMatrix(1, num_pairs) :
+      CreateProjectionStruct(paths.size(), &paths[0], num_pairs);
+  if (!*results)
+    return false;
+  for (int i = 0; i < num_pairs; ++i) {
+    char* merged = NULL;
+    size_t size = 0;
+    if (!MergeBSONDocuments(left.data(pairs[i].first),
+                            right.data(pairs[i].second),
+                            &merged,
+                            &size))
+      return false;
+    bool success = true;
+    if (!paths.empty())
+      success = ConvertBSONPathsToStruct(merged,
+                                         paths.size(),
+                                         &paths[0],
+                                         *results,
+                                         i,
+                                         options.flags);
+    else {
+      mxArray* value = ConvertResultToMxArray(merged, size, options);
+      success = value != NULL;
+      if (success)
+        mxSetCell(*results, i, value);
+    }
+    free(merged);
+    if (!success)
+      return false;
+  }
+  FinishResults(results, options);
+  return true;
+}
+
+bool Database::aggregate(EJCOLL* collection,
+                         bson* query,
+                         bson* hints,
+                         const vector<string>& group_fields,
+                         const vector<Aggregate>& aggregates,
+                         mxArray** results) {
+  // Make the output struct before querying, so that errors do not leak.
+  *results = CreateAggregateStruct(group_fields, aggregates);
+  QueryResults documents;
+  if (!documents.execute(database_, collection, query, hints)) {
+    mxDestroyArray(*results);
+    return false;
+  }
+  vector<const char*> data(documents.size());
+  for (int i = 0; i < documents.size(); ++i)
+    data[i] = documents.data(i);
+  FillAggregateStruct(data, group_fields, aggregates, *results);
+  return true;
+}
+
+bool Database::sketch(EJCOLL* collection,
+                      bson* query,
+                      bson* hints,
+                      const char* field,
+                      bsonmex::SketchType type,
+                      double parameter,
+                      string* state) {
+  QueryResults documents;
+  if (!documents.execute(database_, collection, query, hints))
+    return false;
+  if (type == bsonmex::SKETCH_HLL) {
+    HyperLogLog sketch(static_cast<int>(parameter));
+    JoinKey key;
+    string buffer;
+    for (int i = 0; i < documents.size(); ++i)
+      if (GetJoinKey(documents.data(i), field, &key))
+        sketch.add(HashJoinKey(key, &buffer));
+    sketch.serialize(state);
+  }
+  else {
+    QuantileSketch sketch(parameter);
+    for (int i = 0; i < documents.size(); ++i) {
+      const char* data = documents.data(i);
+      double value;
+      if (data && GetNumber(data, field, &value))
+        sketch.add(value);
+    }
+    sketch.serialize(state);
+  }
+  return true;
+}
+
+bool Database::findColumns(EJCOLL* collection,
+                           bson* query,
+                           bson* hints,
+                           const vector<string>& fields,
+                           mxClassID class_id,
+                           vector<mxArray*>* columns,
+                           vector<mxArray*>* masks) {
+  QueryResults documents;
+  if (!documents.execute(database_, collection, query, hints))
+    return false;
+  int size = documents.size();
+  double nan = mxGetNaN();
+  for (int j = 0; j < fields.size(); ++j) {
+    mxArray* column = (class_id == mxLOGICAL_CLASS) ?
+        mxCreateLogicalMatrix(size, 1) :
+        mxCreateNumericMatrix(size, 1, class_id, mxREAL);
+    mxArray* mask = mxCreateLogicalMatrix(size, 1);
+    void* data = mxGetData(column);
+    mxLogical* mask_data = mxGetLogicals(mask);
+    const char* field = fields[j].c_str();
+    switch (class_id) {
+      case mxDOUBLE_CLASS:
+        FillColumn(documents, field, nan, static_cast<double*>(data),
+                   mask_data);
+        break;
+      case mxSINGLE_CLASS:
+        FillColumn(documents, field, static_cast<float>(nan),
+                   static_cast<float*>(data), mask_data);
+        break;
+      case mxINT8_CLASS:
+        FillColumn<int8_t>(documents, field, 0, static_cast<int8_t*>(data),
+                           mask_data);
+        break;
+      case mxUINT8_CLASS:
+        FillColumn<uint8_t>(documents, field, 0, static_cast<uint8_t*>(data),
+                            mask_data);
+        break;
+      case mxINT16_CLASS:
+        FillColumn<int16_t>(documents, field, 0, static_cast<int16_t*>(data),
+                            mask_data);
+        break;
+      case mxUINT16_CLASS:
+        FillColumn<uint16_t>(documents, field, 0,
+                             static_cast<uint16_t*>(data), mask_data);
+        break;
+      case mxINT32_CLASS:
+        FillColumn<int32_t>(documents, field, 0, static_cast<int32_t*>(data),
+                            mask_data);
+        break;
+      case mxUINT32_CLASS:
+        FillColumn<uint32_t>(documents, field, 0,
+                             static_cast<uint32_t*>(data), mask_data);
+        break;
+      case mxINT64_CLASS:
+        FillColumn<int64_t>(documents, field, 0, static_cast<int64_t*>(data),
+                            mask_data);
+        break;
+      case mxUINT64_CLASS:
+        FillColumn<uint64_t>(documents, field, 0,
+                             static_cast<uint64_t*>(data), mask_data);
+        break;
+      case mxLOGICAL_CLASS:
+        FillColumn<mxLogical>(documents, field, 0,
+                              static_cast<mxLogical*>(data), mask_data, true);
+        break;
+      default:
+        mxDestroyArray(column);
+        mxDestroyArray(mask);
         return false;
+    }
+    columns->push_back(column);
+    masks->push_back(mask);
+  }
+  return true;
+}
+
+bool Database::import(const char* collection_name,
+                      const char* filename,
+                      FileFormat format,
+                      int batch_size,
+                      int num_threads,
+                      int* count) {
+  *count = 0;
+  error_.clear();
+  EJCOLL* collection = createCollection(collection_name);
+  if (!collection)
+    return false;
+  touchDocuments(collection);
+  if (format == FORMAT_BSON) {
+    BSONStream stream;
+    if (!stream.open(filename, false, false)) {
+      error_ = stream.errorMessage();
+      return false;
+    }
+    vector<const char*> documents;
+    vector<bson> values;
+    vector<bson*> pointers;
+    while (stream.read(batch_size, &documents) && !documents.empty()) {
+      values.resize(documents.size());
+      pointers.resize(documents.size());
+      for (int i = 0; i < documents.size(); ++i) {
+        bson_init_finished_data(&values[i], const_cast<char*>(documents[i]));
+        pointers[i] = &values[i];
       }
-      bson_iterator it;
-      bson_iterator_from_buffer(&it, (const char*)result_data);
-      mxArray* value = ConvertBSONIteratorToMxArray(&it);
-      if (!value) {
-        ejdbqresultdispose(result_list);
-        ejdbquerydel(ejdb_query);
+      if (SaveDocuments(collection, &pointers) >= 0)
         return false;
+      *count += documents.size();
+    }
+    if (*stream.errorMessage()) {
+      error_ = stream.errorMessage();
+      stream.close();
+      return false;
+    }
+    return true;
+  }
+  MappedFile file;
+  if (!file.open(filename)) {
+    error_ = file.errorMessage();
+    return false;
+  }
+  JSONBatch batches[2];
+  JSONBatch* current = &batches[0];
+  JSONBatch* next = &batches[1];
+  ThreadGroup threads;
+  int line_number = 0;
+  size_t offset = ReadJSONLines(file, 0, batch_size, &line_number, current);
+  threads.start(current->lines.size(), num_threads, ParseJSONLines, current);
+  threads.join();
+  string message;
+  bool success = true;
+  while (success && !current->lines.empty()) {
+    // Parse the next batch while saving the current one.
+    offset = ReadJSONLines(file, offset, batch_size, &line_number, next);
+    threads.start(next->lines.size(), num_threads, ParseJSONLines, next);
+    vector<bson*> pointers;
+    for (int i = 0; i < current->documents.size(); ++i) {
+      if (current->errors[i]) {
+        char buffer[32];
+        sprintf(buffer, "line %d: ", current->line_numbers[i]);
+        message = string(buffer) + current->errors[i];
+        break;
       }
-      mxSetCell(*results, i, value);
+      pointers.push_back(&current->documents[i]);
     }
-    ejdbqresultdispose(result_list);
+    if (message.empty())
+      success = SaveDocuments(collection, &pointers) < 0;
+    threads.join();
+    file.release(current->lines.back() - file.data());
+    if (success && message.empty())
+      *count += pointers.size();
+    current->clear();
+    std::swap(current, next);
+    if (!message.empty())
+      break;
+  }
+  current->clear();
+  file.close();
+  if (!message.empty()) {
+    error_ = message;
+    return false;
+  }
+  return success;
+}
+
+bool Database::exportQuery(EJCOLL* collection,
+                           bson* query,
+                           bson* hints,
+                           const char* filename,
+                           FileFormat format,
+                           ExportStats* stats) {
+  double start_time = GetTime();
+  error_.clear();
+  EJQ* ejdb_query = ejdbcreatequery(database_, query, NULL, 0, hints);
+  if (!ejdb_query)
+    return false;
+  uint32_t num_results;
+  EJQRESULT result_list = ejdbqryexecute(collection,
+                                         ejdb_query,
+                                         &num_results,
+                                         0,
+                                         NULL);
+  if (!result_list) {
     ejdbquerydel(ejdb_query);
-    TryMergeCellToNDArray(results);
+    return false;
   }
+  BSONStream stream;
+  bool success = stream.open(filename, true, false);
+  if (!success)
+    error_ = stream.errorMessage();
+  JSONBuffer text = {NULL, 0, 0};
+  for (int i = 0; success && i < num_results; ++i) {
+    int size = 0;
+    const char* data = static_cast<const char*>(
+        ejdbqresultbsondata(result_list, i, &size));
+    if (!data)
+      continue;
+    if (format == FORMAT_JSONL) {
+      text.size = 0;
+      success = ConvertBSONToJSON(data, false, &text);
+      if (!success) {
+        char buffer[64];
+        sprintf(buffer, "Failed to convert result %d to JSON.", i + 1);
+        error_ = buffer;
+        break;
+      }
+      success = stream.write(text.data, text.size) && stream.write("\n", 1);
+    }
+    else
+      success = stream.write(data, size);
+    if (success)
+      ++stats->count;
+  }
+  FreeJSONBuffer(&text);
+  ejdbqresultdispose(result_list);
+  ejdbquerydel(ejdb_query);
+  stats->bytes = stream.position();
+  if (!stream.close())
+    success = false;
+  stats->seconds = GetTime() - start_time;
+  if (!success && error_.empty())
+    error_ = stream.errorMessage();
+  return success;
+}
+
+ShardSet::ShardSet(const vector<int>& shard_ids,
+                   const vector<Database*>& shards,
+                   const string& shard_key) :
+    shard_ids_(shard_ids),
+    shards_(shards),
+    shard_key_(shard_key),
+    error_("") {}
+
+int ShardSet::route(const bson_oid_t* object_id) const {
+  return HashBytes(2166136261u, object_id->bytes, sizeof(object_id->bytes)) %
+         shards_.size();
+}
+
+int ShardSet::route(const bson* document, const bson_oid_t* object_id) const {
+  JoinKey key;
+  if (shard_key_.empty() ||
+      !GetJoinKey(bson_data(document), shard_key_.c_str(), &key))
+    return route(object_id);
+  if (key.type == BSON_ARRAY || key.type == BSON_OBJECT)
+    return -1;
+  return key.hash % shards_.size();
+}
+
+int ShardSet::route(const bson* query) const {
+  if (shard_key_.empty())
+    return -1;
+  bson_iterator it;
+  bson_type type = bson_find(&it, query, shard_key_.c_str());
+  JoinKey key;
+  if (type == BSON_ARRAY || type == BSON_OBJECT || type == BSON_REGEX ||
+      !MakeJoinKey(&it, type, &key))
+    return -1;
+  return key.hash % shards_.size();
+}
+
+bool ShardSet::save(const char* collection_name,
+                    bson* value,
+                    bson_oid_t* object_id,
+                    bool is_new) {
+  int shard = route(value, object_id);
+  if (shard < 0) {
+    error_ = "Shard key must not be an array or a document.";
+    return false;
+  }
+  if (!shards_[shard]->save(collection_name, value, object_id)) {
+    error_ = shards_[shard]->errorMessage();
+    return false;
+  }
+  // Remove the old copy after saving, so that a failure does not lose it.
+  for (int i = 0; !is_new && !shard_key_.empty() && i < size(); ++i) {
+    EJCOLL* collection = (i == shard) ?
+        NULL : ejdbgetcoll(shards_[i]->getMutable(), collection_name);
+    if (collection && !shards_[i]->remove(collection, object_id)) {
+      error_ = shards_[i]->errorMessage();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ShardSet::load(const char* collection_name,
+                    const bson_oid_t* object_id,
+                    bson** value) {
+  // Documents are found by object id only without a shard key.
+  int begin = (shard_key_.empty()) ? route(object_id) : 0;
+  int end = (shard_key_.empty()) ? begin + 1 : size();
+  for (int i = begin; i < end; ++i) {
+    EJCOLL* collection = ejdbgetcoll(shards_[i]->getMutable(),
+                                     collection_name);
+    if (collection && shards_[i]->load(collection, object_id, value))
+      return true;
+  }
+  return false;
+}
+
+bool ShardSet::remove(const char* collection_name,
+                      const bson_oid_t* object_id) {
+  int begin = (shard_key_.empty()) ? route(object_id) : 0;
+  int end = (shard_key_.empty()) ? begin + 1 : size();
+  for (int i = begin; i < end; ++i) {
+    EJCOLL* collection = ejdbgetcoll(shards_[i]->getMutable(),
+                                     collection_name);
+    if (collection && !shards_[i]->remove(collection, object_id)) {
+      error_ = shards_[i]->errorMessage();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ShardSet::find(const char* collection_name,
+                    bson* query,
+                    bson* hints,
+                    mxArray** results,
+                    int flags,
+                    const DecodeOptions& options) {
+  ShardQueries queries(size());
+  ShardHints merge;
+  if (!QueryShards(*this,
+                   collection_name,
+                   query,
+                   hints,
+                   flags,
+                   &queries,
+                   &merge,
+                   &error_))
+    return false;
+  if (flags == JBQRYCOUNT) {
+    int count = std::max(0, queries.getNumResults() - merge.skip);
+    *results = mxCreateDoubleScalar(
+        (merge.max >= 0) ? std::min(count, merge.max) : count);
+    return true;
+  }
+  vector<const char*> documents;
+  MergeShardResults(queries, merge, &documents);
+  if (!ConvertDocuments(documents, options, results)) {
+    error_ = ejdberrmsg(JBEINVALIDBSON);
+    return false;
+  }
+  return true;
+}
+
+bool ShardSet::aggregate(const char* collection_name,
+                         bson* query,
+                         bson* hints,
+                         const vector<string>& group_fields,
+                         const vector<Aggregate>& aggregates,
+                         mxArray** results) {
+  *results = CreateAggregateStruct(group_fields, aggregates);
+  ShardQueries queries(size());
+  ShardHints merge;
+  if (!QueryShards(*this,
+                   collection_name,
+                   query,
+                   hints,
+                   0,
+                   &queries,
+                   &merge,
+                   &error_)) {
+    mxDestroyArray(*results);
+    return false;
+  }
+  vector<const char*> documents;
+  MergeShardResults(queries, merge, &documents);
+  FillAggregateStruct(documents, group_fields, aggregates, *results);
   return true;
 }
 
+/// Query state shared with the worker thread.
+struct QueryFuture::State {
+  /// Database to query.
+  Database* database;
+  /// Collection to query.
+  EJCOLL* collection;
+  /// Query object.
+  bson query;
+  /// Hint object.
+  bson hints;
+  /// Whether hints are given.
+  bool with_hints;
+  /// Result conversion options.
+  DecodeOptions options;
+  /// Worker thread.
+  pthread_t thread;
+  /// Whether the worker thread is to be joined.
+  bool running;
+  /// Lock of the flags.
+  pthread_mutex_t mutex;
+  /// Signaled when ready.
+  pthread_cond_t ready_cond;
+  /// Whether the worker has finished. Guarded by the mutex.
+  bool ready;
+  /// Whether the query is cancelled. Guarded by the mutex.
+  bool cancelled;
+  /// Compiled query.
+  EJQ* ejdb_query;
+  /// Result list, or NULL when failed.
+  EJQRESULT results;
+  /// Number of results.
+  uint32_t num_results;
+  /// Error message when failed.
+  const char* error;
+};
+
+QueryFuture::QueryFuture() : state_(NULL) {}
+
+QueryFuture::QueryFuture(const QueryFuture& other) : state_(NULL) {}
+
+QueryFuture::~QueryFuture() {
+  if (!state_)
+    return;
+  wait();
+  if (state_->results)
+    ejdbqresultdispose(state_->results);
+  if (state_->ejdb_query)
+    ejdbquerydel(state_->ejdb_query);
+  bson_destroy(&state_->query);
+  if (state_->with_hints)
+    bson_destroy(&state_->hints);
+  pthread_cond_destroy(&state_->ready_cond);
+  pthread_mutex_destroy(&state_->mutex);
+  delete state_;
+  mexUnlock();
+}
+
+bool QueryFuture::start(Database* database,
+                        EJCOLL* collection,
+                        bson* query,
+                        bson* hints,
+                        const DecodeOptions& options) {
+  if (state_)
+    return false;
+  state_ = new State;
+  state_->database = database;
+  state_->collection = collection;
+  state_->query = *query;
+  state_->with_hints = hints != NULL;
+  if (hints)
+    state_->hints = *hints;
+  state_->options = options;
+  state_->running = false;
+  state_->ready = false;
+  state_->cancelled = false;
+  state_->ejdb_query = NULL;
+  state_->results = NULL;
+  state_->num_results = 0;
+  state_->error = NULL;
+  pthread_mutex_init(&state_->mutex, NULL);
+  pthread_cond_init(&state_->ready_cond, NULL);
+  mexLock();
+  state_->running = pthread_create(&state_->thread, NULL, run, state_) == 0;
+  if (!state_->running) {
+    state_->error = "Failed to start a thread.";
+    state_->ready = true;
+  }
+  return state_->running;
+}
+
+bool QueryFuture::isReady() const {
+  if (!state_)
+    return false;
+  pthread_mutex_lock(&state_->mutex);
+  bool ready = state_->ready;
+  pthread_mutex_unlock(&state_->mutex);
+  return ready;
+}
+
+bool QueryFuture::fetch(mxArray** results, const char** error) {
+  if (!state_ || isCancelled()) {
+    *error = "No query to fetch.";
+    return false;
+  }
+  wait();
+  if (!state_->results) {
+    *error = state_->error;
+    return false;
+  }
+  if (!ConvertQueryResults(state_->results,
+                           state_->num_results,
+                           state_->options,
+                           results)) {
+    *error = "Failed to convert results.";
+    return false;
+  }
+  return true;
+}
+
+void QueryFuture::cancel() {
+  if (!state_)
+    return;
+  pthread_mutex_lock(&state_->mutex);
+  state_->cancelled = true;
+  pthread_mutex_unlock(&state_->mutex);
+}
+
+bool QueryFuture::isCancelled() const {
+  if (!state_)
+    return false;
+  pthread_mutex_lock(&state_->mutex);
+  bool cancelled = state_->cancelled;
+  pthread_mutex_unlock(&state_->mutex);
+  return cancelled;
+}
+
+const Database* QueryFuture::database() const {
+  return (state_) ? state_->database : NULL;
+}
+
+void QueryFuture::wait() {
+  if (!state_)
+    return;
+  pthread_mutex_lock(&state_->mutex);
+  while (!state_->ready)
+    pthread_cond_wait(&state_->ready_cond, &state_->mutex);
+  pthread_mutex_unlock(&state_->mutex);
+  if (state_->running) {
+    pthread_join(state_->thread, NULL);
+    state_->running = false;
+  }
+}
+
+void* QueryFuture::run(void* value) {
+  execute(value);
+  return NULL;
+}
+
+void QueryFuture::execute(void* value) {
+  State* state = static_cast<State*>(value);
+  // A query cancelled before the thread runs is skipped.
+  pthread_mutex_lock(&state->mutex);
+  bool cancelled = state->cancelled;
+  pthread_mutex_unlock(&state->mutex);
+  if (cancelled) {
+    state->error = "Cancelled.";
+    pthread_mutex_lock(&state->mutex);
+    state->ready = true;
+    pthread_cond_broadcast(&state->ready_cond);
+    pthread_mutex_unlock(&state->mutex);
+    return;
+  }
+  EJDB* database = state->database->getMutable();
+  state->ejdb_query = ejdbcreatequery(database,
+                                      &state->query,
+                                      NULL,
+                                      0,
+                                      (state->with_hints) ?
+                                      &state->hints : NULL);
+  if (state->ejdb_query)
+    state->results = ejdbqryexecute(state->collection,
+                                    state->ejdb_query,
+                                    &state->num_results,
+                                    0,
+                                    NULL);
+  if (!state->results)
+    state->error = ejdberrmsg(ejdbecode(database));
+  pthread_mutex_lock(&state->mutex);
+  state->ready = true;
+  pthread_cond_broadcast(&state->ready_cond);
+  pthread_mutex_unlock(&state->mutex);
+}
+
 } // namespace ejdbmex
 
 namespace mex {
 
 template class Session<ejdbmex::Database>;
+template class Session<ejdbmex::QueryFuture>;
 
 } // namespace mex
\ No newline at end of file
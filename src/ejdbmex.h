@@ -6,7 +6,10 @@
 #define __EJDBMEX_H__
 
 #include "mex/session.h"
+#include "sketch.h"
+#include <map>
 #include <string>
+#include <vector>
 
 using namespace std;
 
@@ -19,8 +22,110 @@ using namespace std;
 /// Forward declarations.
 struct EJDB;
 
+namespace bsonmex {
+
+class Predicate;
+
+} // namespace bsonmex
+
 namespace ejdbmex {
 
+class ResultCache;
+class ShardSet;
+class WriteQueue;
+
+/// File formats of document dumps.
+enum FileFormat {
+  /// Concatenated BSON documents, e.g., mongodump output.
+  FORMAT_BSON,
+  /// One JSON object per line.
+  FORMAT_JSONL
+};
+
+/// Output of a join.
+enum JoinOutput {
+  JOIN_MERGED,
+  JOIN_PAIRS
+};
+
+/// Aggregate function of a field.
+enum AggregateFunction {
+  AGGREGATE_COUNT,
+  AGGREGATE_SUM,
+  AGGREGATE_MIN,
+  AGGREGATE_MAX,
+  AGGREGATE_MEAN
+};
+
+/// Aggregate of a field in each group.
+struct Aggregate {
+  /// Aggregate function.
+  AggregateFunction function;
+  /// Dotted path to the field.
+  string field;
+};
+
+/// Statistics of an export.
+struct ExportStats {
+  /// Empty statistics.
+  ExportStats() : count(0), bytes(0), seconds(0) {}
+  /// Number of exported documents.
+  double count;
+  /// Number of bytes written.
+  double bytes;
+  /// Elapsed time in seconds.
+  double seconds;
+};
+
+/// Options to convert query results to mxArray.
+struct DecodeOptions {
+  /// Default options decode every document.
+  DecodeOptions() : lazy(false), flags(0) {}
+  /// Get field paths as C strings.
+  /// @param paths pointers to the strings in fields.
+  void getPaths(vector<const char*>* paths) const;
+  /// Return bson.lazy handles that decode fields on access.
+  bool lazy;
+  /// Dotted paths to convert into a flat struct. Empty to convert all.
+  vector<string> fields;
+  /// Decoder flags, e.g., BSONMEX_DECODE_OID_BINARY.
+  int flags;
+};
+
+/// Convert a BSON document in the query result to mxArray.
+/// @param data BSON data.
+/// @param size size of the BSON data.
+/// @param options conversion options.
+/// @return Newly allocated mxArray, or NULL if unsuccessful.
+mxArray* ConvertResultToMxArray(const void* data,
+                                int size,
+                                const DecodeOptions& options);
+
+/// Finalize a cell array of converted query results.
+/// @param results cell array of results made by ConvertResultToMxArray().
+/// @param options conversion options.
+void FinishResults(mxArray** results, const DecodeOptions& options);
+
+/// Convert raw BSON documents to mxArray.
+/// @param documents BSON documents.
+/// @param options conversion options.
+/// @param results cell array or struct array of the documents.
+/// @return true if success.
+bool ConvertDocuments(const vector<const char*>& documents,
+                      const DecodeOptions& options,
+                      mxArray** results);
+
+/// Convert raw query results to mxArray.
+/// @param result_list query results.
+/// @param num_results number of results to convert.
+/// @param options conversion options.
+/// @param results cell array or struct array of the results.
+/// @return true if success.
+bool ConvertQueryResults(EJQRESULT result_list,
+                         int num_results,
+                         const DecodeOptions& options,
+                         mxArray** results);
+
 /// Database handle.
 class Database {
 public:
@@ -40,39 +145,419 @@ public:
   bool close();
   /// Last error message.
   const char* errorMessage();
+  /// Take the last error message, clearing an error set by import() or
+  /// exportQuery() so that it is not reported for later EJDB errors.
+  string takeErrorMessage();
   /// Save a BSON object.
   /// @param collection_name name of the collection to save.
   /// @param value bson value to be stored.
   /// @param object_id assigned object id.
   /// @return true if success.
-  bool save(const char* collection_name, bson* value, string* object_id);
+  bool save(const char* collection_name, bson* value, bson_oid_t* object_id);
   /// Load a BSON object.
   /// @param collection_name name of the collection to save.
   /// @param object_id object id.
   /// @param value bson value to be loaded. Must be freed with bson_del().
   /// @return true if success.
-  bool load(EJCOLL* collection, const char* object_id, bson** value);
+  bool load(EJCOLL* collection, const bson_oid_t* object_id, bson** value);
   /// Remove a BSON object.
   /// @param collection_name name of the collection to save.
   /// @param object_id object id to be removed.
   /// @return true if success.
-  bool remove(EJCOLL* collection, const char* object_id);
+  bool remove(EJCOLL* collection, const bson_oid_t* object_id);
   /// Query objects.
   /// @param collection Collection in which to query.
   /// @param query bson query object.
   /// @param hints bson query hint object.
   /// @param results query results.
   /// @param flags query search mode: JBQRYCOUNT or JBQRYFINDONE.
+  /// @param options result conversion options.
   /// @return true if success.
   bool find(EJCOLL* collection,
             bson* query,
             bson* hints,
             mxArray** results,
-            int flags);
+            int flags,
+            const DecodeOptions& options = DecodeOptions());
+  /// Filter all documents of a collection with a compiled predicate.
+  /// The collection is read in one pass and the predicate is evaluated
+  /// over the raw BSON of ranges of documents in worker threads, so that
+  /// only matched documents are converted to mxArray.
+  /// @param collection Collection to scan.
+  /// @param predicate compiled query.
+  /// @param num_threads number of threads to use.
+  /// @param options result conversion options.
+  /// @param results matched documents in the collection order.
+  /// @return true if success.
+  bool scan(EJCOLL* collection,
+            const bsonmex::Predicate& predicate,
+            int num_threads,
+            const DecodeOptions& options,
+            mxArray** results);
+  /// Join the results of two queries on equal key values.
+  /// A hash table is built over the raw BSON key values of the smaller
+  /// side and probed with the other side, so that only matched documents
+  /// are converted to mxArray. Numeric keys match by value regardless of
+  /// their BSON type, and documents without the key never match.
+  /// @param left_collection collection of the left side.
+  /// @param left_query bson query object of the left side.
+  /// @param left_key dotted path to the key in the left documents.
+  /// @param right_collection collection of the right side.
+  /// @param right_query bson query object of the right side.
+  /// @param right_key dotted path to the key in the right documents.
+  /// @param output JOIN_MERGED for merged documents, where fields of the
+  ///               left document win, or JOIN_PAIRS for an N-by-2 matrix of
+  ///               one-based indices into the left and right results.
+  /// @param options result conversion options for merged documents.
+  /// @param results join results sorted by the left and right indices.
+  /// @return true if success.
+  bool join(EJCOLL* left_collection,
+            bson* left_query,
+            const char* left_key,
+            EJCOLL* right_collection,
+            bson* right_query,
+            const char* right_key,
+            JoinOutput output,
+            const DecodeOptions& options,
+            mxArray** results);
+  /// Aggregate query results by group without converting them to mxArray.
+  /// Only the group fields and the aggregated fields of each result are
+  /// read, and groups are kept in a hash table of their raw BSON values.
+  /// COUNT counts the documents that have the field, and SUM, MIN, MAX and
+  /// MEAN take numeric values, skipping others.
+  /// @param collection Collection in which to query.
+  /// @param query bson query object.
+  /// @param hints bson query hint object.
+  /// @param group_fields dotted paths to group by. Empty for one group.
+  /// @param aggregates aggregates to compute.
+  /// @param results 1x1 struct of N-by-1 columns: one per group field, the
+  ///                number of documents in the group `count`, and one per
+  ///                aggregate, e.g., `sum_bytes`.
+  /// @return true if success.
+  bool aggregate(EJCOLL* collection,
+                 bson* query,
+                 bson* hints,
+                 const vector<string>& group_fields,
+                 const vector<Aggregate>& aggregates,
+                 mxArray** results);
+  /// Sketch a field of query results in one pass without converting them
+  /// to mxArray. A HyperLogLog sketch counts distinct raw BSON values, where
+  /// numbers are distinct by value. A quantile sketch takes numeric values
+  /// and skips others.
+  /// @param collection Collection in which to query.
+  /// @param query bson query object.
+  /// @param hints bson query hint object.
+  /// @param field dotted path to the field.
+  /// @param type bsonmex::SKETCH_HLL or bsonmex::SKETCH_QUANTILES.
+  /// @param parameter precision bits of HyperLogLog, or relative accuracy
+  ///                  of quantiles.
+  /// @param state serialized sketch.
+  /// @return true if success.
+  bool sketch(EJCOLL* collection,
+              bson* query,
+              bson* hints,
+              const char* field,
+              bsonmex::SketchType type,
+              double parameter,
+              string* state);
+  /// Query fields of each result into typed columns.
+  /// Numbers and booleans are converted to the class as Matlab does. Other
+  /// or missing values become NaN, or 0 for integer and logical classes.
+  /// @param collection Collection in which to query.
+  /// @param query bson query object.
+  /// @param hints bson query hint object.
+  /// @param fields dotted paths of the fields.
+  /// @param class_id class of the columns.
+  /// @param columns N-by-1 columns to be created, one per field.
+  /// @param masks N-by-1 logical masks of present values to be created,
+  ///              one per field.
+  /// @return true if success.
+  bool findColumns(EJCOLL* collection,
+                   bson* query,
+                   bson* hints,
+                   const vector<string>& fields,
+                   mxClassID class_id,
+                   vector<mxArray*>* columns,
+                   vector<mxArray*>* masks);
+  /// Import documents from a file without converting them to mxArray.
+  /// Documents are saved in transactions of batch_size documents. JSON lines
+  /// of the next batch are parsed in worker threads while saving the current
+  /// batch. Malformed input fails the import, leaving the batches before it
+  /// saved.
+  /// @param collection_name name of the collection to import into.
+  /// @param filename path to the file.
+  /// @param format file format.
+  /// @param batch_size number of documents to save in a transaction.
+  /// @param num_threads number of threads to parse JSON lines.
+  /// @param count number of imported documents.
+  /// @return true if success.
+  bool import(const char* collection_name,
+              const char* filename,
+              FileFormat format,
+              int batch_size,
+              int num_threads,
+              int* count);
+
+  /// Export query results to a file without converting them to mxArray.
+  /// Each result is written to a buffered file as BSON, or as a line of
+  /// JSON text.
+  /// @param collection Collection in which to query.
+  /// @param query bson query object.
+  /// @param hints bson query hint object.
+  /// @param filename path to the file to write.
+  /// @param format file format.
+  /// @param stats export statistics.
+  /// @return true if success.
+  bool exportQuery(EJCOLL* collection,
+                   bson* query,
+                   bson* hints,
+                   const char* filename,
+                   FileFormat format,
+                   ExportStats* stats);
+  /// Get a collection, creating it if it does not exist.
+  EJCOLL* createCollection(const char* collection_name);
+  /// Start applying saves, updates and removes in a writer thread.
+  /// The MEX file is locked until the database is closed.
+  /// @return true if success.
+  bool startWriteBehind();
+  /// Write-behind queue, or NULL when writes are applied immediately.
+  WriteQueue* writeQueue() { return write_queue_; }
+  /// Take the first write-behind error since the last call.
+  /// @param message error message.
+  /// @return true if there was an error.
+  bool takeWriteError(string* message);
+  /// Set the byte budget of the query result cache. Zero disables the
+  /// cache. The MEX file is locked while the cache is enabled.
+  void setQueryCacheBudget(size_t budget);
+  /// Query result cache, or NULL when disabled.
+  ResultCache* queryCache() { return query_cache_; }
+  /// Make a key of the query result cache.
+  /// @param collection collection to query.
+  /// @param query bson query object.
+  /// @param hints bson query hint object, or NULL.
+  /// @param flags query search mode.
+  /// @param options result conversion options.
+  /// @param key cache key.
+  void makeQueryCacheKey(const EJCOLL* collection,
+                         const bson* query,
+                         const bson* hints,
+                         int flags,
+                         const DecodeOptions& options,
+                         string* key) const;
+  /// Set the byte budget of the decoded document cache for loads by
+  /// object id. Zero disables the cache. The MEX file is locked while the
+  /// cache is enabled.
+  void setDocumentCacheBudget(size_t budget);
+  /// Decoded document cache, or NULL when disabled.
+  ResultCache* documentCache() { return document_cache_; }
+  /// Make a key of the document cache. Keys of a document share the prefix
+  /// made without options.
+  /// @param collection collection of the document.
+  /// @param object_id object id of the document.
+  /// @param options result conversion options, or NULL for the prefix.
+  /// @param key cache key.
+  void makeDocumentCacheKey(const EJCOLL* collection,
+                            const bson_oid_t* object_id,
+                            const DecodeOptions* options,
+                            string* key) const;
+  /// Check if writes are pending in the write-behind queue, in which case
+  /// results read now must not be cached.
+  bool hasPendingWrites();
+  /// Generation of the collection, increased by every write.
+  uint64_t getGeneration(const EJCOLL* collection) const;
+  /// Generation of the documents in the collection, increased by writes
+  /// not tied to an object id.
+  uint64_t getDocumentGeneration(const EJCOLL* collection) const;
+  /// Mark a collection as modified, invalidating cached query results.
+  void touch(const EJCOLL* collection);
+  /// Mark a document as modified, invalidating its cached copies and
+  /// cached query results of the collection.
+  void touchDocument(const EJCOLL* collection, const bson_oid_t* object_id);
+  /// Mark any document in a collection as modified.
+  void touchDocuments(const EJCOLL* collection);
+  /// Mark every collection as modified.
+  void touchAll();
+  /// Make the database route to shards instead of a file of its own.
+  /// @param shards shards to route to. The database takes the ownership.
+  void setShards(ShardSet* shards);
+  /// Shards, or NULL when the database is not sharded.
+  ShardSet* shards() const { return shards_; }
 
 private:
   /// Database pointer.
   EJDB* database_;
+  /// Write-behind queue, or NULL.
+  WriteQueue* write_queue_;
+  /// Query result cache, or NULL.
+  ResultCache* query_cache_;
+  /// Decoded document cache, or NULL.
+  ResultCache* document_cache_;
+  /// Shards, or NULL.
+  ShardSet* shards_;
+  /// Error of import() or exportQuery(), or empty for EJDB errors.
+  string error_;
+  /// Generation of each modified collection.
+  map<const EJCOLL*, uint64_t> generations_;
+  /// Document generation of each collection modified by query.
+  map<const EJCOLL*, uint64_t> document_generations_;
+  /// Generation shared by all collections.
+  uint64_t base_generation_;
+};
+
+/// Hash-partitioned databases that act as one database.
+/// Each shard is a database of its own in the session, so that it can be
+/// synced, optimized or copied independently. Documents are routed by the
+/// hash of the shard key, or of the object id when no key is given or the
+/// document lacks the key. Queries run on the shards in parallel threads,
+/// and the raw results are merged before conversion to mxArray.
+class ShardSet {
+public:
+  /// Create a set of open databases.
+  /// @param shard_ids session ids of the shards.
+  /// @param shards shards in the order of the ids. Must outlive the set.
+  /// @param shard_key dotted path to the shard key, or empty to route by
+  ///                  object id.
+  ShardSet(const vector<int>& shard_ids,
+           const vector<Database*>& shards,
+           const string& shard_key);
+  /// Number of shards.
+  int size() const { return shards_.size(); }
+  /// Session id of the shard at the index.
+  int getShardId(int index) const { return shard_ids_[index]; }
+  /// Shard at the index.
+  Database* getShard(int index) const { return shards_[index]; }
+  /// Error message of the last failure.
+  const char* errorMessage() const { return error_; }
+  /// Shard index of an object id.
+  int route(const bson_oid_t* object_id) const;
+  /// Shard index of a document.
+  /// @param document bson document to save.
+  /// @param object_id object id of the document.
+  /// @return shard index, or -1 if the shard key is an array or a
+  ///         document.
+  int route(const bson* document, const bson_oid_t* object_id) const;
+  /// Shard index of the documents a query can match.
+  /// @param query bson query object.
+  /// @return shard index, or -1 unless the query has a scalar equality on
+  ///         the shard key.
+  int route(const bson* query) const;
+  /// Save a BSON object to its shard. With a shard key, copies of an
+  /// existing object in other shards are removed, so that a changed key
+  /// moves the object.
+  /// @param collection_name name of the collection.
+  /// @param value bson value to be stored.
+  /// @param object_id object id of the value.
+  /// @param is_new whether the object id was just generated, in which case
+  ///               no other shard can have the object.
+  /// @return true if success.
+  bool save(const char* collection_name,
+            bson* value,
+            bson_oid_t* object_id,
+            bool is_new);
+  /// Load a BSON object. Every shard is searched when a shard key is set.
+  /// @param collection_name name of the collection.
+  /// @param object_id object id.
+  /// @param value bson value to be created. Must be freed with bson_del().
+  /// @return true if found.
+  bool load(const char* collection_name,
+            const bson_oid_t* object_id,
+            bson** value);
+  /// Remove a BSON object. Every shard is searched when a shard key is set.
+  /// @param collection_name name of the collection.
+  /// @param object_id object id to be removed.
+  /// @return true if success.
+  bool remove(const char* collection_name, const bson_oid_t* object_id);
+  /// Query the shards in parallel threads and merge the results.
+  /// Results of the shards are concatenated in the shard order, or merged
+  /// in the order of $orderby. $skip and $max apply to the merged results.
+  /// @param collection_name name of the collection.
+  /// @param query bson query object.
+  /// @param hints bson query hint object, or NULL.
+  /// @param results query results.
+  /// @param flags query search mode: JBQRYCOUNT or JBQRYFINDONE.
+  /// @param options result conversion options.
+  /// @return true if success.
+  bool find(const char* collection_name,
+            bson* query,
+            bson* hints,
+            mxArray** results,
+            int flags,
+            const DecodeOptions& options);
+  /// Aggregate the merged query results of the shards.
+  /// See Database::aggregate().
+  bool aggregate(const char* collection_name,
+                 bson* query,
+                 bson* hints,
+                 const vector<string>& group_fields,
+                 const vector<Aggregate>& aggregates,
+                 mxArray** results);
+
+private:
+  /// Session ids of the shards.
+  vector<int> shard_ids_;
+  /// Shards.
+  vector<Database*> shards_;
+  /// Dotted path to the shard key, or empty.
+  string shard_key_;
+  /// Static error message of the last failure.
+  const char* error_;
+};
+
+/// Query running in a worker thread.
+/// The worker does not call the Matlab API, and results are converted to
+/// mxArray in fetch() on the Matlab thread. The MEX file is locked while a
+/// future exists so that the worker never outlives the code.
+class QueryFuture {
+public:
+  /// Empty constructor.
+  QueryFuture();
+  /// Copies are empty. Needed to keep futures in a session.
+  QueryFuture(const QueryFuture& other);
+  /// Destructor. Waits for the worker thread and releases the results.
+  virtual ~QueryFuture();
+  /// Start a query in a worker thread.
+  /// @param database database to query. Must outlive the future.
+  /// @param collection collection in which to query.
+  /// @param query bson query object. The future takes the ownership.
+  /// @param hints bson query hint object, or NULL. The future takes the
+  ///              ownership.
+  /// @param options result conversion options.
+  /// @return true if the thread started.
+  bool start(Database* database,
+             EJCOLL* collection,
+             bson* query,
+             bson* hints,
+             const DecodeOptions& options);
+  /// Check if the query has finished.
+  bool isReady() const;
+  /// Wait for the query and convert the results.
+  /// @param results cell array or struct array of the results.
+  /// @param error static error message set when unsuccessful.
+  /// @return true if success.
+  bool fetch(mxArray** results, const char** error);
+  /// Mark the results as unwanted. A query not yet started is skipped.
+  /// EJDB cannot interrupt a running query, so the worker runs to
+  /// the end and the results are discarded.
+  void cancel();
+  /// Check if cancelled.
+  bool isCancelled() const;
+  /// Database of the query.
+  const Database* database() const;
+  /// Wait for the worker to finish. The results are kept for fetch().
+  void wait();
+
+private:
+  /// Shared state of the query.
+  struct State;
+  /// Disabled assignment.
+  QueryFuture& operator=(const QueryFuture&);
+  /// Thread entry point.
+  static void* run(void* state);
+  /// Run the query.
+  static void execute(void* state);
+
+  /// Query state, or NULL when empty.
+  State* state_;
 };
 
 } // namespace ejdbmex
@@ -81,6 +566,7 @@ namespace mex {
 
 // Template instanciations.
 extern template class Session<ejdbmex::Database>;
+extern template class Session<ejdbmex::QueryFuture>;
 
 } // namespace mex
 
@@ -0,0 +1,726 @@
+/** Native conversion between JSON and BSON implementation.
+ */
+
+#include "jsonbson.h"
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/** Maximum nesting level of JSON values.
+ */
+#define MAX_JSON_DEPTH 128
+
+/** Parser state.
+ */
+typedef struct {
+  const char* begin;
+  const char* cur;
+  const char* end;
+  const char* error;
+  int depth;
+  JSONBuffer key;
+  JSONBuffer text;
+} JSONParser;
+
+static bool ParseValue(JSONParser* parser, const char* key, bson* output);
+
+/** Reserve the capacity of the buffer.
+ */
+static bool ReserveBuffer(JSONBuffer* buffer, size_t capacity) {
+  if (capacity <= buffer->capacity)
+    return true;
+  size_t new_capacity = (buffer->capacity) ? buffer->capacity : 64;
+  while (new_capacity < capacity)
+    new_capacity *= 2;
+  char* data = (char*)realloc(buffer->data, new_capacity);
+  if (!data)
+    return false;
+  buffer->data = data;
+  buffer->capacity = new_capacity;
+  return true;
+}
+
+/** Check if the character ends a run of plain string characters.
+ */
+static bool IsSpecialCharacter(unsigned char c) {
+  return c == '"' || c == '\\' || c < 0x20;
+}
+
+/** Find the first quote, backslash or control character. Most of the text
+ * in JSON is inside strings, so this scan dominates both parsing and
+ * serialization. With SSE2, 16 bytes of a string are classified at a time.
+ * Structural characters outside strings are still parsed one at a time.
+ * @return pointer to the found character, or end.
+ */
+static const char* FindSpecialCharacter(const char* cur, const char* end) {
+#ifdef __SSE2__
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(0x1F);
+  while (end - cur >= 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)cur);
+    __m128i special = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                     _mm_cmpeq_epi8(chunk, backslash)),
+        _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control));
+    int mask = _mm_movemask_epi8(special);
+    if (mask)
+      return cur + __builtin_ctz(mask);
+    cur += 16;
+  }
+#endif
+  while (cur < end && !IsSpecialCharacter((unsigned char)*cur))
+    ++cur;
+  return cur;
+}
+
+/** Set an error message and return false.
+ */
+static bool SetError(JSONParser* parser, const char* message) {
+  if (!parser->error)
+    parser->error = message;
+  return false;
+}
+
+/** Skip whitespace characters.
+ */
+static void SkipSpace(JSONParser* parser) {
+  while (parser->cur < parser->end &&
+         (*parser->cur == ' ' || *parser->cur == '\t' ||
+          *parser->cur == '\n' || *parser->cur == '\r'))
+    ++parser->cur;
+}
+
+/** Consume the given character after whitespace.
+ */
+static bool Consume(JSONParser* parser, char c) {
+  SkipSpace(parser);
+  if (parser->cur >= parser->end || *parser->cur != c)
+    return false;
+  ++parser->cur;
+  return true;
+}
+
+/** Consume the given literal.
+ */
+static bool ConsumeLiteral(JSONParser* parser, const char* literal) {
+  size_t length = strlen(literal);
+  if ((size_t)(parser->end - parser->cur) < length ||
+      memcmp(parser->cur, literal, length) != 0)
+    return SetError(parser, "Invalid literal.");
+  parser->cur += length;
+  return true;
+}
+
+/** Parse 4 hex digits of a \u escape.
+ */
+static bool ParseHex4(JSONParser* parser, uint32_t* value) {
+  if (parser->end - parser->cur < 4)
+    return SetError(parser, "Invalid unicode escape.");
+  *value = 0;
+  for (int i = 0; i < 4; ++i) {
+    char c = *parser->cur++;
+    *value <<= 4;
+    if (c >= '0' && c <= '9')
+      *value |= c - '0';
+    else if (c >= 'a' && c <= 'f')
+      *value |= c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      *value |= c - 'A' + 10;
+    else
+      return SetError(parser, "Invalid unicode escape.");
+  }
+  return true;
+}
+
+/** Append a code point to the buffer in UTF-8.
+ */
+static bool AppendUTF8(JSONBuffer* buffer, uint32_t code) {
+  if (!ReserveBuffer(buffer, buffer->size + 4))
+    return false;
+  char* out = buffer->data + buffer->size;
+  if (code < 0x80) {
+    out[0] = (char)code;
+    buffer->size += 1;
+  }
+  else if (code < 0x800) {
+    out[0] = (char)(0xC0 | (code >> 6));
+    out[1] = (char)(0x80 | (code & 0x3F));
+    buffer->size += 2;
+  }
+  else if (code < 0x10000) {
+    out[0] = (char)(0xE0 | (code >> 12));
+    out[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+    out[2] = (char)(0x80 | (code & 0x3F));
+    buffer->size += 3;
+  }
+  else {
+    out[0] = (char)(0xF0 | (code >> 18));
+    out[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (code & 0x3F));
+    buffer->size += 4;
+  }
+  return true;
+}
+
+/** Parse a string into the null-terminated buffer.
+ */
+static bool ParseString(JSONParser* parser, JSONBuffer* buffer) {
+  buffer->size = 0;
+  if (!Consume(parser, '"'))
+    return SetError(parser, "String expected.");
+  while (true) {
+    const char* run = parser->cur;
+    parser->cur = FindSpecialCharacter(parser->cur, parser->end);
+    size_t run_length = parser->cur - run;
+    if (!ReserveBuffer(buffer, buffer->size + run_length + 1))
+      return SetError(parser, "Out of memory.");
+    memcpy(buffer->data + buffer->size, run, run_length);
+    buffer->size += run_length;
+    if (parser->cur >= parser->end)
+      return SetError(parser, "Unterminated string.");
+    char c = *parser->cur++;
+    if (c == '"')
+      break;
+    if (c != '\\')
+      return SetError(parser, "Control character in string.");
+    if (parser->cur >= parser->end)
+      return SetError(parser, "Unterminated string.");
+    c = *parser->cur++;
+    uint32_t code = 0;
+    switch (c) {
+      case '"': case '\\': case '/': code = c; break;
+      case 'b': code = '\b'; break;
+      case 'f': code = '\f'; break;
+      case 'n': code = '\n'; break;
+      case 'r': code = '\r'; break;
+      case 't': code = '\t'; break;
+      case 'u': {
+        if (!ParseHex4(parser, &code))
+          return false;
+        if (code >= 0xD800 && code < 0xDC00) {
+          uint32_t low;
+          if (parser->end - parser->cur < 2 || parser->cur[0] != '\\' ||
+              parser->cur[1] != 'u')
+            return SetError(parser, "Invalid surrogate pair.");
+          parser->cur += 2;
+          if (!ParseHex4(parser, &low))
+            return false;
+          if (low < 0xDC00 || low >= 0xE000)
+            return SetError(parser, "Invalid surrogate pair.");
+          code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        }
+        break;
+      }
+      default:
+        return SetError(parser, "Invalid escape sequence.");
+    }
+    if (!AppendUTF8(buffer, code))
+      return SetError(parser, "Out of memory.");
+  }
+  if (!ReserveBuffer(buffer, buffer->size + 1))
+    return SetError(parser, "Out of memory.");
+  buffer->data[buffer->size] = '\0';
+  return true;
+}
+
+/** Parse a key. Keys cannot contain null characters in BSON.
+ */
+static bool ParseKey(JSONParser* parser, JSONBuffer* buffer) {
+  if (!ParseString(parser, buffer))
+    return false;
+  if (strlen(buffer->data) != buffer->size)
+    return SetError(parser, "Null character in key.");
+  if (!Consume(parser, ':'))
+    return SetError(parser, "Colon expected.");
+  return true;
+}
+
+/** Parse a number.
+ */
+static bool ParseNumber(JSONParser* parser, double* value) {
+  const char* start = parser->cur;
+  const char* cur = parser->cur;
+  if (cur < parser->end && *cur == '-')
+    ++cur;
+  if (cur >= parser->end || *cur < '0' || *cur > '9')
+    return SetError(parser, "Invalid number.");
+  if (*cur == '0')
+    ++cur;
+  else
+    while (cur < parser->end && *cur >= '0' && *cur <= '9')
+      ++cur;
+  if (cur < parser->end && *cur == '.') {
+    ++cur;
+    if (cur >= parser->end || *cur < '0' || *cur > '9')
+      return SetError(parser, "Invalid number.");
+    while (cur < parser->end && *cur >= '0' && *cur <= '9')
+      ++cur;
+  }
+  if (cur < parser->end && (*cur == 'e' || *cur == 'E')) {
+    ++cur;
+    if (cur < parser->end && (*cur == '+' || *cur == '-'))
+      ++cur;
+    if (cur >= parser->end || *cur < '0' || *cur > '9')
+      return SetError(parser, "Invalid number.");
+    while (cur < parser->end && *cur >= '0' && *cur <= '9')
+      ++cur;
+  }
+  // strtod() requires a null-terminated string.
+  size_t length = cur - start;
+  JSONBuffer* buffer = &parser->text;
+  if (!ReserveBuffer(buffer, length + 1))
+    return SetError(parser, "Out of memory.");
+  memcpy(buffer->data, start, length);
+  buffer->data[length] = '\0';
+  *value = strtod(buffer->data, NULL);
+  parser->cur = cur;
+  return true;
+}
+
+/** Parse an integer given as a string, e.g., {"$numberLong": "123"}.
+ */
+static bool ParseIntegerString(JSONParser* parser, int64_t* value) {
+  if (!ParseString(parser, &parser->text))
+    return false;
+  char* end = NULL;
+  errno = 0;
+  *value = strtoll(parser->text.data, &end, 10);
+  if (parser->text.size == 0 || *end != '\0')
+    return SetError(parser, "Invalid integer string.");
+  if (errno == ERANGE)
+    return SetError(parser, "Integer string out of range.");
+  return true;
+}
+
+/** Try to parse an extended JSON value. The parser is rewound when the
+ * object is not an extended JSON value.
+ */
+static bool ParseExtendedValue(JSONParser* parser,
+                               const char* key,
+                               bson* output,
+                               bool* matched) {
+  const char* start = parser->cur;
+  *matched = false;
+  SkipSpace(parser);
+  if (parser->end - parser->cur < 2 || parser->cur[1] != '$')
+    return true;
+  if (!ParseKey(parser, &parser->text)) {
+    parser->error = NULL;
+    parser->cur = start;
+    return true;
+  }
+  int status = BSON_OK;
+  SkipSpace(parser);
+  if (strcmp(parser->text.data, "$oid") == 0) {
+    if (!ParseString(parser, &parser->text) || parser->text.size != 24)
+      return SetError(parser, "Invalid $oid.");
+    bson_oid_t oid;
+    bson_oid_from_string(&oid, parser->text.data);
+    status = bson_append_oid(output, key, &oid);
+  }
+  else if (strcmp(parser->text.data, "$date") == 0) {
+    int64_t value;
+    if (parser->cur < parser->end && *parser->cur == '{') {
+      ++parser->cur;
+      if (!ParseKey(parser, &parser->text) ||
+          strcmp(parser->text.data, "$numberLong") != 0)
+        return SetError(parser, "Invalid $date.");
+      SkipSpace(parser);
+      if (!ParseIntegerString(parser, &value))
+        return false;
+      if (!Consume(parser, '}'))
+        return SetError(parser, "Invalid $date.");
+    }
+    else {
+      double number;
+      if (!ParseNumber(parser, &number))
+        return false;
+      value = (int64_t)number;
+    }
+    status = bson_append_date(output, key, (bson_date_t)value);
+  }
+  else if (strcmp(parser->text.data, "$numberLong") == 0) {
+    int64_t value;
+    if (!ParseIntegerString(parser, &value))
+      return false;
+    status = bson_append_long(output, key, value);
+  }
+  else if (strcmp(parser->text.data, "$numberInt") == 0) {
+    int64_t value;
+    if (!ParseIntegerString(parser, &value))
+      return false;
+    if (value < INT32_MIN || value > INT32_MAX)
+      return SetError(parser, "$numberInt out of range.");
+    status = bson_append_int(output, key, (int)value);
+  }
+  else {
+    parser->cur = start;
+    return true;
+  }
+  if (status != BSON_OK)
+    return SetError(parser, "Failed to append a value.");
+  if (!Consume(parser, '}'))
+    return SetError(parser, "Closing brace expected.");
+  *matched = true;
+  return true;
+}
+
+/** Parse members of an object after the opening brace.
+ */
+static bool ParseMembers(JSONParser* parser, bson* output) {
+  if (Consume(parser, '}'))
+    return true;
+  do {
+    if (!ParseKey(parser, &parser->key))
+      return false;
+    if (!ParseValue(parser, parser->key.data, output))
+      return false;
+  } while (Consume(parser, ','));
+  if (!Consume(parser, '}'))
+    return SetError(parser, "Closing brace expected.");
+  return true;
+}
+
+/** Parse elements of an array after the opening bracket.
+ */
+static bool ParseElements(JSONParser* parser, bson* output) {
+  if (Consume(parser, ']'))
+    return true;
+  int index = 0;
+  char key[16];
+  do {
+    sprintf(key, "%d", index++);
+    if (!ParseValue(parser, key, output))
+      return false;
+  } while (Consume(parser, ','));
+  if (!Consume(parser, ']'))
+    return SetError(parser, "Closing bracket expected.");
+  return true;
+}
+
+/** Parse a value and append it to the output under the key.
+ */
+static bool ParseValue(JSONParser* parser, const char* key, bson* output) {
+  SkipSpace(parser);
+  if (parser->cur >= parser->end)
+    return SetError(parser, "Unexpected end of input.");
+  int status = BSON_OK;
+  switch (*parser->cur) {
+    case '{': {
+      if (++parser->depth > MAX_JSON_DEPTH)
+        return SetError(parser, "Too deeply nested.");
+      ++parser->cur;
+      bool matched = false;
+      if (!ParseExtendedValue(parser, key, output, &matched))
+        return false;
+      if (!matched) {
+        if (bson_append_start_object(output, key) != BSON_OK ||
+            !ParseMembers(parser, output) ||
+            bson_append_finish_object(output) != BSON_OK)
+          return SetError(parser, "Failed to append an object.");
+      }
+      --parser->depth;
+      return true;
+    }
+    case '[': {
+      if (++parser->depth > MAX_JSON_DEPTH)
+        return SetError(parser, "Too deeply nested.");
+      ++parser->cur;
+      if (bson_append_start_array(output, key) != BSON_OK ||
+          !ParseElements(parser, output) ||
+          bson_append_finish_array(output) != BSON_OK)
+        return SetError(parser, "Failed to append an array.");
+      --parser->depth;
+      return true;
+    }
+    case '"':
+      if (!ParseString(parser, &parser->text))
+        return false;
+      status = bson_append_string_n(output,
+                                    key,
+                                    parser->text.data,
+                                    parser->text.size);
+      break;
+    case 't':
+      if (!ConsumeLiteral(parser, "true"))
+        return false;
+      status = bson_append_bool(output, key, 1);
+      break;
+    case 'f':
+      if (!ConsumeLiteral(parser, "false"))
+        return false;
+      status = bson_append_bool(output, key, 0);
+      break;
+    case 'n':
+      if (!ConsumeLiteral(parser, "null"))
+        return false;
+      status = bson_append_null(output, key);
+      break;
+    default: {
+      double value;
+      if (!ParseNumber(parser, &value))
+        return false;
+      status = bson_append_double(output, key, value);
+      break;
+    }
+  }
+  if (status != BSON_OK)
+    return SetError(parser, "Failed to append a value.");
+  return true;
+}
+
+bool ConvertJSONToBSON(const char* json,
+                       size_t length,
+                       int flags,
+                       bson* output,
+                       const char** error,
+                       size_t* error_offset) {
+  JSONParser parser;
+  memset(&parser, 0, sizeof(parser));
+  parser.begin = json;
+  parser.cur = json;
+  parser.end = json + length;
+  if (flags & BSON_FLAG_QUERY_MODE)
+    bson_init_as_query(output);
+  else
+    bson_init(output);
+  bool success = true;
+  if (Consume(&parser, '{'))
+    success = ParseMembers(&parser, output);
+  else if (Consume(&parser, '['))
+    success = ParseElements(&parser, output);
+  else
+    success = SetError(&parser, "JSON object or array expected.");
+  SkipSpace(&parser);
+  if (success && parser.cur != parser.end)
+    success = SetError(&parser, "Trailing characters after the object.");
+  if (success && bson_finish(output) != BSON_OK)
+    success = SetError(&parser, "Failed to finish BSON.");
+  if (!success) {
+    bson_destroy(output);
+    if (error)
+      *error = parser.error;
+    if (error_offset)
+      *error_offset = parser.cur - parser.begin;
+  }
+  free(parser.key.data);
+  free(parser.text.data);
+  return success;
+}
+
+void FreeJSONBuffer(JSONBuffer* buffer) {
+  free(buffer->data);
+  buffer->data = NULL;
+  buffer->size = 0;
+  buffer->capacity = 0;
+}
+
+/** Append bytes to the buffer.
+ */
+static bool AppendBytes(JSONBuffer* buffer, const char* data, size_t length) {
+  if (!ReserveBuffer(buffer, buffer->size + length))
+    return false;
+  memcpy(buffer->data + buffer->size, data, length);
+  buffer->size += length;
+  return true;
+}
+
+/** Append a null-terminated text to the buffer.
+ */
+static bool AppendText(JSONBuffer* buffer, const char* text) {
+  return AppendBytes(buffer, text, strlen(text));
+}
+
+/** Append a quoted and escaped string to the buffer.
+ */
+static bool AppendQuoted(JSONBuffer* buffer, const char* text, size_t length) {
+  static const char kHex[] = "0123456789abcdef";
+  const char* end = text + length;
+  if (!AppendBytes(buffer, "\"", 1))
+    return false;
+  while (true) {
+    const char* run = text;
+    text = FindSpecialCharacter(text, end);
+    if (!AppendBytes(buffer, run, text - run))
+      return false;
+    if (text == end)
+      break;
+    unsigned char c = (unsigned char)*text++;
+    char escape[6] = {'\\', c, 0, 0, 0, 0};
+    size_t escape_length = 2;
+    switch (c) {
+      case '"': case '\\': break;
+      case '\b': escape[1] = 'b'; break;
+      case '\f': escape[1] = 'f'; break;
+      case '\n': escape[1] = 'n'; break;
+      case '\r': escape[1] = 'r'; break;
+      case '\t': escape[1] = 't'; break;
+      default:
+        escape[1] = 'u';
+        escape[2] = '0';
+        escape[3] = '0';
+        escape[4] = kHex[c >> 4];
+        escape[5] = kHex[c & 0xF];
+        escape_length = 6;
+        break;
+    }
+    if (!AppendBytes(buffer, escape, escape_length))
+      return false;
+  }
+  return AppendBytes(buffer, "\"", 1);
+}
+
+/** Append binary data encoded in base64.
+ */
+static bool AppendBase64(JSONBuffer* buffer, const char* data, int length) {
+  static const char kTable[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  if (!ReserveBuffer(buffer, buffer->size + 4 * ((length + 2) / 3)))
+    return false;
+  char* out = buffer->data + buffer->size;
+  const unsigned char* in = (const unsigned char*)data;
+  int i = 0;
+  for (; i + 2 < length; i += 3) {
+    *out++ = kTable[in[i] >> 2];
+    *out++ = kTable[((in[i] & 0x3) << 4) | (in[i + 1] >> 4)];
+    *out++ = kTable[((in[i + 1] & 0xF) << 2) | (in[i + 2] >> 6)];
+    *out++ = kTable[in[i + 2] & 0x3F];
+  }
+  if (i < length) {
+    *out++ = kTable[in[i] >> 2];
+    if (i + 1 < length) {
+      *out++ = kTable[((in[i] & 0x3) << 4) | (in[i + 1] >> 4)];
+      *out++ = kTable[(in[i + 1] & 0xF) << 2];
+    }
+    else {
+      *out++ = kTable[(in[i] & 0x3) << 4];
+      *out++ = '=';
+    }
+    *out++ = '=';
+  }
+  buffer->size = out - buffer->data;
+  return true;
+}
+
+static bool AppendBSONObject(bson_iterator* it,
+                             bool is_array,
+                             int depth,
+                             JSONBuffer* output);
+
+/** Append the value of the current element.
+ */
+static bool AppendBSONValue(bson_iterator* it, int depth, JSONBuffer* output) {
+  char text[64];
+  switch (bson_iterator_type(it)) {
+    case BSON_DOUBLE: {
+      double value = bson_iterator_double(it);
+      if (!isfinite(value))
+        return AppendText(output, "null");
+      sprintf(text, "%.17g", value);
+      return AppendText(output, text);
+    }
+    case BSON_STRING:
+    case BSON_SYMBOL:
+    case BSON_CODE:
+      return AppendQuoted(output,
+                          bson_iterator_string(it),
+                          bson_iterator_string_len(it) - 1);
+    case BSON_OBJECT:
+    case BSON_ARRAY: {
+      bson_iterator sub;
+      bson_iterator_subiterator(it, &sub);
+      return AppendBSONObject(&sub,
+                              bson_iterator_type(it) == BSON_ARRAY,
+                              depth + 1,
+                              output);
+    }
+    case BSON_BINDATA:
+      sprintf(text, "\",\"subType\":\"%02x\"}}",
+              (unsigned char)bson_iterator_bin_type(it));
+      return AppendText(output, "{\"$binary\":{\"base64\":\"") &&
+             AppendBase64(output,
+                          bson_iterator_bin_data(it),
+                          bson_iterator_bin_len(it)) &&
+             AppendText(output, text);
+    case BSON_UNDEFINED:
+    case BSON_NULL:
+      return AppendText(output, "null");
+    case BSON_OID:
+      strcpy(text, "{\"$oid\":\"");
+      bson_oid_to_string(bson_iterator_oid(it), text + strlen(text));
+      strcat(text, "\"}");
+      return AppendText(output, text);
+    case BSON_BOOL:
+      return AppendText(output, (bson_iterator_bool(it)) ? "true" : "false");
+    case BSON_DATE:
+      sprintf(text, "{\"$date\":%lld}",
+              (long long)bson_iterator_date(it));
+      return AppendText(output, text);
+    case BSON_REGEX: {
+      const char* pattern = bson_iterator_regex(it);
+      const char* options = bson_iterator_regex_opts(it);
+      return AppendText(output, "{\"$regex\":") &&
+             AppendQuoted(output, pattern, strlen(pattern)) &&
+             AppendText(output, ",\"$options\":") &&
+             AppendQuoted(output, options, strlen(options)) &&
+             AppendText(output, "}");
+    }
+    case BSON_INT:
+      sprintf(text, "{\"$numberInt\":\"%d\"}", bson_iterator_int(it));
+      return AppendText(output, text);
+    case BSON_TIMESTAMP: {
+      bson_timestamp_t value = bson_iterator_timestamp(it);
+      sprintf(text, "{\"$timestamp\":{\"t\":%d,\"i\":%d}}",
+              value.t, value.i);
+      return AppendText(output, text);
+    }
+    case BSON_LONG:
+      sprintf(text, "{\"$numberLong\":\"%lld\"}",
+              (long long)bson_iterator_long(it));
+      return AppendText(output, text);
+    default:
+      return false;
+  }
+}
+
+/** Append elements of an object or an array.
+ */
+static bool AppendBSONObject(bson_iterator* it,
+                             bool is_array,
+                             int depth,
+                             JSONBuffer* output) {
+  if (depth > MAX_JSON_DEPTH)
+    return false;
+  if (!AppendText(output, (is_array) ? "[" : "{"))
+    return false;
+  bool first = true;
+  while (bson_iterator_next(it)) {
+    if (!first && !AppendText(output, ","))
+      return false;
+    first = false;
+    if (!is_array) {
+      const char* key = bson_iterator_key(it);
+      if (!AppendQuoted(output, key, strlen(key)) ||
+          !AppendText(output, ":"))
+        return false;
+    }
+    if (!AppendBSONValue(it, depth, output))
+      return false;
+  }
+  return AppendText(output, (is_array) ? "]" : "}");
+}
+
+bool ConvertBSONToJSON(const char* data, bool is_array, JSONBuffer* output) {
+  bson_iterator it;
+  bson_iterator_from_buffer(&it, data);
+  return AppendBSONObject(&it, is_array, 0, output);
+}
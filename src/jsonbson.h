@@ -0,0 +1,69 @@
+/** Native conversion between JSON and BSON.
+ *
+ * The conversion works directly between JSON text and BSON without the
+ * mxArray layer, and is safe to call outside of the Matlab thread. Numbers
+ * become doubles as in Matlab. Extended JSON values {"$oid": "..."},
+ * {"$date": ...}, {"$numberInt": "..."} and {"$numberLong": "..."} map to
+ * the corresponding BSON types in both directions.
+ */
+
+#ifndef __JSONBSON_H__
+#define __JSONBSON_H__
+
+#include <bson.h>
+#include <stddef.h>
+#ifndef __cplusplus
+#include <stdbool.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Growable text buffer.
+ */
+typedef struct {
+  char* data;
+  size_t size;
+  size_t capacity;
+} JSONBuffer;
+
+/** Free the text of the buffer.
+ * @param buffer buffer to free. The buffer is empty afterwards.
+ */
+void FreeJSONBuffer(JSONBuffer* buffer);
+
+/** Convert a JSON object to BSON. A JSON array is converted to a document
+ * keyed by the element index, as ConvertMxArrayToBSON() does for a cell.
+ * @param json JSON text. Need not be null-terminated.
+ * @param length length of the text in bytes.
+ * @param flags BSON_FLAG_QUERY_MODE to construct BSON as a query.
+ * @param output bson object to be created. Must be freed with
+ *               bson_destroy() when successful.
+ * @param error static error message set when unsuccessful. Can be NULL.
+ * @param error_offset byte offset of the error in the text. Can be NULL.
+ * @return true if success.
+ */
+bool ConvertJSONToBSON(const char* json,
+                       size_t length,
+                       int flags,
+                       bson* output,
+                       const char** error,
+                       size_t* error_offset);
+
+/** Convert a BSON document to JSON text.
+ * Doubles that are not finite become null. Binary data, regular
+ * expressions and timestamps use the extended JSON notation.
+ * @param data BSON document.
+ * @param is_array write the elements as a JSON array.
+ * @param output buffer to append the text to. The text is not
+ *               null-terminated.
+ * @return true if success.
+ */
+bool ConvertBSONToJSON(const char* data, bool is_array, JSONBuffer* output);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __JSONBSON_H__ */
@@ -3,14 +3,25 @@
 /// Kota Yamaguchi 2013
 
 #include "bsonmex.h"
+#include "bsonstream.h"
+#include "bsonutil.h"
+#include "jsonbson.h"
 #include <mex.h>
 #include "mex/arguments.h"
 #include "mex/function.h"
+#include "mex/session.h"
+#include "parallel.h"
+#include <algorithm>
 #include <stdlib.h>
 #include <string.h>
+#include <string>
+#include <vector>
 
+using bsonmex::BSONStream;
 using mex::CheckInputArguments;
 using mex::CheckOutputArguments;
+using mex::MxArray;
+using mex::Session;
 using mex::VariableInputArguments;
 
 namespace {
@@ -32,25 +43,462 @@ void EncodeBSON(const mxArray* input, int flags, mxArray** output) {
   bson_destroy(&value);
 }
 
+/** Get the BSON data of the encoded mxArray without copying.
+ * @param input mxArray of BSON-encoded bytes.
+ * @param path dotted path to check, or NULL to check the whole document.
+ * @return pointer to the BSON data, checked to lie within the mxArray.
+ */
+const char* GetBSONData(const mxArray* input, const char* path = NULL) {
+  if (!mxIsUint8(input) && !mxIsInt8(input))
+    mexErrMsgIdAndTxt("bsonmex:error", "BSON input must be uint8.");
+  const char* data = (const char*)mxGetData(input);
+  size_t length = mxGetNumberOfElements(input);
+  if (!((path) ? CheckBSONPath(data, length, path) :
+                 CheckBSONBuffer(data, length)))
+    mexErrMsgIdAndTxt("bsonmex:error", "Invalid BSON input.");
+  return data;
+}
+
+/** Parse an object id format name into decoder flags.
+ * @param input mxArray of the format name: 'string', 'binary' or 'uint32'.
+ * @return decoder flags.
+ */
+int ParseOIDFormat(const MxArray& input) {
+  std::string format = input.toString();
+  int flags = GetOIDDecodeFlags(format.c_str());
+  if (flags < 0)
+    mexErrMsgIdAndTxt("bsonmex:error",
+                      "Unknown OID format: %s",
+                      format.c_str());
+  return flags;
+}
+
 /** Decode BSON-encoded mxArray.
  * @param input mxArray to decode.
+ * @param flags decoder options, e.g., BSONMEX_DECODE_OID_BINARY.
  * @param output mxArray to be created.
  * @return true if success.
  */
-void DecodeBSON(const mxArray* input, mxArray** output) {
-  bson value;
-  int size = mxGetNumberOfElements(input);
-  char* data = (char*)bson_malloc(size * sizeof(char));
-  memcpy(data, mxGetData(input), size * sizeof(char));
-  if (bson_init_finished_data(&value, data) != BSON_OK) {
-    bson_free(data);
-    mexErrMsgIdAndTxt("bsonmex:error", bson_first_errormsg(&value));
+void DecodeBSON(const mxArray* input, int flags, mxArray** output) {
+  bson_iterator it;
+  bson_iterator_from_buffer(&it, GetBSONData(input));
+  *output = ConvertBSONIteratorToMxArray(&it, flags);
+  if (!*output)
+    mexErrMsgIdAndTxt("bsonmex:error", "Failed to decode BSON.");
+}
+
+/** Get a field of BSON-encoded mxArray without decoding the rest.
+ * @param input mxArray to look up.
+ * @param path dotted path to the field.
+ * @param output mxArray to be created.
+ */
+void GetBSONField(const mxArray* input, const char* path, mxArray** output) {
+  bson_iterator it;
+  // Only the walked path is checked, so untouched fields cost nothing.
+  bson_iterator_from_buffer(&it, GetBSONData(input, path));
+  if (FindBSONPath(&it, path) == BSON_EOO)
+    mexErrMsgIdAndTxt("bsonmex:error", "Field not found: %s", path);
+  *output = ConvertBSONValueToMxArray(&it, 0);
+  if (!*output)
+    mexErrMsgIdAndTxt("bsonmex:error", "Failed to convert field: %s", path);
+}
+
+/** Set a field of BSON-encoded mxArray without decoding the rest.
+ * @param input mxArray to modify.
+ * @param path dotted path to the field.
+ * @param value mxArray of the new value, or NULL to remove the field.
+ * @param output mxArray of the modified BSON to be created.
+ */
+void SetBSONField(const mxArray* input,
+                  const char* path,
+                  const mxArray* value,
+                  mxArray** output) {
+  const char* data = GetBSONData(input);
+  char* modified = NULL;
+  size_t size = 0;
+  bool success = true;
+  if (value) {
+    bson element;
+    if (!ConvertMxArrayToBSONElement(value, "v", &element))
+      mexErrMsgIdAndTxt("bsonmex:error",
+                        "Failed to encode value: %s",
+                        bson_first_errormsg(&element));
+    // The element is {type, "v\0", value} after the length prefix.
+    const char* element_data = bson_data(&element) + 4;
+    success = SetBSONPath(data,
+                          path,
+                          (bson_type)(unsigned char)element_data[0],
+                          element_data + 3,
+                          bson_size(&element) - 4 - 3 - 1,
+                          &modified,
+                          &size);
+    bson_destroy(&element);
   }
-  if (!ConvertBSONToMxArray(&value, output))
-    mexErrMsgIdAndTxt("bsonmex:error", bson_first_errormsg(&value));
+  else
+    success = UnsetBSONPath(data, path, &modified, &size);
+  if (!success)
+    mexErrMsgIdAndTxt("bsonmex:error", "Invalid path: %s", path);
+  *output = mxCreateNumericMatrix(1, size, mxUINT8_CLASS, mxREAL);
+  memcpy(mxGetData(*output), modified, size);
+  free(modified);
+}
+
+/** Encode an element of a cell or struct array as a BSON document.
+ * @param input cell or struct array to encode.
+ * @param index index of the element.
+ * @param flags options to change the behavior. See EncodeBSON().
+ * @param value bson object to be created. Must be freed with bson_destroy().
+ */
+void EncodeDocument(const mxArray* input, int index, int flags, bson* value) {
+  bool success = (mxIsCell(input)) ?
+      ConvertMxArrayToBSON(mxGetCell(input, index), flags, value) :
+      ConvertStructElementToBSON(input, index, flags, value);
+  if (!success)
+    mexErrMsgIdAndTxt("bsonmex:error",
+                      "Failed to encode document %d: %s",
+                      index + 1,
+                      bson_first_errormsg(value));
+}
+
+/** Encode each element of a cell or struct array into one BSON stream.
+ * @param input cell or struct array to encode.
+ * @param flags options to change the behavior. See EncodeBSON().
+ * @param output mxArray of concatenated BSON documents to be created.
+ * @param offsets mxArray of zero-based byte offsets to be created.
+ */
+void EncodeBSONStream(const mxArray* input,
+                      int flags,
+                      mxArray** output,
+                      mxArray** offsets) {
+  if (!mxIsCell(input) && !mxIsStruct(input))
+    mexErrMsgIdAndTxt("bsonmex:error", "Input must be a cell or struct array.");
+  int num_documents = mxGetNumberOfElements(input);
+  std::string buffer;
+  *offsets = mxCreateDoubleMatrix(1, num_documents, mxREAL);
+  double* offset_data = mxGetPr(*offsets);
+  for (int i = 0; i < num_documents; ++i) {
+    bson value;
+    EncodeDocument(input, i, flags, &value);
+    offset_data[i] = buffer.size();
+    buffer.append(bson_data(&value), bson_size(&value));
+    bson_destroy(&value);
+  }
+  *output = mxCreateNumericMatrix(1, buffer.size(), mxUINT8_CLASS, mxREAL);
+  memcpy(mxGetData(*output), buffer.data(), buffer.size());
+}
+
+/** Convert BSON documents to mxArray.
+ * @param documents BSON documents to convert.
+ * @param columnar return a columnar struct instead of an array of values.
+ * @param flags decoder options, e.g., BSONMEX_DECODE_OID_BINARY.
+ * @param output mxArray to be created.
+ */
+void ConvertDocuments(const std::vector<const char*>& documents,
+                      bool columnar,
+                      int flags,
+                      mxArray** output) {
+  if (columnar) {
+    *output = ConvertBSONDocumentsToColumns(
+        (documents.empty()) ? NULL : &documents[0], documents.size(), flags);
+    if (!*output)
+      mexErrMsgIdAndTxt("bsonmex:error", "Failed to decode BSON.");
+    return;
+  }
+  *output = mxCreateCellMatrix(1, documents.size());
+  for (int i = 0; i < documents.size(); ++i) {
+    bson_iterator it;
+    bson_iterator_from_buffer(&it, documents[i]);
+    mxArray* value = ConvertBSONIteratorToMxArray(&it, flags);
+    if (!value)
+      mexErrMsgIdAndTxt("bsonmex:error",
+                        "Failed to decode document %d.",
+                        i + 1);
+    mxSetCell(*output, i, value);
+  }
+  TryMergeCellToNDArray(output);
+}
+
+/** Get pointers to the documents in concatenated BSON without copying.
+ * @param input mxArray of concatenated BSON documents.
+ * @param documents pointers to the documents, each checked to be valid.
+ * @param lengths lengths of the documents, or NULL. When given, only the
+ *                length prefixes are checked, and the caller checks the
+ *                documents with CheckBSONBuffer().
+ */
+void SplitBSONStream(const mxArray* input,
+                     std::vector<const char*>* documents,
+                     std::vector<size_t>* lengths = NULL) {
+  if (!mxIsUint8(input) && !mxIsInt8(input))
+    mexErrMsgIdAndTxt("bsonmex:error", "BSON input must be uint8.");
+  const char* data = (const char*)mxGetData(input);
+  size_t length = mxGetNumberOfElements(input);
+  size_t offset = 0;
+  while (offset < length) {
+    int32_t size = 0;
+    if (length - offset >= 5)
+      bson_little_endian32(&size, data + offset);
+    bool valid = (lengths) ?
+        size >= 5 && (size_t)size <= length - offset :
+        CheckBSONBuffer(data + offset, length - offset);
+    if (!valid)
+      mexErrMsgIdAndTxt("bsonmex:error",
+                        "Invalid BSON document at byte %d.",
+                        (int)offset);
+    documents->push_back(data + offset);
+    if (lengths)
+      lengths->push_back(size);
+    offset += size;
+  }
+}
+
+/** Decode concatenated BSON documents.
+ * @param input mxArray of concatenated BSON documents.
+ * @param columnar return a columnar struct instead of an array of values.
+ * @param flags decoder options, e.g., BSONMEX_DECODE_OID_BINARY.
+ * @param output mxArray to be created.
+ */
+void DecodeBSONStream(const mxArray* input,
+                      bool columnar,
+                      int flags,
+                      mxArray** output) {
+  std::vector<const char*> documents;
+  SplitBSONStream(input, &documents);
+  ConvertDocuments(documents, columnar, flags, output);
+}
+
+/** Minimum number of documents to pluck in each thread.
+ */
+const size_t kPluckDocumentsPerThread = 4096;
+
+/** Documents and the located field of each.
+ */
+struct PluckContext {
+  /// Documents to look up.
+  const char* const* documents;
+  /// Length of each document.
+  const size_t* lengths;
+  /// Whether each document failed CheckBSONBuffer().
+  char* invalid;
+  /// Dotted path to the field.
+  const char* path;
+  /// Iterator at the field of each document.
+  bson_iterator* iterators;
+  /// Type of the field of each document, or BSON_EOO if missing.
+  bson_type* types;
+  /// Class of the output column.
+  mxClassID class_id;
+  /// Value for missing numbers, as the Matlab API is not thread-safe.
+  double missing;
+  /// Data of the output column.
+  void* output;
+};
+
+/** Check and locate the field in a range of documents. Called in worker
+ * threads.
+ */
+void FindPluckPaths(size_t begin, size_t end, void* context) {
+  PluckContext* pluck = static_cast<PluckContext*>(context);
+  for (size_t i = begin; i < end; ++i) {
+    pluck->invalid[i] = !CheckBSONBuffer(pluck->documents[i],
+                                         pluck->lengths[i]);
+    if (pluck->invalid[i]) {
+      pluck->types[i] = BSON_EOO;
+      continue;
+    }
+    bson_iterator_from_buffer(&pluck->iterators[i], pluck->documents[i]);
+    pluck->types[i] = FindBSONPath(&pluck->iterators[i], pluck->path);
+  }
+}
+
+/** Fill a range of the numeric output column. Called in worker threads.
+ */
+void FillPluckColumn(size_t begin, size_t end, void* context) {
+  PluckContext* pluck = static_cast<PluckContext*>(context);
+  for (size_t i = begin; i < end; ++i) {
+    bson_iterator* it = &pluck->iterators[i];
+    bson_type type = pluck->types[i];
+    switch (pluck->class_id) {
+      case mxDOUBLE_CLASS:
+        static_cast<double*>(pluck->output)[i] =
+            (type == BSON_DOUBLE) ? bson_iterator_double(it) :
+            (type == BSON_INT) ? bson_iterator_int(it) :
+            (type == BSON_LONG) ? bson_iterator_long(it) :
+            pluck->missing;
+        break;
+      case mxINT64_CLASS:
+        static_cast<int64_t*>(pluck->output)[i] =
+            (type == BSON_INT) ? bson_iterator_int(it) :
+            bson_iterator_long(it);
+        break;
+      case mxINT32_CLASS:
+        static_cast<int32_t*>(pluck->output)[i] = bson_iterator_int(it);
+        break;
+      case mxLOGICAL_CLASS:
+        static_cast<mxLogical*>(pluck->output)[i] = bson_iterator_bool(it);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+/** Extract a field from each document into a column.
+ * Numeric fields become a double column with NaN for missing values, or an
+ * int32 or int64 column when every value is an integer. Boolean fields
+ * become a logical column and string fields a cellstr when no value is
+ * missing. Object ids become an N-by-12 uint8 or N-by-3 uint32 matrix with
+ * BSONMEX_DECODE_OID_BINARY or BSONMEX_DECODE_OID_UINT32 when no value is
+ * missing. Other fields become a cell array with [] for missing values.
+ * @param documents BSON documents, checked in the worker threads.
+ * @param lengths length of each document.
+ * @param path dotted path to the field.
+ * @param num_threads number of threads to use.
+ * @param flags decoder options, e.g., BSONMEX_DECODE_OID_BINARY.
+ * @param output mxArray of the column to be created.
+ */
+void PluckBSONField(const std::vector<const char*>& documents,
+                    const std::vector<size_t>& lengths,
+                    const char* path,
+                    int num_threads,
+                    int flags,
+                    mxArray** output) {
+  size_t size = documents.size();
+  std::vector<bson_iterator> iterators(size);
+  std::vector<bson_type> types(size);
+  std::vector<char> invalid(size);
+  PluckContext context;
+  context.documents = (size) ? &documents[0] : NULL;
+  context.lengths = (size) ? &lengths[0] : NULL;
+  context.invalid = (size) ? &invalid[0] : NULL;
+  context.path = path;
+  context.iterators = (size) ? &iterators[0] : NULL;
+  context.types = (size) ? &types[0] : NULL;
+  num_threads = std::max(1, std::min<int>(
+      num_threads, size / kPluckDocumentsPerThread));
+  bsonmex::ParallelFor(size, num_threads, FindPluckPaths, &context);
+  for (size_t i = 0; i < size; ++i)
+    if (invalid[i])
+      mexErrMsgIdAndTxt("bsonmex:error",
+                        "Invalid BSON document %d.",
+                        (int)i + 1);
+  size_t num_missing = 0, num_doubles = 0, num_ints = 0, num_longs = 0;
+  size_t num_bools = 0, num_strings = 0, num_oids = 0;
+  for (size_t i = 0; i < size; ++i) {
+    switch (types[i]) {
+      case BSON_EOO: ++num_missing; break;
+      case BSON_DOUBLE: ++num_doubles; break;
+      case BSON_INT: ++num_ints; break;
+      case BSON_LONG: ++num_longs; break;
+      case BSON_BOOL: ++num_bools; break;
+      case BSON_STRING: ++num_strings; break;
+      case BSON_OID: ++num_oids; break;
+      default: break;
+    }
+  }
+  size_t num_numbers = num_doubles + num_ints + num_longs;
+  context.class_id = mxCELL_CLASS;
+  if (size > 0 && num_numbers == size - num_missing && num_numbers > 0)
+    context.class_id = (num_doubles || num_missing) ? mxDOUBLE_CLASS :
+                       (num_longs) ? mxINT64_CLASS : mxINT32_CLASS;
+  else if (size > 0 && num_bools == size)
+    context.class_id = mxLOGICAL_CLASS;
+  else if (size > 0 && num_oids == size &&
+           (flags & (BSONMEX_DECODE_OID_BINARY | BSONMEX_DECODE_OID_UINT32))) {
+    std::vector<bson_oid_t> oids(size);
+    for (size_t i = 0; i < size; ++i)
+      oids[i] = *bson_iterator_oid(&iterators[i]);
+    *output = ConvertOIDsToMxArray(&oids[0], size, flags);
+    return;
+  }
+  if (context.class_id == mxLOGICAL_CLASS)
+    *output = mxCreateLogicalMatrix(size, 1);
+  else if (context.class_id != mxCELL_CLASS)
+    *output = mxCreateNumericMatrix(size, 1, context.class_id, mxREAL);
+  else {
+    *output = mxCreateCellMatrix(size, 1);
+    for (size_t i = 0; i < size; ++i) {
+      mxArray* value = (types[i] == BSON_EOO) ?
+          mxCreateDoubleMatrix(0, 0, mxREAL) :
+          ConvertBSONValueToMxArray(&iterators[i], flags);
+      if (!value)
+        mexErrMsgIdAndTxt("bsonmex:error",
+                          "Failed to convert document %d.",
+                          (int)i + 1);
+      mxSetCell(*output, i, value);
+    }
+    return;
+  }
+  context.missing = mxGetNaN();
+  context.output = mxGetData(*output);
+  bsonmex::ParallelFor(size, num_threads, FillPluckColumn, &context);
+}
+
+/** Serialize a value or BSON-encoded mxArray to JSON.
+ * @param input mxArray to serialize. uint8 input is taken as BSON.
+ * @param output mxArray of UTF-8 text to be created.
+ */
+void EncodeJSON(const mxArray* input, mxArray** output) {
+  JSONBuffer text = {NULL, 0, 0};
+  bool success = true;
+  if (mxIsUint8(input))
+    success = ConvertBSONToJSON(GetBSONData(input), false, &text);
+  else {
+    bson value;
+    if (!ConvertMxArrayToBSON(input, 0, &value))
+      mexErrMsgIdAndTxt("bsonmex:error",
+                        "Failed to encode BSON: %s",
+                        bson_first_errormsg(&value));
+    bool is_array = !mxIsStruct(input) || mxGetNumberOfElements(input) != 1;
+    success = ConvertBSONToJSON(bson_data(&value), is_array, &text);
+    bson_destroy(&value);
+  }
+  if (!success) {
+    FreeJSONBuffer(&text);
+    mexErrMsgIdAndTxt("bsonmex:error", "Failed to convert to JSON.");
+  }
+  *output = mxCreateNumericMatrix(1, text.size, mxUINT8_CLASS, mxREAL);
+  memcpy(mxGetData(*output), text.data, text.size);
+  FreeJSONBuffer(&text);
+}
+
+/** Parse JSON text into BSON-encoded mxArray.
+ * @param input mxArray of UTF-8 text.
+ * @param flags options to change the behavior. See EncodeBSON().
+ * @param output mxArray to be created.
+ */
+void DecodeJSON(const mxArray* input, int flags, mxArray** output) {
+  if (!mxIsUint8(input))
+    mexErrMsgIdAndTxt("bsonmex:error", "JSON input must be uint8.");
+  bson value;
+  const char* error = NULL;
+  size_t error_offset = 0;
+  if (!ConvertJSONToBSON((const char*)mxGetData(input),
+                         mxGetNumberOfElements(input),
+                         flags,
+                         &value,
+                         &error,
+                         &error_offset))
+    mexErrMsgIdAndTxt("bsonmex:error",
+                      "Failed to parse JSON at byte %d: %s",
+                      (int)error_offset,
+                      error);
+  int size = bson_size(&value);
+  *output = mxCreateNumericMatrix(1, size, mxUINT8_CLASS, mxREAL);
+  memcpy(mxGetData(*output), bson_data(&value), size);
   bson_destroy(&value);
 }
 
+/** Get an open stream from the session id in mxArray.
+ * @param input mxArray of the stream id.
+ * @return stream instance.
+ */
+BSONStream* GetStream(const mxArray* input) {
+  BSONStream* stream = Session<BSONStream>::get(MxArray(input).toInt());
+  if (!stream || !stream->isOpen())
+    mexErrMsgIdAndTxt("bsonmex:error", "No open stream found.");
+  return stream;
+}
+
 MEX_FUNCTION(encode) (int nlhs,
                       mxArray *plhs[],
                       int nrhs,
@@ -68,9 +516,227 @@ MEX_FUNCTION(decode) (int nlhs,
                       mxArray *plhs[],
                       int nrhs,
                       const mxArray *prhs[]) {
+  CheckInputArguments(1, 3, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  VariableInputArguments options;
+  options.set("OID", "string");
+  options.update(prhs + 1, prhs + nrhs);
+  DecodeBSON(prhs[0], ParseOIDFormat(options["OID"]), &plhs[0]);
+}
+
+MEX_FUNCTION(get) (int nlhs,
+                   mxArray *plhs[],
+                   int nrhs,
+                   const mxArray *prhs[]) {
+  CheckInputArguments(2, 2, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  char* path = mxArrayToString(prhs[1]);
+  if (!path)
+    mexErrMsgIdAndTxt("bsonmex:error", "Path must be a string.");
+  GetBSONField(prhs[0], path, &plhs[0]);
+  mxFree(path);
+}
+
+MEX_FUNCTION(set) (int nlhs,
+                   mxArray *plhs[],
+                   int nrhs,
+                   const mxArray *prhs[]) {
+  CheckInputArguments(3, 3, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  char* path = mxArrayToString(prhs[1]);
+  if (!path)
+    mexErrMsgIdAndTxt("bsonmex:error", "Path must be a string.");
+  SetBSONField(prhs[0], path, prhs[2], &plhs[0]);
+  mxFree(path);
+}
+
+MEX_FUNCTION(unset) (int nlhs,
+                     mxArray *plhs[],
+                     int nrhs,
+                     const mxArray *prhs[]) {
+  CheckInputArguments(2, 2, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  char* path = mxArrayToString(prhs[1]);
+  if (!path)
+    mexErrMsgIdAndTxt("bsonmex:error", "Path must be a string.");
+  SetBSONField(prhs[0], path, NULL, &plhs[0]);
+  mxFree(path);
+}
+
+MEX_FUNCTION(pluck) (int nlhs,
+                     mxArray *plhs[],
+                     int nrhs,
+                     const mxArray *prhs[]) {
+  CheckInputArguments(2, 6, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  VariableInputArguments options;
+  options.set("THREADS", bsonmex::ThreadGroup::numProcessors());
+  options.set("OID", "string");
+  options.update(prhs + 2, prhs + nrhs);
+  std::vector<const char*> documents;
+  std::vector<size_t> lengths;
+  if (mxIsCell(prhs[0])) {
+    documents.resize(mxGetNumberOfElements(prhs[0]));
+    lengths.resize(documents.size());
+    for (int i = 0; i < documents.size(); ++i) {
+      const mxArray* element = mxGetCell(prhs[0], i);
+      if (!element || (!mxIsUint8(element) && !mxIsInt8(element)))
+        mexErrMsgIdAndTxt("bsonmex:error",
+                          "BSON input %d must be uint8.",
+                          i + 1);
+      documents[i] = (const char*)mxGetData(element);
+      lengths[i] = mxGetNumberOfElements(element);
+    }
+  }
+  else
+    SplitBSONStream(prhs[0], &documents, &lengths);
+  std::string path = MxArray(prhs[1]).toString();
+  PluckBSONField(documents,
+                 lengths,
+                 path.c_str(),
+                 options["THREADS"].toInt(),
+                 ParseOIDFormat(options["OID"]),
+                 &plhs[0]);
+}
+
+MEX_FUNCTION(toJSON) (int nlhs,
+                      mxArray *plhs[],
+                      int nrhs,
+                      const mxArray *prhs[]) {
   CheckInputArguments(1, 1, nrhs);
   CheckOutputArguments(0, 1, nlhs);
-  DecodeBSON(prhs[0], &plhs[0]);
+  EncodeJSON(prhs[0], &plhs[0]);
+}
+
+MEX_FUNCTION(fromJSON) (int nlhs,
+                        mxArray *plhs[],
+                        int nrhs,
+                        const mxArray *prhs[]) {
+  CheckInputArguments(1, 3, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  VariableInputArguments options;
+  options.set("QUERY", false);
+  options.update(prhs + 1, prhs + nrhs);
+  int flags = (options["QUERY"].toBool()) ? BSON_FLAG_QUERY_MODE : 0;
+  DecodeJSON(prhs[0], flags, &plhs[0]);
+}
+
+MEX_FUNCTION(encodeStream) (int nlhs,
+                            mxArray *plhs[],
+                            int nrhs,
+                            const mxArray *prhs[]) {
+  CheckInputArguments(1, 3, nrhs);
+  CheckOutputArguments(0, 2, nlhs);
+  VariableInputArguments options;
+  options.set("QUERY", false);
+  options.update(prhs + 1, prhs + nrhs);
+  int flags = (options["QUERY"].toBool()) ? BSON_FLAG_QUERY_MODE : 0;
+  mxArray* offsets = NULL;
+  EncodeBSONStream(prhs[0], flags, &plhs[0], &offsets);
+  if (nlhs > 1)
+    plhs[1] = offsets;
+  else
+    mxDestroyArray(offsets);
+}
+
+MEX_FUNCTION(decodeStream) (int nlhs,
+                            mxArray *plhs[],
+                            int nrhs,
+                            const mxArray *prhs[]) {
+  CheckInputArguments(1, 5, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  VariableInputArguments options;
+  options.set("COLUMNAR", false);
+  options.set("OID", "string");
+  options.update(prhs + 1, prhs + nrhs);
+  DecodeBSONStream(prhs[0],
+                   options["COLUMNAR"].toBool(),
+                   ParseOIDFormat(options["OID"]),
+                   &plhs[0]);
+}
+
+MEX_FUNCTION(openStream) (int nlhs,
+                          mxArray *plhs[],
+                          int nrhs,
+                          const mxArray *prhs[]) {
+  CheckInputArguments(1, 5, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  VariableInputArguments options;
+  options.set("WRITE", false);
+  options.set("APPEND", false);
+  options.update(prhs + 1, prhs + nrhs);
+  std::string filename = MxArray(prhs[0]).toString();
+  bool append = options["APPEND"].toBool();
+  BSONStream* stream = NULL;
+  int stream_id = Session<BSONStream>::create(&stream);
+  if (!stream->open(filename.c_str(),
+                    options["WRITE"].toBool() || append,
+                    append)) {
+    std::string message = stream->errorMessage();
+    Session<BSONStream>::destroy(stream_id);
+    mexErrMsgIdAndTxt("bsonmex:error",
+                      "Failed to open a stream: %s",
+                      message.c_str());
+  }
+  plhs[0] = MxArray(stream_id).getMutable();
+}
+
+MEX_FUNCTION(readStream) (int nlhs,
+                          mxArray *plhs[],
+                          int nrhs,
+                          const mxArray *prhs[]) {
+  CheckInputArguments(1, 6, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  BSONStream* stream = GetStream(prhs[0]);
+  int count = (nrhs > 1 && !mxIsChar(prhs[1])) ?
+              MxArray(prhs[1]).toInt() : 1;
+  VariableInputArguments options;
+  options.set("COLUMNAR", false);
+  options.set("OID", "string");
+  options.update(prhs + 1, prhs + nrhs);
+  std::vector<const char*> documents;
+  if (!stream->read(count, &documents))
+    mexErrMsgIdAndTxt("bsonmex:error", "%s", stream->errorMessage());
+  ConvertDocuments(documents,
+                   options["COLUMNAR"].toBool(),
+                   ParseOIDFormat(options["OID"]),
+                   &plhs[0]);
+}
+
+MEX_FUNCTION(writeStream) (int nlhs,
+                           mxArray *plhs[],
+                           int nrhs,
+                           const mxArray *prhs[]) {
+  CheckInputArguments(2, 2, nrhs);
+  CheckOutputArguments(0, 0, nlhs);
+  BSONStream* stream = GetStream(prhs[0]);
+  if (!mxIsCell(prhs[1]) && !mxIsStruct(prhs[1]))
+    mexErrMsgIdAndTxt("bsonmex:error", "Input must be a cell or struct array.");
+  for (int i = 0; i < mxGetNumberOfElements(prhs[1]); ++i) {
+    bson value;
+    EncodeDocument(prhs[1], i, 0, &value);
+    bool success = stream->write(bson_data(&value), bson_size(&value));
+    bson_destroy(&value);
+    if (!success)
+      mexErrMsgIdAndTxt("bsonmex:error", "%s", stream->errorMessage());
+  }
+}
+
+MEX_FUNCTION(closeStream) (int nlhs,
+                           mxArray *plhs[],
+                           int nrhs,
+                           const mxArray *prhs[]) {
+  CheckInputArguments(1, 1, nrhs);
+  CheckOutputArguments(0, 0, nlhs);
+  int stream_id = MxArray(prhs[0]).toInt();
+  BSONStream* stream = Session<BSONStream>::get(stream_id);
+  if (!stream)
+    mexErrMsgIdAndTxt("bsonmex:error", "No open stream found.");
+  bool success = stream->close();
+  std::string message = stream->errorMessage();
+  Session<BSONStream>::destroy(stream_id);
+  if (!success)
+    mexErrMsgIdAndTxt("bsonmex:error", "%s", message.c_str());
 }
 
 } // namespace
\ No newline at end of file
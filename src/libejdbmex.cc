@@ -3,13 +3,33 @@
 /// Kota Yamaguchi 2013
 
 #include "bsonmex.h"
+#include "bsonutil.h"
 #include "ejdb.h"
 #include "ejdbmex.h"
 #include "mex/arguments.h"
 #include "mex/function.h"
 #include "mex/mxarray.h"
+#include "parallel.h"
+#include "predicate.h"
+#include "resultcache.h"
+#include "sketch.h"
+#include "writequeue.h"
+#include <set>
+#include <stdio.h>
+#include <string.h>
 
+using bsonmex::HyperLogLog;
+using bsonmex::QuantileSketch;
+using bsonmex::SketchType;
+using bsonmex::ThreadGroup;
 using ejdbmex::Database;
+using ejdbmex::DecodeOptions;
+using ejdbmex::ExportStats;
+using ejdbmex::FileFormat;
+using ejdbmex::QueryFuture;
+using ejdbmex::ResultCache;
+using ejdbmex::ShardSet;
+using ejdbmex::WriteQueue;
 using mex::CheckInputArguments;
 using mex::CheckOutputArguments;
 using mex::MxArray;
@@ -19,9 +39,11 @@ using mex::VariableInputArguments;
 namespace {
 
 /// Parse database input in the arguments.
+/// @param allow_sharded whether the caller supports sharded databases.
 int ParseDatabaseInput(int nrhs,
                        const mxArray *prhs[],
-                       Database** database) {
+                       Database** database,
+                       bool allow_sharded = false) {
   if (!database) {
     ERROR("Null pointer.");
   }
@@ -32,6 +54,11 @@ int ParseDatabaseInput(int nrhs,
   if (!(*database)) {
     ERROR("No open database found.");
   }
+  if ((*database)->shards() && !allow_sharded)
+    ERROR("Not supported on a sharded database. Pass a shard id instead.");
+  string message;
+  if ((*database)->takeWriteError(&message))
+    ERROR("Write-behind failed: %s", message.c_str());
   return index;
 }
 
@@ -46,38 +73,371 @@ int ParseCollectionInput(int nrhs,
   return index;
 }
 
+/// Parse a string or a cell array of strings into a list of fields.
+void ParseFieldList(const MxArray& input, vector<string>* fields) {
+  if (input.isChar())
+    fields->assign(1, input.toString());
+  else
+    input.toVector<string>(fields);
+}
+
+/// Parse an object id format name into decoder flags.
+int ParseOIDFormat(const string& format) {
+  int flags = GetOIDDecodeFlags(format.c_str());
+  if (flags < 0)
+    ERROR("Unknown OID format: %s", format.c_str());
+  return flags;
+}
+
+/// Get an object id from a string or a row of an N-by-12 uint8 or N-by-3
+/// uint32 matrix.
+void ParseObjectId(const mxArray* input, int index, bson_oid_t* object_id) {
+  if (!ConvertMxArrayToOID(input, index, object_id))
+    ERROR("Invalid object id.");
+}
+
+/// Parse result conversion options in the arguments.
+/// @param begin first option argument.
+/// @param end end of the option arguments.
+/// @param options conversion options to be set.
+/// @param extra_arguments other options of the caller to be updated. Can be
+///                        NULL.
+void ParseDecodeOptions(const mxArray** begin,
+                        const mxArray** end,
+                        DecodeOptions* options,
+                        VariableInputArguments* extra_arguments = NULL) {
+  VariableInputArguments default_arguments;
+  VariableInputArguments& arguments = (extra_arguments) ?
+      *extra_arguments : default_arguments;
+  arguments.set("LAZY", false);
+  arguments.set("FIELDS", MxArray::Cell(0, 0));
+  arguments.set("OID", "string");
+  arguments.update(begin, end);
+  options->lazy = arguments["LAZY"].toBool();
+  options->flags = ParseOIDFormat(arguments["OID"].toString());
+  ParseFieldList(arguments["FIELDS"], &options->fields);
+  if (options->lazy && !options->fields.empty())
+    ERROR("LAZY and FIELDS options cannot be combined.");
+}
+
+/// Parse open mode flags in the options.
+int ParseOpenMode(VariableInputArguments& options) {
+  return ((options["READER"].toBool()) ? JBOREADER : 0) |
+         ((options["WRITER"].toBool()) ? JBOWRITER : 0) |
+         ((options["CREAT"].toBool()) ? JBOCREAT : 0) |
+         ((options["TRUNC"].toBool()) ? JBOTRUNC : 0) |
+         ((options["NOLCK"].toBool()) ? JBONOLCK : 0) |
+         ((options["LCKNB"].toBool()) ? JBOLCKNB : 0) |
+         ((options["TSYNC"].toBool()) ? JBOTSYNC : 0);
+}
+
+/// Parse a file format name, or guess it from the file extension.
+FileFormat ParseFileFormat(const string& format, const string& filename) {
+  if (format == "bson")
+    return ejdbmex::FORMAT_BSON;
+  if (format == "jsonl" || format == "json")
+    return ejdbmex::FORMAT_JSONL;
+  if (!format.empty())
+    ERROR("Unknown format: %s", format.c_str());
+  size_t dot = filename.rfind('.');
+  string extension = (dot == string::npos) ? "" : filename.substr(dot);
+  return (extension == ".json" || extension == ".jsonl") ?
+      ejdbmex::FORMAT_JSONL : ejdbmex::FORMAT_BSON;
+}
+
+/// Parse a class name of numeric or logical columns.
+mxClassID ParseColumnClass(const string& name) {
+  const char* names[] = {"double", "single", "int8", "uint8", "int16",
+                         "uint16", "int32", "uint32", "int64", "uint64",
+                         "logical"};
+  const mxClassID class_ids[] = {mxDOUBLE_CLASS, mxSINGLE_CLASS,
+                                 mxINT8_CLASS, mxUINT8_CLASS,
+                                 mxINT16_CLASS, mxUINT16_CLASS,
+                                 mxINT32_CLASS, mxUINT32_CLASS,
+                                 mxINT64_CLASS, mxUINT64_CLASS,
+                                 mxLOGICAL_CLASS};
+  for (int i = 0; i < sizeof(class_ids) / sizeof(class_ids[0]); ++i)
+    if (name == names[i])
+      return class_ids[i];
+  ERROR("Unknown TYPE: %s", name.c_str());
+  return mxUNKNOWN_CLASS;
+}
+
+/// Make query hints that fetch only the given fields.
+/// @param input query hints given by the user, or NULL.
+/// @param fields dotted paths of the fields to fetch.
+/// @param hints bson query hint object to be created.
+void MakeFieldsHints(const mxArray* input,
+                     const vector<string>& fields,
+                     bson* hints) {
+  bson_init_as_query(hints);
+  if (input) {
+    bson user_hints;
+    if (!ConvertMxArrayToBSON(input, BSON_FLAG_QUERY_MODE, &user_hints))
+      ERROR(bson_first_errormsg(&user_hints));
+    bson_iterator it;
+    bson_iterator_init(&it, &user_hints);
+    while (bson_iterator_next(&it) != BSON_EOO)
+      if (strcmp(bson_iterator_key(&it), "$fields") != 0)
+        bson_append_element(hints, NULL, &it);
+    bson_destroy(&user_hints);
+  }
+  bson_append_start_object(hints, "$fields");
+  for (int i = 0; i < fields.size(); ++i)
+    bson_append_int(hints, fields[i].c_str(), 1);
+  bson_append_finish_object(hints);
+  bson_finish(hints);
+}
+
+/// Parse a serialized sketch in a uint8 array.
+/// @param input mxArray of the serialized sketch.
+/// @param hll sketch to restore when the type is bsonmex::SKETCH_HLL.
+/// @param quantiles sketch to restore when the type is
+///                  bsonmex::SKETCH_QUANTILES.
+/// @return type of the sketch.
+SketchType ParseSketch(const mxArray* input,
+                       HyperLogLog* hll,
+                       QuantileSketch* quantiles) {
+  if (!mxIsUint8(input))
+    ERROR("Sketch must be uint8.");
+  const char* data = static_cast<const char*>(mxGetData(input));
+  size_t size = mxGetNumberOfElements(input);
+  SketchType type = bsonmex::GetSketchType(data, size);
+  bool success = (type == bsonmex::SKETCH_HLL) ?
+      hll->deserialize(data, size) :
+      (type == bsonmex::SKETCH_QUANTILES) ?
+      quantiles->deserialize(data, size) : false;
+  if (!success)
+    ERROR("Invalid sketch.");
+  return type;
+}
+
+/// Create a uint8 row vector of the serialized sketch.
+mxArray* CreateSketchArray(const string& state) {
+  mxArray* output = mxCreateNumericMatrix(1,
+                                          state.size(),
+                                          mxUINT8_CLASS,
+                                          mxREAL);
+  memcpy(mxGetData(output), state.data(), state.size());
+  return output;
+}
+
+/// Transactions of the collections in a batch.
+/// An error raised in a MEX function need not unwind C++ frames, so the
+/// transactions are aborted explicitly before raising an error.
+class BatchTransaction {
+public:
+  /// Create an empty transaction.
+  explicit BatchTransaction(Database* database) : database_(database) {}
+  /// Begin a transaction of the collection, creating it if missing.
+  bool begin(const char* collection_name) {
+    EJCOLL* collection = database_->createCollection(collection_name);
+    if (!collection || !ejdbtranbegin(collection))
+      return false;
+    collections_.push_back(collection);
+    return true;
+  }
+  /// Commit all the transactions.
+  bool commit() {
+    bool success = true;
+    for (int i = 0; i < collections_.size(); ++i) {
+      success = ejdbtrancommit(collections_[i]) && success;
+      database_->touch(collections_[i]);
+    }
+    collections_.clear();
+    return success;
+  }
+  /// Abort the transactions not committed.
+  void abort() {
+    for (int i = 0; i < collections_.size(); ++i) {
+      ejdbtranabort(collections_[i]);
+      database_->touchDocuments(collections_[i]);
+    }
+    collections_.clear();
+  }
+
+private:
+  /// Database of the collections.
+  Database* database_;
+  /// Collections in transaction.
+  vector<EJCOLL*> collections_;
+};
+
+/// Get a batch operation. Operations are created once and kept, so that an
+/// error raised by the operation does not leak it.
+mex::Operation* GetBatchOperation(const string& name) {
+  static map<string, mex::Operation*> operations;
+  map<string, mex::Operation*>::iterator it = operations.find(name);
+  if (it != operations.end())
+    return it->second;
+  mex::Operation* operation = mex::OperationFactory::create(name);
+  if (operation)
+    operations[name] = operation;
+  return operation;
+}
+
+/// Tell hints from a cell array of fields. Hints are a struct or a cell
+/// array of $-prefixed keys, and an empty cell array has no fields.
+bool IsHintsInput(const mxArray* input) {
+  if (mxIsStruct(input))
+    return true;
+  if (!mxIsCell(input))
+    return false;
+  if (mxGetNumberOfElements(input) == 0)
+    return true;
+  const mxArray* key = mxGetCell(input, 0);
+  if (!key || !mxIsChar(key) || mxGetNumberOfElements(key) == 0)
+    return false;
+  return *mxGetChars(key) == '$';
+}
+
 /// Common query operation interface.
 void QueryOperation(int nlhs,
                     mxArray *plhs[],
                     int nrhs,
                     const mxArray *prhs[],
                     int flags) {
-  CheckInputArguments(2, 4, nrhs);
+  CheckInputArguments(2, 1024, nrhs);
   CheckOutputArguments(0, 1, nlhs);
   Database* database;
-  EJCOLL* collection;
-  int index = ParseCollectionInput(nrhs, prhs, &collection, &database);
+  int index = ParseDatabaseInput(nrhs, prhs, &database, true);
+  string collection_name = MxArray(prhs[index++]).toString();
+  ShardSet* shards = database->shards();
+  EJCOLL* collection = (shards) ? NULL :
+      database->getMutableCollection(collection_name.c_str());
   bson query, hints;
   if (!ConvertMxArrayToBSON(prhs[index++], BSON_FLAG_QUERY_MODE, &query))
     ERROR(bson_first_errormsg(&query));
   bool with_hints = false;
-  if (index < nrhs) {
+  if (index < nrhs && !mxIsChar(prhs[index])) {
     if (ConvertMxArrayToBSON(prhs[index++], BSON_FLAG_QUERY_MODE, &hints))
       with_hints = true;
     else
       ERROR(bson_first_errormsg(&hints));
   }
-  if (!database->find(collection,
+  DecodeOptions options;
+  ParseDecodeOptions(prhs + index, prhs + nrhs, &options);
+  // Lazy handles are Matlab objects and not cached.
+  ResultCache* cache = (options.lazy || shards) ?
+      NULL : database->queryCache();
+  string cache_key;
+  uint64_t generation = database->getGeneration(collection);
+  mxArray* results = NULL;
+  if (cache) {
+    database->makeQueryCacheKey(collection,
+                                &query,
+                                (with_hints) ? &hints : NULL,
+                                flags,
+                                options,
+                                &cache_key);
+    results = cache->get(cache_key, generation);
+  }
+  if (!results && shards) {
+    if (!shards->find(collection_name.c_str(),
                       &query,
                       (with_hints) ? &hints : NULL,
-                      &plhs[0],
-                      flags))
-    ERROR("Failed to query: %s", database->errorMessage());
+                      &results,
+                      flags,
+                      options))
+      ERROR("Failed to query: %s", shards->errorMessage());
+  }
+  else if (!results) {
+    // A queued write applied during the query would not change the
+    // generation taken above, so only results read with no queued writes
+    // are cached. Writes are only queued from this thread.
+    bool cacheable = cache && !database->hasPendingWrites();
+    if (!database->find(collection,
+                        &query,
+                        (with_hints) ? &hints : NULL,
+                        &results,
+                        flags,
+                        options))
+      ERROR("Failed to query: %s", database->errorMessage());
+    if (cacheable)
+      cache->put(cache_key, generation, results);
+  }
+  plhs[0] = results;
   bson_destroy(&query);
   if (with_hints)
     bson_destroy(&hints);
 }
 
+/// Parse a query future id in the arguments.
+int ParseFutureInput(const mxArray* input, QueryFuture** future) {
+  int future_id = MxArray(input).toInt();
+  if (future_id <= 0 || !Session<QueryFuture>::is_valid(future_id))
+    ERROR("Invalid query future: %d", future_id);
+  *future = Session<QueryFuture>::get(future_id);
+  if ((*future)->isCancelled())
+    ERROR("Query future %d is cancelled.", future_id);
+  return future_id;
+}
+
+/// Release cancelled query futures that have finished.
+void ReleaseCancelledFutures() {
+  vector<int> future_ids;
+  const map<int, QueryFuture>& futures =
+      Session<QueryFuture>::get_const_instances();
+  for (map<int, QueryFuture>::const_iterator it = futures.begin();
+       it != futures.end();
+       ++it)
+    if (it->second.isCancelled() && it->second.isReady())
+      future_ids.push_back(it->first);
+  for (int i = 0; i < future_ids.size(); ++i)
+    Session<QueryFuture>::destroy(future_ids[i]);
+}
+
+/// Release query futures of the database, waiting for running queries.
+void ReleaseFutures(const Database* database) {
+  vector<int> future_ids;
+  const map<int, QueryFuture>& futures =
+      Session<QueryFuture>::get_const_instances();
+  for (map<int, QueryFuture>::const_iterator it = futures.begin();
+       it != futures.end();
+       ++it)
+    if (it->second.database() == database)
+      future_ids.push_back(it->first);
+  for (int i = 0; i < future_ids.size(); ++i)
+    Session<QueryFuture>::destroy(future_ids[i]);
+}
+
+/// Wait for the running queries of the database, keeping their futures.
+void WaitFutures(const Database* database) {
+  const map<int, QueryFuture>& futures =
+      Session<QueryFuture>::get_const_instances();
+  for (map<int, QueryFuture>::const_iterator it = futures.begin();
+       it != futures.end();
+       ++it)
+    if (it->second.database() == database)
+      Session<QueryFuture>::get(it->first)->wait();
+}
+
+/// Close the shards of a sharded database and release their sessions.
+void CloseShards(const vector<int>& shard_ids) {
+  for (int i = 0; i < shard_ids.size(); ++i) {
+    Database* shard = Session<Database>::get(shard_ids[i]);
+    ReleaseFutures(shard);
+    shard->close();
+    Session<Database>::destroy(shard_ids[i]);
+  }
+}
+
+/// Find the sharded database that owns the database as a shard.
+/// @return id of the sharded database, or 0 if the database is not a shard.
+int FindShardOwner(const Database* database) {
+  const map<int, Database>& databases =
+      Session<Database>::get_const_instances();
+  for (map<int, Database>::const_iterator it = databases.begin();
+       it != databases.end();
+       ++it) {
+    const ShardSet* shards = it->second.shards();
+    for (int i = 0; shards && i < shards->size(); ++i)
+      if (shards->getShard(i) == database)
+        return it->first;
+  }
+  return 0;
+}
+
 /// Common setIndex operation interface.
 void SetIndexOperation(int nlhs,
                        mxArray *plhs[],
@@ -90,6 +450,7 @@ void SetIndexOperation(int nlhs,
   EJCOLL* collection;
   int index = ParseCollectionInput(nrhs, prhs, &collection, &database);
   string path = MxArray(prhs[index++]).toString();
+  database->touch(collection);
   if (!ejdbsetindex(collection, path.c_str(), flags)) {
     ERROR("Failed to set index: %s", database->errorMessage());
   }
@@ -109,15 +470,10 @@ MEX_FUNCTION(open) (int nlhs,
   options.set("NOLCK", false);
   options.set("LCKNB", false);
   options.set("TSYNC", false);
+  options.set("WRITEBEHIND", false);
   options.update(prhs + 1, prhs + nrhs);
   string filename = MxArray(prhs[0]).toString();
-  int mode = ((options["READER"].toBool()) ? JBOREADER : 0) |
-             ((options["WRITER"].toBool()) ? JBOWRITER : 0) |
-             ((options["CREAT"].toBool()) ? JBOCREAT : 0) |
-             ((options["TRUNC"].toBool()) ? JBOTRUNC : 0) |
-             ((options["NOLCK"].toBool()) ? JBONOLCK : 0) |
-             ((options["LCKNB"].toBool()) ? JBOLCKNB : 0) |
-             ((options["TSYNC"].toBool()) ? JBOTSYNC : 0);
+  int mode = ParseOpenMode(options);
   Database* database = NULL;
   int database_id = Session<Database>::create(&database);
   if (!database->open(filename.c_str(), mode)) {
@@ -126,9 +482,62 @@ MEX_FUNCTION(open) (int nlhs,
           filename.c_str(), 
           database->errorMessage());
   }
+  if (options["WRITEBEHIND"].toBool() && !database->startWriteBehind()) {
+    database->close();
+    Session<Database>::destroy(database_id);
+    ERROR("Failed to start a writer thread.");
+  }
   plhs[0] = MxArray(database_id).getMutable();
 }
 
+MEX_FUNCTION(openSharded) (int nlhs,
+                           mxArray *plhs[],
+                           int nrhs,
+                           const mxArray *prhs[]) {
+  CheckInputArguments(2, 1024, nrhs);
+  CheckOutputArguments(0, 2, nlhs);
+  VariableInputArguments options;
+  options.set("READER", false);
+  options.set("WRITER", true);
+  options.set("CREAT", true);
+  options.set("TRUNC", false);
+  options.set("NOLCK", false);
+  options.set("LCKNB", false);
+  options.set("TSYNC", false);
+  options.set("KEY", "");
+  options.update(prhs + 2, prhs + nrhs);
+  string base_path = MxArray(prhs[0]).toString();
+  int num_shards = MxArray(prhs[1]).toInt();
+  if (num_shards < 1)
+    ERROR("Invalid number of shards: %d", num_shards);
+  int mode = ParseOpenMode(options);
+  vector<int> shard_ids;
+  vector<Database*> shards;
+  for (int i = 0; i < num_shards; ++i) {
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), ".%d", i);
+    string filename = base_path + suffix;
+    Database* shard = NULL;
+    shard_ids.push_back(Session<Database>::create(&shard));
+    shards.push_back(shard);
+    if (!shard->open(filename.c_str(), mode)) {
+      string message = shard->errorMessage();
+      CloseShards(shard_ids);
+      ERROR("Failed to create a database at %s: %s",
+            filename.c_str(),
+            message.c_str());
+    }
+  }
+  Database* database = NULL;
+  int database_id = Session<Database>::create(&database);
+  database->setShards(new ShardSet(shard_ids,
+                                   shards,
+                                   options["KEY"].toString()));
+  plhs[0] = MxArray(database_id).getMutable();
+  if (nlhs > 1)
+    plhs[1] = MxArray(shard_ids).getMutable();
+}
+
 MEX_FUNCTION(isopen) (int nlhs,
                       mxArray *plhs[],
                       int nrhs,
@@ -150,8 +559,26 @@ MEX_FUNCTION(close) (int nlhs,
   Database* database = Session<Database>::get(database_id);
   if (!database)
     ERROR("No open database found.");
+  int owner_id = FindShardOwner(database);
+  if (owner_id)
+    ERROR("The database is a shard. Close the sharded database %d.",
+          owner_id);
+  ReleaseFutures(database);
+  ShardSet* shards = database->shards();
+  if (shards) {
+    vector<int> shard_ids;
+    for (int i = 0; i < shards->size(); ++i)
+      shard_ids.push_back(shards->getShardId(i));
+    CloseShards(shard_ids);
+  }
+  if (database->writeQueue())
+    database->writeQueue()->drain();
+  string message;
+  bool failed = database->takeWriteError(&message);
   database->close();
   Session<Database>::destroy(database_id);
+  if (failed)
+    ERROR("Write-behind failed: %s", message.c_str());
 }
 
 MEX_FUNCTION(ensureCollection) (int nlhs,
@@ -195,6 +622,14 @@ MEX_FUNCTION(dropCollection) (int nlhs,
   VariableInputArguments options;
   options.set("UNLINK", true);
   options.update(prhs + index, prhs + nrhs);
+  if (database->writeQueue())
+    database->writeQueue()->drain();
+  // Running queries may still read the collection to be freed.
+  WaitFutures(database);
+  EJCOLL* collection = ejdbgetcoll(database->getMutable(),
+                                   collection_name.c_str());
+  if (collection)
+    database->touchDocuments(collection);
   if (!ejdbrmcoll(database->getMutable(),
                   collection_name.c_str(),
                   options["UNLINK"].toBool())) {
@@ -209,61 +644,751 @@ MEX_FUNCTION(save) (int nlhs,
   CheckInputArguments(2, 1024, nrhs);
   CheckOutputArguments(0, 1, nlhs);
   Database* database;
-  int index = ParseDatabaseInput(nrhs, prhs, &database);
+  int index = ParseDatabaseInput(nrhs, prhs, &database, true);
   string collection_name = MxArray(prhs[index++]).toString();
   int num_objects = nrhs - index;
-  plhs[0] = mxCreateCellMatrix(1, num_objects);
+  int flags = 0;
+  if (num_objects >= 2 &&
+      mxIsChar(prhs[nrhs - 2]) &&
+      MxArray(prhs[nrhs - 2]).toString() == "OID") {
+    flags = ParseOIDFormat(MxArray(prhs[nrhs - 1]).toString());
+    num_objects -= 2;
+  }
+  // Ids are generated in bulk and prefixed to the documents, so that they
+  // are known without waiting for the database.
+  vector<bson_oid_t> object_ids(num_objects);
+  if (num_objects > 0)
+    GenerateObjectIds(&object_ids[0], num_objects);
+  ShardSet* shards = database->shards();
+  WriteQueue* queue = database->writeQueue();
+  EJCOLL* collection = (queue) ?
+      database->createCollection(collection_name.c_str()) : NULL;
+  if (queue && !collection)
+    ERROR(database->errorMessage());
   for (int i = 0; i < num_objects; ++i) {
     bson value;
-    if (!ConvertMxArrayToBSON(prhs[index++], 0, &value))
+    bson_oid_t generated_id = object_ids[i];
+    if (!ConvertMxArrayToBSONWithId(prhs[index++], &object_ids[i], &value))
       ERROR(bson_first_errormsg(&value));
-    string object_id;
-    if (!database->save(collection_name.c_str(), &value, &object_id))
+    if (!SetBSONObjectId(&value, &object_ids[i])) {
+      bson_destroy(&value);
+      ERROR("Invalid _id.");
+    }
+    if (queue) {
+      database->touchDocument(collection, &object_ids[i]);
+      queue->save(collection, &value);
+      continue;
+    }
+    if (shards) {
+      bool is_new = memcmp(generated_id.bytes,
+                           object_ids[i].bytes,
+                           sizeof(generated_id.bytes)) == 0;
+      bool success = shards->save(collection_name.c_str(),
+                                  &value,
+                                  &object_ids[i],
+                                  is_new);
+      bson_destroy(&value);
+      if (!success)
+        ERROR(shards->errorMessage());
+      continue;
+    }
+    if (!database->save(collection_name.c_str(), &value, &object_ids[i]))
       ERROR(database->errorMessage());
     bson_destroy(&value);
-    mxSetCell(plhs[0], i, MxArray(object_id).getMutable());
   }
-  if (num_objects == 1) {
-    mxArray* value = mxDuplicateArray(mxGetCell(plhs[0], 0));
-    mxDestroyArray(plhs[0]);
-    plhs[0] = value;
+  plhs[0] = ConvertOIDsToMxArray((num_objects) ? &object_ids[0] : NULL,
+                                 num_objects,
+                                 flags);
+}
+
+MEX_FUNCTION(setCache) (int nlhs,
+                        mxArray *plhs[],
+                        int nrhs,
+                        const mxArray *prhs[]) {
+  CheckInputArguments(0, 1024, nrhs);
+  CheckOutputArguments(0, 0, nlhs);
+  Database* database;
+  int index = ParseDatabaseInput(nrhs, prhs, &database);
+  VariableInputArguments options;
+  // -1 keeps the budget of an option not given.
+  options.set("QUERYBYTES", -1);
+  options.set("DOCUMENTBYTES", -1);
+  options.update(prhs + index, prhs + nrhs);
+  double query_bytes = options["QUERYBYTES"].toDouble();
+  double document_bytes = options["DOCUMENTBYTES"].toDouble();
+  if ((query_bytes < 0 && query_bytes != -1) ||
+      (document_bytes < 0 && document_bytes != -1))
+    ERROR("Cache budgets must not be negative.");
+  if (query_bytes >= 0)
+    database->setQueryCacheBudget(static_cast<size_t>(query_bytes));
+  if (document_bytes >= 0)
+    database->setDocumentCacheBudget(static_cast<size_t>(document_bytes));
+}
+
+MEX_FUNCTION(cacheStats) (int nlhs,
+                          mxArray *plhs[],
+                          int nrhs,
+                          const mxArray *prhs[]) {
+  CheckInputArguments(0, 1, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  Database* database;
+  ParseDatabaseInput(nrhs, prhs, &database);
+  const char* cache_names[] = {"query", "document"};
+  const char* stat_names[] = {"entries", "bytes", "budget", "hits", "misses"};
+  ResultCache* caches[] = {database->queryCache(), database->documentCache()};
+  plhs[0] = mxCreateStructMatrix(1, 1, 2, cache_names);
+  for (int i = 0; i < 2; ++i) {
+    mxArray* stats = mxCreateStructMatrix(1, 1, 5, stat_names);
+    double values[] = {0, 0, 0, 0, 0};
+    if (caches[i]) {
+      values[0] = caches[i]->size();
+      values[1] = caches[i]->bytes();
+      values[2] = caches[i]->budget();
+      values[3] = caches[i]->hits();
+      values[4] = caches[i]->misses();
+    }
+    for (int j = 0; j < 5; ++j)
+      mxSetFieldByNumber(stats, 0, j, mxCreateDoubleScalar(values[j]));
+    mxSetFieldByNumber(plhs[0], 0, i, stats);
+  }
+}
+
+MEX_FUNCTION(newId) (int nlhs,
+                     mxArray *plhs[],
+                     int nrhs,
+                     const mxArray *prhs[]) {
+  CheckInputArguments(0, 3, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  int index = 0;
+  int num_ids = (nrhs > 0 && !mxIsChar(prhs[0])) ?
+                MxArray(prhs[index++]).toInt() : 1;
+  if (num_ids < 0)
+    ERROR("Invalid number of ids: %d", num_ids);
+  VariableInputArguments options;
+  options.set("OID", "string");
+  options.update(prhs + index, prhs + nrhs);
+  int flags = ParseOIDFormat(options["OID"].toString());
+  vector<bson_oid_t> object_ids(num_ids);
+  if (num_ids > 0)
+    GenerateObjectIds(&object_ids[0], num_ids);
+  plhs[0] = ConvertOIDsToMxArray((num_ids) ? &object_ids[0] : NULL,
+                                 num_ids,
+                                 flags);
+}
+
+MEX_FUNCTION(import) (int nlhs,
+                      mxArray *plhs[],
+                      int nrhs,
+                      const mxArray *prhs[]) {
+  CheckInputArguments(2, 1024, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  Database* database;
+  int index = ParseDatabaseInput(nrhs, prhs, &database);
+  string collection_name = MxArray(prhs[index++]).toString();
+  string filename = MxArray(prhs[index++]).toString();
+  VariableInputArguments options;
+  options.set("FORMAT", "");
+  options.set("BATCHSIZE", 10000);
+  options.set("THREADS", ThreadGroup::numProcessors());
+  options.update(prhs + index, prhs + nrhs);
+  FileFormat format = ParseFileFormat(options["FORMAT"].toString(),
+                                      filename);
+  int batch_size = options["BATCHSIZE"].toInt();
+  if (batch_size < 1)
+    ERROR("BATCHSIZE must be positive.");
+  int count = 0;
+  if (!database->import(collection_name.c_str(),
+                        filename.c_str(),
+                        format,
+                        batch_size,
+                        options["THREADS"].toInt(),
+                        &count)) {
+    string message = database->takeErrorMessage();
+    ERROR("Failed to import %s: %s", filename.c_str(), message.c_str());
+  }
+  plhs[0] = mxCreateDoubleScalar(count);
+}
+
+MEX_FUNCTION(export) (int nlhs,
+                      mxArray *plhs[],
+                      int nrhs,
+                      const mxArray *prhs[]) {
+  CheckInputArguments(3, 1024, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  Database* database;
+  EJCOLL* collection;
+  int index = ParseCollectionInput(nrhs, prhs, &collection, &database);
+  bson query, hints;
+  if (!ConvertMxArrayToBSON(prhs[index++], BSON_FLAG_QUERY_MODE, &query))
+    ERROR(bson_first_errormsg(&query));
+  bool with_hints = false;
+  if (index < nrhs && !mxIsChar(prhs[index])) {
+    if (ConvertMxArrayToBSON(prhs[index++], BSON_FLAG_QUERY_MODE, &hints))
+      with_hints = true;
+    else
+      ERROR(bson_first_errormsg(&hints));
+  }
+  if (index >= nrhs)
+    ERROR("Missing filename.");
+  string filename = MxArray(prhs[index++]).toString();
+  VariableInputArguments options;
+  options.set("FORMAT", "");
+  options.update(prhs + index, prhs + nrhs);
+  FileFormat format = ParseFileFormat(options["FORMAT"].toString(),
+                                      filename);
+  ExportStats stats;
+  bool success = database->exportQuery(collection,
+                                       &query,
+                                       (with_hints) ? &hints : NULL,
+                                       filename.c_str(),
+                                       format,
+                                       &stats);
+  bson_destroy(&query);
+  if (with_hints)
+    bson_destroy(&hints);
+  if (!success) {
+    string message = database->takeErrorMessage();
+    ERROR("Failed to export %s: %s", filename.c_str(), message.c_str());
   }
+  const char* fields[] = {"count", "bytes", "seconds", "rate"};
+  plhs[0] = mxCreateStructMatrix(1, 1, 4, fields);
+  mxSetField(plhs[0], 0, "count", mxCreateDoubleScalar(stats.count));
+  mxSetField(plhs[0], 0, "bytes", mxCreateDoubleScalar(stats.bytes));
+  mxSetField(plhs[0], 0, "seconds", mxCreateDoubleScalar(stats.seconds));
+  mxSetField(plhs[0], 0, "rate", mxCreateDoubleScalar(
+      (stats.seconds > 0) ? stats.count / stats.seconds : 0));
 }
 
 MEX_FUNCTION(load) (int nlhs,
                     mxArray *plhs[],
                     int nrhs,
                     const mxArray *prhs[]) {
-  CheckInputArguments(1, 2, nrhs);
+  CheckInputArguments(2, 1024, nrhs);
   CheckOutputArguments(0, 1, nlhs);
   Database* database;
-  EJCOLL* collection;
-  int index = ParseCollectionInput(nrhs, prhs, &collection, &database);
-  string object_id = MxArray(prhs[index++]).toString();
-  bson* value;
-  if (database->load(collection, object_id.c_str(), &value)) {
-    if (!ConvertBSONToMxArray(value, &plhs[0])) {
-      ERROR(bson_first_errormsg(value));
+  int index = ParseDatabaseInput(nrhs, prhs, &database, true);
+  string collection_name = MxArray(prhs[index++]).toString();
+  ShardSet* shards = database->shards();
+  EJCOLL* collection = (shards) ? NULL :
+      database->getMutableCollection(collection_name.c_str());
+  const mxArray* object_ids = prhs[index++];
+  int num_objects = GetNumberOfOIDs(object_ids);
+  if (num_objects < 0)
+    ERROR("Invalid object id.");
+  DecodeOptions options;
+  ParseDecodeOptions(prhs + index, prhs + nrhs, &options);
+  // Rows of an object id matrix are loaded into a cell array.
+  bool is_single = mxIsChar(object_ids);
+  if (!is_single)
+    plhs[0] = mxCreateCellMatrix(num_objects, 1);
+  ResultCache* cache = (shards) ? NULL : database->documentCache();
+  uint64_t generation = (shards) ?
+      0 : database->getDocumentGeneration(collection);
+  string cache_key;
+  for (int i = 0; i < num_objects; ++i) {
+    bson_oid_t object_id;
+    ParseObjectId(object_ids, i, &object_id);
+    mxArray* result = NULL;
+    bson* value;
+    if (cache) {
+      database->makeDocumentCacheKey(collection,
+                                     &object_id,
+                                     &options,
+                                     &cache_key);
+      result = cache->get(cache_key, generation);
     }
-    bson_del(value);
+    // A document read while its queued write is applied must not be
+    // cached, so the queue is tested before the load.
+    bool cacheable = cache && !result && !database->hasPendingWrites();
+    bool found = result || ((shards) ?
+        shards->load(collection_name.c_str(), &object_id, &value) :
+        database->load(collection, &object_id, &value));
+    if (found) {
+      if (!result) {
+        result = ejdbmex::ConvertResultToMxArray(bson_data(value),
+                                                 bson_size(value),
+                                                 options);
+        if (!result) {
+          ERROR(bson_first_errormsg(value));
+        }
+        bson_del(value);
+        if (cacheable)
+          cache->put(cache_key, generation, result);
+      }
+      if (options.lazy) {
+        mxArray* handle = NULL;
+        mexCallMATLAB(1, &handle, 1, &result, "bson.lazy");
+        mxDestroyArray(result);
+        result = handle;
+      }
+    }
+    else
+      result = mxCreateCellMatrix(0, 0);
+    if (is_single)
+      plhs[0] = result;
+    else
+      mxSetCell(plhs[0], i, result);
   }
-  else
-    plhs[0] = mxCreateCellMatrix(0, 0);
 }
 
 MEX_FUNCTION(remove) (int nlhs,
                       mxArray *plhs[],
                       int nrhs,
                       const mxArray *prhs[]) {
-  CheckInputArguments(1, 2, nrhs);
+  CheckInputArguments(2, 3, nrhs);
   CheckOutputArguments(0, 0, nlhs);
   Database* database;
+  int index = ParseDatabaseInput(nrhs, prhs, &database, true);
+  string collection_name = MxArray(prhs[index++]).toString();
+  ShardSet* shards = database->shards();
+  EJCOLL* collection = (shards) ? NULL :
+      database->getMutableCollection(collection_name.c_str());
+  const mxArray* object_ids = prhs[index++];
+  int num_objects = GetNumberOfOIDs(object_ids);
+  if (num_objects < 0)
+    ERROR("Invalid object id.");
+  WriteQueue* queue = database->writeQueue();
+  for (int i = 0; i < num_objects; ++i) {
+    bson_oid_t object_id;
+    ParseObjectId(object_ids, i, &object_id);
+    if (queue) {
+      database->touchDocument(collection, &object_id);
+      queue->remove(collection, &object_id);
+    }
+    else if (shards) {
+      if (!shards->remove(collection_name.c_str(), &object_id))
+        ERROR(shards->errorMessage());
+    }
+    else if (!database->remove(collection, &object_id)) {
+      ERROR(database->errorMessage());
+    }
+  }
+}
+
+MEX_FUNCTION(aggregate) (int nlhs,
+                         mxArray *plhs[],
+                         int nrhs,
+                         const mxArray *prhs[]) {
+  CheckInputArguments(2, 1024, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  Database* database;
+  int index = ParseDatabaseInput(nrhs, prhs, &database, true);
+  string collection_name = MxArray(prhs[index++]).toString();
+  ShardSet* shards = database->shards();
+  EJCOLL* collection = (shards) ? NULL :
+      database->getMutableCollection(collection_name.c_str());
+  if (index >= nrhs)
+    ERROR("Missing query.");
+  VariableInputArguments options;
+  options.set("GROUPBY", MxArray::Cell(0, 0));
+  const char* function_names[] = {"COUNT", "SUM", "MIN", "MAX", "MEAN"};
+  const ejdbmex::AggregateFunction functions[] = {
+    ejdbmex::AGGREGATE_COUNT,
+    ejdbmex::AGGREGATE_SUM,
+    ejdbmex::AGGREGATE_MIN,
+    ejdbmex::AGGREGATE_MAX,
+    ejdbmex::AGGREGATE_MEAN
+  };
+  for (int i = 0; i < 5; ++i)
+    options.set(function_names[i], MxArray::Cell(0, 0));
+  bool with_hints = index + 1 < nrhs && !mxIsChar(prhs[index + 1]);
+  options.update(prhs + index + 1 + with_hints, prhs + nrhs);
+  vector<string> group_fields;
+  ParseFieldList(options["GROUPBY"], &group_fields);
+  vector<ejdbmex::Aggregate> aggregates;
+  for (int i = 0; i < 5; ++i) {
+    vector<string> fields;
+    ParseFieldList(options[function_names[i]], &fields);
+    for (int j = 0; j < fields.size(); ++j) {
+      ejdbmex::Aggregate aggregate;
+      aggregate.function = functions[i];
+      aggregate.field = fields[j];
+      aggregates.push_back(aggregate);
+    }
+  }
+  bson query, hints;
+  if (!ConvertMxArrayToBSON(prhs[index++], BSON_FLAG_QUERY_MODE, &query))
+    ERROR(bson_first_errormsg(&query));
+  if (with_hints &&
+      !ConvertMxArrayToBSON(prhs[index++], BSON_FLAG_QUERY_MODE, &hints))
+    ERROR(bson_first_errormsg(&hints));
+  bool success = (shards) ?
+      shards->aggregate(collection_name.c_str(),
+                        &query,
+                        (with_hints) ? &hints : NULL,
+                        group_fields,
+                        aggregates,
+                        &plhs[0]) :
+      database->aggregate(collection,
+                          &query,
+                          (with_hints) ? &hints : NULL,
+                          group_fields,
+                          aggregates,
+                          &plhs[0]);
+  bson_destroy(&query);
+  if (with_hints)
+    bson_destroy(&hints);
+  if (!success)
+    ERROR("Failed to aggregate: %s",
+          (shards) ? shards->errorMessage() : database->errorMessage());
+}
+
+MEX_FUNCTION(sketch) (int nlhs,
+                      mxArray *plhs[],
+                      int nrhs,
+                      const mxArray *prhs[]) {
+  CheckInputArguments(3, 1024, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  Database* database;
   EJCOLL* collection;
   int index = ParseCollectionInput(nrhs, prhs, &collection, &database);
-  string object_id = MxArray(prhs[index++]).toString();
-  if (!database->remove(collection, object_id.c_str())) {
-    ERROR(database->errorMessage());
+  bool with_hints = index + 2 < nrhs && !mxIsChar(prhs[index + 1]);
+  if (index + 1 + with_hints >= nrhs)
+    ERROR("Missing field.");
+  string field = MxArray(prhs[index + 1 + with_hints]).toString();
+  VariableInputArguments options;
+  options.set("TYPE", "hll");
+  options.set("PRECISION", 14);
+  options.set("ACCURACY", 0.01);
+  options.update(prhs + index + 2 + with_hints, prhs + nrhs);
+  string type_name = options["TYPE"].toString();
+  SketchType type = bsonmex::SKETCH_INVALID;
+  double parameter = 0;
+  if (type_name == "hll") {
+    type = bsonmex::SKETCH_HLL;
+    parameter = options["PRECISION"].toInt();
+    if (parameter < 4 || parameter > 18)
+      ERROR("PRECISION must be between 4 and 18.");
+  }
+  else if (type_name == "quantiles") {
+    type = bsonmex::SKETCH_QUANTILES;
+    parameter = options["ACCURACY"].toDouble();
+    if (!(parameter > 0 && parameter < 1))
+      ERROR("ACCURACY must be between 0 and 1.");
+  }
+  else
+    ERROR("Unknown TYPE: %s", type_name.c_str());
+  bson query, hints;
+  if (!ConvertMxArrayToBSON(prhs[index++], BSON_FLAG_QUERY_MODE, &query))
+    ERROR(bson_first_errormsg(&query));
+  if (with_hints &&
+      !ConvertMxArrayToBSON(prhs[index++], BSON_FLAG_QUERY_MODE, &hints))
+    ERROR(bson_first_errormsg(&hints));
+  string state;
+  bool success = database->sketch(collection,
+                                  &query,
+                                  (with_hints) ? &hints : NULL,
+                                  field.c_str(),
+                                  type,
+                                  parameter,
+                                  &state);
+  bson_destroy(&query);
+  if (with_hints)
+    bson_destroy(&hints);
+  if (!success)
+    ERROR("Failed to sketch: %s", database->errorMessage());
+  plhs[0] = CreateSketchArray(state);
+}
+
+MEX_FUNCTION(sketchMerge) (int nlhs,
+                           mxArray *plhs[],
+                           int nrhs,
+                           const mxArray *prhs[]) {
+  CheckInputArguments(1, 1024, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  HyperLogLog hll, other_hll;
+  QuantileSketch quantiles, other_quantiles;
+  SketchType type = ParseSketch(prhs[0], &hll, &quantiles);
+  for (int i = 1; i < nrhs; ++i) {
+    if (ParseSketch(prhs[i], &other_hll, &other_quantiles) != type)
+      ERROR("Sketches of different types cannot be merged.");
+    bool success = (type == bsonmex::SKETCH_HLL) ?
+        hll.merge(other_hll) : quantiles.merge(other_quantiles);
+    if (!success)
+      ERROR("Sketches of different parameters cannot be merged.");
   }
+  string state;
+  if (type == bsonmex::SKETCH_HLL)
+    hll.serialize(&state);
+  else
+    quantiles.serialize(&state);
+  plhs[0] = CreateSketchArray(state);
+}
+
+MEX_FUNCTION(sketchEstimate) (int nlhs,
+                              mxArray *plhs[],
+                              int nrhs,
+                              const mxArray *prhs[]) {
+  CheckInputArguments(1, 2, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  HyperLogLog hll;
+  QuantileSketch quantiles;
+  if (ParseSketch(prhs[0], &hll, &quantiles) == bsonmex::SKETCH_HLL) {
+    plhs[0] = mxCreateDoubleScalar(hll.estimate());
+    return;
+  }
+  if (nrhs < 2) {
+    const double probabilities[] = {0.5, 0.95, 0.99};
+    plhs[0] = mxCreateDoubleMatrix(1, 3, mxREAL);
+    for (int i = 0; i < 3; ++i)
+      mxGetPr(plhs[0])[i] = quantiles.quantile(probabilities[i]);
+    return;
+  }
+  if (!mxIsDouble(prhs[1]))
+    ERROR("Probabilities must be double.");
+  plhs[0] = mxDuplicateArray(prhs[1]);
+  double* values = mxGetPr(plhs[0]);
+  for (int i = 0; i < mxGetNumberOfElements(plhs[0]); ++i)
+    values[i] = quantiles.quantile(values[i]);
+}
+
+MEX_FUNCTION(findColumn) (int nlhs,
+                          mxArray *plhs[],
+                          int nrhs,
+                          const mxArray *prhs[]) {
+  CheckInputArguments(3, 1024, nrhs);
+  CheckOutputArguments(0, 2, nlhs);
+  Database* database;
+  EJCOLL* collection;
+  int index = ParseCollectionInput(nrhs, prhs, &collection, &database);
+  bool with_hints = index + 2 < nrhs && IsHintsInput(prhs[index + 1]);
+  if (index + 1 + with_hints >= nrhs)
+    ERROR("Missing field.");
+  const mxArray* field_input = prhs[index + 1 + with_hints];
+  vector<string> fields;
+  ParseFieldList(MxArray(field_input), &fields);
+  if (fields.empty())
+    ERROR("Missing field.");
+  VariableInputArguments options;
+  options.set("TYPE", "double");
+  options.update(prhs + index + 2 + with_hints, prhs + nrhs);
+  mxClassID class_id = ParseColumnClass(options["TYPE"].toString());
+  bson query, hints;
+  MakeFieldsHints((with_hints) ? prhs[index + 1] : NULL, fields, &hints);
+  if (!ConvertMxArrayToBSON(prhs[index], BSON_FLAG_QUERY_MODE, &query)) {
+    bson_destroy(&hints);
+    ERROR(bson_first_errormsg(&query));
+  }
+  vector<mxArray*> columns, masks;
+  bool success = database->findColumns(collection,
+                                       &query,
+                                       &hints,
+                                       fields,
+                                       class_id,
+                                       &columns,
+                                       &masks);
+  bson_destroy(&query);
+  bson_destroy(&hints);
+  if (!success)
+    ERROR("Failed to query: %s", database->errorMessage());
+  // A single field name returns vectors, and a cell array returns structs.
+  mxArray* values = NULL;
+  mxArray* mask = NULL;
+  if (mxIsChar(field_input)) {
+    values = columns[0];
+    mask = masks[0];
+  }
+  else {
+    vector<const char*> paths(fields.size());
+    for (int i = 0; i < fields.size(); ++i)
+      paths[i] = fields[i].c_str();
+    values = CreateProjectionStruct(paths.size(), &paths[0], 1);
+    mask = CreateProjectionStruct(paths.size(), &paths[0], 1);
+    if (!values || !mask)
+      ERROR("Invalid field names.");
+    for (int i = 0; i < fields.size(); ++i) {
+      mxSetFieldByNumber(values, 0, i, columns[i]);
+      mxSetFieldByNumber(mask, 0, i, masks[i]);
+    }
+  }
+  plhs[0] = values;
+  if (nlhs > 1)
+    plhs[1] = mask;
+  else
+    mxDestroyArray(mask);
+}
+
+MEX_FUNCTION(join) (int nlhs,
+                    mxArray *plhs[],
+                    int nrhs,
+                    const mxArray *prhs[]) {
+  CheckInputArguments(6, 1024, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  Database* database;
+  EJCOLL* left_collection;
+  int index = ParseCollectionInput(nrhs,
+                                   prhs,
+                                   &left_collection,
+                                   &database);
+  if (nrhs - index < 5)
+    ERROR("Missing join arguments.");
+  bson left_query, right_query;
+  if (!ConvertMxArrayToBSON(prhs[index++], BSON_FLAG_QUERY_MODE, &left_query))
+    ERROR(bson_first_errormsg(&left_query));
+  string left_key = MxArray(prhs[index++]).toString();
+  string right_name = MxArray(prhs[index++]).toString();
+  EJCOLL* right_collection = database->getMutableCollection(
+      right_name.c_str());
+  if (!ConvertMxArrayToBSON(prhs[index++],
+                            BSON_FLAG_QUERY_MODE,
+                            &right_query))
+    ERROR(bson_first_errormsg(&right_query));
+  string right_key = MxArray(prhs[index++]).toString();
+  VariableInputArguments arguments;
+  arguments.set("OUTPUT", "merged");
+  DecodeOptions options;
+  ParseDecodeOptions(prhs + index, prhs + nrhs, &options, &arguments);
+  string output = arguments["OUTPUT"].toString();
+  if (output != "merged" && output != "pairs")
+    ERROR("Unknown OUTPUT: %s", output.c_str());
+  bool success = database->join(left_collection,
+                                &left_query,
+                                left_key.c_str(),
+                                right_collection,
+                                &right_query,
+                                right_key.c_str(),
+                                (output == "pairs") ? ejdbmex::JOIN_PAIRS :
+                                                      ejdbmex::JOIN_MERGED,
+                                options,
+                                &plhs[0]);
+  bson_destroy(&left_query);
+  bson_destroy(&right_query);
+  if (!success)
+    ERROR("Failed to join: %s", database->errorMessage());
+}
+
+MEX_FUNCTION(scan) (int nlhs,
+                    mxArray *plhs[],
+                    int nrhs,
+                    const mxArray *prhs[]) {
+  CheckInputArguments(2, 1024, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  Database* database;
+  EJCOLL* collection;
+  int index = ParseCollectionInput(nrhs, prhs, &collection, &database);
+  if (index >= nrhs)
+    ERROR("Missing query.");
+  bson query;
+  if (!ConvertMxArrayToBSON(prhs[index++], BSON_FLAG_QUERY_MODE, &query))
+    ERROR(bson_first_errormsg(&query));
+  bsonmex::Predicate predicate;
+  string error;
+  bool compiled = predicate.compile(bson_data(&query), &error);
+  bson_destroy(&query);
+  if (!compiled)
+    ERROR("%s Use ejdb.find for this query.", error.c_str());
+  VariableInputArguments arguments;
+  arguments.set("THREADS", ThreadGroup::numProcessors());
+  DecodeOptions options;
+  ParseDecodeOptions(prhs + index, prhs + nrhs, &options, &arguments);
+  int num_threads = arguments["THREADS"].toInt();
+  if (num_threads < 1)
+    ERROR("THREADS must be positive.");
+  if (!database->scan(collection, predicate, num_threads, options, &plhs[0]))
+    ERROR("Failed to scan: %s", database->errorMessage());
+}
+
+MEX_FUNCTION(batch) (int nlhs,
+                     mxArray *plhs[],
+                     int nrhs,
+                     const mxArray *prhs[]) {
+  CheckInputArguments(1, 4, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  Database* database;
+  int index = ParseDatabaseInput(nrhs, prhs, &database);
+  const mxArray* database_input = (index > 0) ? prhs[0] : NULL;
+  const mxArray* operations = prhs[index++];
+  if (!mxIsCell(operations))
+    ERROR("Operations must be a cell array.");
+  VariableInputArguments options;
+  options.set("ATOMIC", false);
+  options.update(prhs + index, prhs + nrhs);
+  bool atomic = options["ATOMIC"].toBool();
+  if (atomic && database->writeQueue())
+    ERROR("ATOMIC batches cannot be used with write-behind.");
+  // Operations that take a collection as the first argument.
+  const char* atomic_names[] = {"save", "load", "remove", "update", "find",
+                                "findOne", "count"};
+  set<string> atomic_operations(atomic_names, atomic_names + 7);
+  int num_operations = mxGetNumberOfElements(operations);
+  vector<string> names(num_operations);
+  set<string> collection_names;
+  for (int i = 0; i < num_operations; ++i) {
+    const mxArray* operation = mxGetCell(operations, i);
+    if (!operation || !mxIsCell(operation) ||
+        mxGetNumberOfElements(operation) < 1 ||
+        !mxIsChar(mxGetCell(operation, 0)))
+      ERROR("Operation %d must be a cell array of a name and arguments.",
+            i + 1);
+    names[i] = MxArray(mxGetCell(operation, 0)).toString();
+    if (names[i] == "batch")
+      ERROR("Batches cannot be nested.");
+    if (!atomic)
+      continue;
+    if (atomic_operations.find(names[i]) == atomic_operations.end())
+      ERROR("Operation %s is not allowed in an atomic batch.",
+            names[i].c_str());
+    const mxArray* collection = (mxGetNumberOfElements(operation) > 1) ?
+                                mxGetCell(operation, 1) : NULL;
+    if (!collection || !mxIsChar(collection))
+      ERROR("Operation %d is missing a collection.", i + 1);
+    collection_names.insert(MxArray(collection).toString());
+  }
+  if (atomic) {
+    BatchTransaction transaction(database);
+    for (set<string>::const_iterator it = collection_names.begin();
+         it != collection_names.end();
+         ++it) {
+      if (!transaction.begin(it->c_str())) {
+        const char* message = database->errorMessage();
+        transaction.abort();
+        ERROR("Failed to begin a transaction: %s", message);
+      }
+    }
+    // The operations run as one batch without ATOMIC, where an error is
+    // trapped here to abort the transactions before raising it.
+    vector<mxArray*> arguments;
+    if (database_input)
+      arguments.push_back(const_cast<mxArray*>(database_input));
+    arguments.push_back(const_cast<mxArray*>(operations));
+    mxArray* results = NULL;
+    mxArray* exception = mexCallMATLABWithTrap(1,
+                                               &results,
+                                               arguments.size(),
+                                               &arguments[0],
+                                               "ejdb.batch");
+    if (exception) {
+      transaction.abort();
+      mexCallMATLAB(0, NULL, 1, &exception, "throw");
+    }
+    if (!transaction.commit()) {
+      mxDestroyArray(results);
+      ERROR("Failed to commit: %s", database->errorMessage());
+    }
+    plhs[0] = results;
+    return;
+  }
+  mxArray* results = mxCreateCellMatrix(1, num_operations);
+  vector<const mxArray*> arguments;
+  for (int i = 0; i < num_operations; ++i) {
+    const mxArray* operation = mxGetCell(operations, i);
+    arguments.clear();
+    if (database_input)
+      arguments.push_back(database_input);
+    for (int j = 1; j < mxGetNumberOfElements(operation); ++j)
+      arguments.push_back(mxGetCell(operation, j));
+    mxArray* outputs[2] = {NULL, NULL};
+    mex::Operation* function = GetBatchOperation(names[i]);
+    if (!function)
+      ERROR("Invalid operation: %s", names[i].c_str());
+    (*function)(0,
+                outputs,
+                arguments.size(),
+                (arguments.empty()) ? NULL : &arguments[0]);
+    if (outputs[0])
+      mxSetCell(results, i, outputs[0]);
+  }
+  plhs[0] = results;
 }
 
 MEX_FUNCTION(find) (int nlhs,
@@ -273,6 +1398,83 @@ MEX_FUNCTION(find) (int nlhs,
   QueryOperation(nlhs, plhs, nrhs, prhs, 0);
 }
 
+MEX_FUNCTION(findAsync) (int nlhs,
+                         mxArray *plhs[],
+                         int nrhs,
+                         const mxArray *prhs[]) {
+  CheckInputArguments(2, 1024, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  ReleaseCancelledFutures();
+  Database* database;
+  EJCOLL* collection;
+  int index = ParseCollectionInput(nrhs, prhs, &collection, &database);
+  bson query, hints;
+  if (!ConvertMxArrayToBSON(prhs[index++], BSON_FLAG_QUERY_MODE, &query))
+    ERROR(bson_first_errormsg(&query));
+  bool with_hints = false;
+  if (index < nrhs && !mxIsChar(prhs[index])) {
+    if (ConvertMxArrayToBSON(prhs[index++], BSON_FLAG_QUERY_MODE, &hints))
+      with_hints = true;
+    else {
+      bson_destroy(&query);
+      ERROR(bson_first_errormsg(&hints));
+    }
+  }
+  DecodeOptions options;
+  ParseDecodeOptions(prhs + index, prhs + nrhs, &options);
+  QueryFuture* future = NULL;
+  int future_id = Session<QueryFuture>::create(&future);
+  if (!future->start(database,
+                     collection,
+                     &query,
+                     (with_hints) ? &hints : NULL,
+                     options)) {
+    Session<QueryFuture>::destroy(future_id);
+    ERROR("Failed to start a query.");
+  }
+  plhs[0] = MxArray(future_id).getMutable();
+}
+
+MEX_FUNCTION(isReady) (int nlhs,
+                       mxArray *plhs[],
+                       int nrhs,
+                       const mxArray *prhs[]) {
+  CheckInputArguments(1, 1, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  ReleaseCancelledFutures();
+  QueryFuture* future;
+  ParseFutureInput(prhs[0], &future);
+  plhs[0] = mxCreateLogicalScalar(future->isReady());
+}
+
+MEX_FUNCTION(fetch) (int nlhs,
+                     mxArray *plhs[],
+                     int nrhs,
+                     const mxArray *prhs[]) {
+  CheckInputArguments(1, 1, nrhs);
+  CheckOutputArguments(0, 1, nlhs);
+  ReleaseCancelledFutures();
+  QueryFuture* future;
+  int future_id = ParseFutureInput(prhs[0], &future);
+  const char* error = NULL;
+  bool success = future->fetch(&plhs[0], &error);
+  Session<QueryFuture>::destroy(future_id);
+  if (!success)
+    ERROR("Failed to query: %s", error);
+}
+
+MEX_FUNCTION(cancel) (int nlhs,
+                      mxArray *plhs[],
+                      int nrhs,
+                      const mxArray *prhs[]) {
+  CheckInputArguments(1, 1, nrhs);
+  CheckOutputArguments(0, 0, nlhs);
+  QueryFuture* future;
+  ParseFutureInput(prhs[0], &future);
+  future->cancel();
+  ReleaseCancelledFutures();
+}
+
 MEX_FUNCTION(findOne) (int nlhs,
                        mxArray *plhs[],
                        int nrhs,
@@ -306,6 +1508,15 @@ MEX_FUNCTION(update) (int nlhs,
     else
       ERROR(bson_first_errormsg(&hints));
   }
+  database->touchDocuments(collection);
+  if (database->writeQueue()) {
+    database->writeQueue()->update(collection,
+                                   &query,
+                                   (with_hints) ? &hints : NULL);
+    // The count is not known until the writer applies the update.
+    plhs[0] = mxCreateDoubleScalar(mxGetNaN());
+    return;
+  }
   uint32_t num_updates = ejdbupdate(collection, &query, NULL, 0, &hints, NULL);
   bson_destroy(&query);
   if (with_hints)
@@ -418,12 +1629,30 @@ MEX_FUNCTION(sync) (int nlhs,
   CheckInputArguments(0, 1, nrhs);
   CheckOutputArguments(0, 0, nlhs);
   Database* database;
-  ParseDatabaseInput(nrhs, prhs, &database);
-  if (!ejdbsyncdb(database->getMutable())) {
+  ParseDatabaseInput(nrhs, prhs, &database, true);
+  if (database->writeQueue()) {
+    database->writeQueue()->drain();
+    string message;
+    if (database->takeWriteError(&message))
+      ERROR("Write-behind failed: %s", message.c_str());
+  }
+  ShardSet* shards = database->shards();
+  for (int i = 0; shards && i < shards->size(); ++i)
+    if (!ejdbsyncdb(shards->getShard(i)->getMutable()))
+      ERROR(shards->getShard(i)->errorMessage());
+  if (!shards && !ejdbsyncdb(database->getMutable())) {
     ERROR(database->errorMessage());
   }
 }
 
+/// Raise an error for a transaction on a write-behind database. The writer
+/// thread would wait for the transaction of the Matlab thread, so queued
+/// writes could neither be drained nor aborted.
+void CheckTransactionInput(Database* database) {
+  if (database->writeQueue())
+    ERROR("Transactions cannot be used with write-behind.");
+}
+
 MEX_FUNCTION(begintx) (int nlhs,
                       mxArray *plhs[],
                       int nrhs,
@@ -433,6 +1662,7 @@ MEX_FUNCTION(begintx) (int nlhs,
   Database* database;
   EJCOLL* collection;
   ParseCollectionInput(nrhs, prhs, &collection, &database);
+  CheckTransactionInput(database);
   if (!ejdbtranbegin(collection)) {
     ERROR(database->errorMessage());
   }
@@ -447,6 +1677,8 @@ MEX_FUNCTION(commitx) (int nlhs,
   Database* database;
   EJCOLL* collection;
   ParseCollectionInput(nrhs, prhs, &collection, &database);
+  CheckTransactionInput(database);
+  database->touch(collection);
   if (!ejdbtrancommit(collection)) {
     ERROR(database->errorMessage());
   }
@@ -461,6 +1693,8 @@ MEX_FUNCTION(abortx) (int nlhs,
   Database* database;
   EJCOLL* collection;
   ParseCollectionInput(nrhs, prhs, &collection, &database);
+  CheckTransactionInput(database);
+  database->touchDocuments(collection);
   if (!ejdbtranabort(collection)) {
     ERROR(database->errorMessage());
   }
@@ -512,6 +1746,8 @@ MEX_FUNCTION(command) (int nlhs,
   if (!ConvertMxArrayToBSON(prhs[index++], 0, &command)) {
     ERROR(bson_first_errormsg(&command));
   }
+  // Commands may modify any collection.
+  database->touchAll();
   bson* response = ejdbcommand(database->getMutable(), &command);
   if (!response) {
     ERROR(database->errorMessage());
@@ -0,0 +1,64 @@
+/// Read-only memory-mapped file.
+
+#include "mappedfile.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace bsonmex {
+
+MappedFile::MappedFile() : fd_(-1), data_(NULL), size_(0), released_(0) {}
+
+MappedFile::~MappedFile() {
+  close();
+}
+
+bool MappedFile::open(const char* filename) {
+  close();
+  error_.clear();
+  fd_ = ::open(filename, O_RDONLY);
+  struct stat status;
+  if (fd_ >= 0 && fstat(fd_, &status) == 0) {
+    size_ = status.st_size;
+    if (size_ == 0)
+      return true;
+    void* data = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (data != MAP_FAILED) {
+      data_ = static_cast<char*>(data);
+      madvise(data_, size_, MADV_SEQUENTIAL);
+      return true;
+    }
+  }
+  error_ = std::string(filename) + ": " + strerror(errno);
+  close();
+  return false;
+}
+
+void MappedFile::close() {
+  if (data_) {
+    munmap(data_, size_);
+    data_ = NULL;
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+  size_ = 0;
+  released_ = 0;
+}
+
+void MappedFile::release(size_t offset) {
+  if (!data_)
+    return;
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t end = offset - offset % page_size;
+  if (end > released_) {
+    madvise(data_ + released_, end - released_, MADV_DONTNEED);
+    released_ = end;
+  }
+}
+
+} // namespace bsonmex
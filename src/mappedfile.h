@@ -0,0 +1,51 @@
+/// Read-only memory-mapped file.
+
+#ifndef __MAPPEDFILE_H__
+#define __MAPPEDFILE_H__
+
+#include <stddef.h>
+#include <string>
+
+namespace bsonmex {
+
+/// Read-only memory mapping of a whole file for a sequential scan.
+class MappedFile {
+public:
+  /// Empty constructor.
+  MappedFile();
+  /// Destructor. Unmaps the file if open.
+  virtual ~MappedFile();
+  /// Map a file.
+  /// @param filename path to the file.
+  /// @return true if success.
+  bool open(const char* filename);
+  /// Check if open.
+  bool isOpen() const { return fd_ >= 0; }
+  /// Unmap the file.
+  void close();
+  /// Mapped contents, or NULL for an empty file.
+  const char* data() const { return data_; }
+  /// Size of the file.
+  size_t size() const { return size_; }
+  /// Release resident pages before the offset. The contents remain
+  /// accessible and are paged in again on access.
+  void release(size_t offset);
+  /// Last error message.
+  const char* errorMessage() const { return error_.c_str(); }
+
+private:
+  /// File descriptor.
+  int fd_;
+  /// Mapped contents.
+  char* data_;
+  /// Size of the mapped file.
+  size_t size_;
+  /// Offset below which pages are already released.
+  size_t released_;
+  /// Last error message.
+  std::string error_;
+};
+
+} // namespace bsonmex
+
+#endif // __MAPPEDFILE_H__
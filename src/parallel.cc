@@ -0,0 +1,70 @@
+/// Thread helpers for work done outside of the Matlab thread.
+
+#include "parallel.h"
+#include <unistd.h>
+
+namespace bsonmex {
+
+ThreadGroup::ThreadGroup() {}
+
+ThreadGroup::~ThreadGroup() {
+  join();
+}
+
+void ThreadGroup::start(size_t size,
+                        int num_threads,
+                        RangeFunction function,
+                        void* context) {
+  join();
+  if (num_threads < 1)
+    num_threads = 1;
+  if (static_cast<size_t>(num_threads) > size)
+    num_threads = (size > 0) ? size : 1;
+  ranges_.resize(num_threads);
+  for (int i = 0; i < num_threads; ++i) {
+    ranges_[i].begin = size * i / num_threads;
+    ranges_[i].end = size * (i + 1) / num_threads;
+    ranges_[i].function = function;
+    ranges_[i].context = context;
+  }
+  if (num_threads == 1) {
+    run(&ranges_[0]);
+    return;
+  }
+  threads_.reserve(num_threads);
+  for (int i = 0; i < num_threads; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, run, &ranges_[i]) == 0)
+      threads_.push_back(thread);
+    else
+      run(&ranges_[i]);
+  }
+}
+
+void ThreadGroup::join() {
+  for (size_t i = 0; i < threads_.size(); ++i)
+    pthread_join(threads_[i], NULL);
+  threads_.clear();
+}
+
+int ThreadGroup::numProcessors() {
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return (count > 0) ? count : 1;
+}
+
+void* ThreadGroup::run(void* range) {
+  Range* value = static_cast<Range*>(range);
+  value->function(value->begin, value->end, value->context);
+  return NULL;
+}
+
+void ParallelFor(size_t size,
+                 int num_threads,
+                 RangeFunction function,
+                 void* context) {
+  ThreadGroup threads;
+  threads.start(size, num_threads, function, context);
+  threads.join();
+}
+
+} // namespace bsonmex
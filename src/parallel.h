@@ -0,0 +1,69 @@
+/// Thread helpers for work done outside of the Matlab thread.
+///
+/// Functions run in the worker threads must not call the Matlab API.
+
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <pthread.h>
+#include <stddef.h>
+#include <vector>
+
+namespace bsonmex {
+
+/// Function to process the index range [begin, end).
+typedef void (*RangeFunction)(size_t begin, size_t end, void* context);
+
+/// Threads processing contiguous index ranges in parallel.
+class ThreadGroup {
+public:
+  /// Empty constructor.
+  ThreadGroup();
+  /// Destructor. Waits for running threads.
+  virtual ~ThreadGroup();
+  /// Split [0, size) into contiguous ranges and start processing them
+  /// without waiting. Ranges run in the calling thread when threads are not
+  /// available.
+  /// @param size number of items.
+  /// @param num_threads number of threads to use.
+  /// @param function function to process a range.
+  /// @param context pointer passed to the function.
+  void start(size_t size,
+             int num_threads,
+             RangeFunction function,
+             void* context);
+  /// Wait for all ranges to finish.
+  void join();
+  /// Number of processors online.
+  static int numProcessors();
+
+private:
+  /// Range of items to process in a thread.
+  struct Range {
+    size_t begin;
+    size_t end;
+    RangeFunction function;
+    void* context;
+  };
+  /// Thread entry point.
+  static void* run(void* range);
+
+  /// Ranges being processed.
+  std::vector<Range> ranges_;
+  /// Running threads.
+  std::vector<pthread_t> threads_;
+};
+
+/// Process [0, size) in parallel and wait for completion.
+/// @param size number of items.
+/// @param num_threads number of threads to use.
+/// @param function function to process a range.
+/// @param context pointer passed to the function.
+void ParallelFor(size_t size,
+                 int num_threads,
+                 RangeFunction function,
+                 void* context);
+
+} // namespace bsonmex
+
+#endif // __PARALLEL_H__
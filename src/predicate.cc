@@ -0,0 +1,285 @@
+/// Query predicates evaluated over raw BSON.
+
+#include "predicate.h"
+#include "bsonutil.h"
+#include <algorithm>
+#include <string.h>
+
+using std::string;
+using std::vector;
+
+namespace bsonmex {
+
+Predicate::Predicate() {}
+
+bool Predicate::compile(const char* query, string* error) {
+  conditions_.clear();
+  return compileDocument(query, error);
+}
+
+bool Predicate::match(const char* document) const {
+  for (size_t i = 0; i < conditions_.size(); ++i) {
+    const Condition& condition = conditions_[i];
+    bson_iterator it;
+    bson_iterator_from_buffer(&it, document);
+    bson_type type = FindBSONPath(&it, condition.path.c_str());
+    bool matched = (condition.op == OP_EXISTS) ?
+        type != BSON_EOO :
+        type != BSON_EOO && matchElement(condition, &it);
+    if (matched == condition.negate)
+      return false;
+  }
+  return true;
+}
+
+void Predicate::getPaths(vector<string>* paths) const {
+  paths->clear();
+  for (size_t i = 0; i < conditions_.size(); ++i)
+    if (std::find(paths->begin(),
+                  paths->end(),
+                  conditions_[i].path) == paths->end())
+      paths->push_back(conditions_[i].path);
+}
+
+Predicate::Value Predicate::getValue(const bson_iterator* it) {
+  Value value;
+  value.type = bson_iterator_type(it);
+  value.number = 0;
+  value.data = NULL;
+  value.size = 0;
+  switch (value.type) {
+    case BSON_DOUBLE:
+      value.number = bson_iterator_double(it);
+      break;
+    case BSON_INT:
+      value.number = bson_iterator_int(it);
+      value.type = BSON_DOUBLE;
+      break;
+    case BSON_LONG:
+      value.number = bson_iterator_long(it);
+      value.type = BSON_DOUBLE;
+      break;
+    case BSON_BOOL:
+      value.number = (bson_iterator_bool(it)) ? 1 : 0;
+      break;
+    case BSON_STRING:
+      value.data = bson_iterator_string(it);
+      value.size = bson_iterator_string_len(it) - 1;
+      break;
+    default: {
+      bson_iterator next = *it;
+      bson_iterator_next(&next);
+      value.data = bson_iterator_value(it);
+      value.size = next.cur - value.data;
+      break;
+    }
+  }
+  return value;
+}
+
+bool Predicate::isEqual(const Value& value1, const Value& value2) {
+  if (value1.type != value2.type)
+    return false;
+  if (!value1.data)
+    return value1.number == value2.number;
+  return value1.size == value2.size &&
+         memcmp(value1.data, value2.data, value1.size) == 0;
+}
+
+bool Predicate::compare(const Value& value1, const Value& value2, int* order) {
+  if (value1.type != value2.type)
+    return false;
+  if (value1.type == BSON_DOUBLE) {
+    *order = (value1.number < value2.number) ? -1 :
+             (value1.number > value2.number) ? 1 : 0;
+    return value1.number == value1.number && value2.number == value2.number;
+  }
+  if (value1.type == BSON_STRING) {
+    int result = memcmp(value1.data,
+                        value2.data,
+                        std::min(value1.size, value2.size));
+    *order = (result) ? result : value1.size - value2.size;
+    return true;
+  }
+  return false;
+}
+
+bool Predicate::compileDocument(const char* query, string* error) {
+  bson_iterator it;
+  bson_iterator_from_buffer(&it, query);
+  while (bson_iterator_next(&it) != BSON_EOO) {
+    const char* key = bson_iterator_key(&it);
+    if (strcmp(key, "$and") == 0) {
+      if (bson_iterator_type(&it) != BSON_ARRAY) {
+        *error = "$and takes an array of queries.";
+        return false;
+      }
+      bson_iterator element;
+      bson_iterator_subiterator(&it, &element);
+      while (bson_iterator_next(&element) != BSON_EOO) {
+        if (bson_iterator_type(&element) != BSON_OBJECT) {
+          *error = "$and takes an array of queries.";
+          return false;
+        }
+        if (!compileDocument(bson_iterator_value(&element), error))
+          return false;
+      }
+    }
+    else if (key[0] == '$') {
+      *error = string("Unsupported operator: ") + key;
+      return false;
+    }
+    else if (!compileField(key, &it, false, error))
+      return false;
+  }
+  return true;
+}
+
+bool Predicate::compileField(const string& path,
+                             const bson_iterator* it,
+                             bool negate,
+                             string* error) {
+  // Values other than a document of operators are compared as a whole.
+  bson_iterator operation;
+  if (bson_iterator_type(it) == BSON_OBJECT) {
+    bson_iterator_subiterator(it, &operation);
+    bson_iterator first = operation;
+    if (bson_iterator_next(&first) == BSON_EOO ||
+        bson_iterator_key(&first)[0] != '$') {
+      addCondition(path, OP_EQ, negate, it);
+      return true;
+    }
+  }
+  else {
+    addCondition(path, OP_EQ, negate, it);
+    return true;
+  }
+  int num_operators = 0;
+  bson_iterator counter = operation;
+  while (bson_iterator_next(&counter) != BSON_EOO)
+    ++num_operators;
+  // The negation of a conjunction is not a conjunction.
+  if (negate && num_operators > 1) {
+    *error = "$not over several operators is not supported.";
+    return false;
+  }
+  while (bson_iterator_next(&operation) != BSON_EOO) {
+    const char* name = bson_iterator_key(&operation);
+    bson_type type = bson_iterator_type(&operation);
+    if (strcmp(name, "$gt") == 0)
+      addCondition(path, OP_GT, negate, &operation);
+    else if (strcmp(name, "$gte") == 0)
+      addCondition(path, OP_GTE, negate, &operation);
+    else if (strcmp(name, "$lt") == 0)
+      addCondition(path, OP_LT, negate, &operation);
+    else if (strcmp(name, "$lte") == 0)
+      addCondition(path, OP_LTE, negate, &operation);
+    else if (strcmp(name, "$bt") == 0) {
+      if (type != BSON_ARRAY) {
+        *error = "$bt takes an array of two values.";
+        return false;
+      }
+      addCondition(path, OP_BT, negate, &operation);
+      if (conditions_.back().values.size() != 2) {
+        *error = "$bt takes an array of two values.";
+        return false;
+      }
+    }
+    else if (strcmp(name, "$in") == 0 || strcmp(name, "$nin") == 0) {
+      if (type != BSON_ARRAY) {
+        *error = string(name) + " takes an array.";
+        return false;
+      }
+      addCondition(path, OP_IN, negate != (name[1] == 'n'), &operation);
+    }
+    else if (strcmp(name, "$exists") == 0) {
+      bool exists = (type == BSON_BOOL) ? bson_iterator_bool(&operation) :
+                                          true;
+      addCondition(path, OP_EXISTS, negate == exists, NULL);
+    }
+    else if (strcmp(name, "$begin") == 0) {
+      if (type != BSON_STRING) {
+        *error = "$begin takes a string.";
+        return false;
+      }
+      addCondition(path, OP_BEGIN, negate, &operation);
+    }
+    else if (strcmp(name, "$not") == 0) {
+      if (!compileField(path, &operation, !negate, error))
+        return false;
+    }
+    else {
+      *error = string("Unsupported operator: ") + name;
+      return false;
+    }
+  }
+  return true;
+}
+
+void Predicate::addCondition(const string& path,
+                             Operator op,
+                             bool negate,
+                             const bson_iterator* it) {
+  Condition condition;
+  condition.path = path;
+  condition.op = op;
+  condition.negate = negate;
+  if (it && (op == OP_IN || op == OP_BT)) {
+    bson_iterator element;
+    bson_iterator_subiterator(it, &element);
+    while (bson_iterator_next(&element) != BSON_EOO)
+      condition.values.push_back(getValue(&element));
+  }
+  else if (it)
+    condition.values.push_back(getValue(it));
+  conditions_.push_back(condition);
+}
+
+bool Predicate::matchValue(const Condition& condition, const Value& value) {
+  int order = 0;
+  switch (condition.op) {
+    case OP_EQ:
+      return isEqual(value, condition.values[0]);
+    case OP_GT:
+      return compare(value, condition.values[0], &order) && order > 0;
+    case OP_GTE:
+      return compare(value, condition.values[0], &order) && order >= 0;
+    case OP_LT:
+      return compare(value, condition.values[0], &order) && order < 0;
+    case OP_LTE:
+      return compare(value, condition.values[0], &order) && order <= 0;
+    case OP_BT:
+      return compare(value, condition.values[0], &order) && order >= 0 &&
+             compare(value, condition.values[1], &order) && order <= 0;
+    case OP_IN:
+      for (size_t i = 0; i < condition.values.size(); ++i)
+        if (isEqual(value, condition.values[i]))
+          return true;
+      return false;
+    case OP_BEGIN: {
+      const Value& prefix = condition.values[0];
+      return value.type == BSON_STRING &&
+             value.size >= prefix.size &&
+             memcmp(value.data, prefix.data, prefix.size) == 0;
+    }
+    case OP_EXISTS:
+      return true;
+  }
+  return false;
+}
+
+bool Predicate::matchElement(const Condition& condition,
+                             const bson_iterator* it) {
+  if (matchValue(condition, getValue(it)))
+    return true;
+  if (bson_iterator_type(it) != BSON_ARRAY)
+    return false;
+  bson_iterator element;
+  bson_iterator_subiterator(it, &element);
+  while (bson_iterator_next(&element) != BSON_EOO)
+    if (matchValue(condition, getValue(&element)))
+      return true;
+  return false;
+}
+
+} // namespace bsonmex
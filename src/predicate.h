@@ -0,0 +1,104 @@
+/// Query predicates evaluated over raw BSON.
+///
+/// A subset of the EJDB query language is compiled once and matched
+/// against encoded documents without the database, so that documents can be
+/// filtered in worker threads. The classes do not call the Matlab API.
+
+#ifndef __PREDICATE_H__
+#define __PREDICATE_H__
+
+#include <bson.h>
+#include <string>
+#include <vector>
+
+namespace bsonmex {
+
+/// Compiled conjunction of field conditions.
+///
+/// Supported are equality {path: value}, $gt, $gte, $lt, $lte, $bt, $in,
+/// $nin, $exists, $begin, $not and $and. Numbers compare by value
+/// regardless of their BSON type, and strings by bytes. A condition on an
+/// array field matches when any element matches.
+class Predicate {
+public:
+  /// Empty predicate matching every document.
+  Predicate();
+  /// Compile a query document.
+  /// @param query BSON query document. Must outlive the predicate.
+  /// @param error message set when the query is not supported.
+  /// @return true if success.
+  bool compile(const char* query, std::string* error);
+  /// Check if a document matches.
+  /// @param document BSON document.
+  bool match(const char* document) const;
+  /// Dotted paths of the fields in the conditions.
+  void getPaths(std::vector<std::string>* paths) const;
+
+private:
+  /// Comparison of a condition.
+  enum Operator {
+    OP_EQ,
+    OP_GT,
+    OP_GTE,
+    OP_LT,
+    OP_LTE,
+    OP_BT,
+    OP_IN,
+    OP_EXISTS,
+    OP_BEGIN
+  };
+  /// Decoded BSON value.
+  struct Value {
+    /// BSON type. Numbers are normalized to BSON_DOUBLE.
+    bson_type type;
+    /// Number, or 0 and 1 for booleans.
+    double number;
+    /// String contents or encoded value, or NULL for numbers and booleans.
+    const char* data;
+    /// Size of the data.
+    int size;
+  };
+  /// Condition on a field.
+  struct Condition {
+    /// Dotted path to the field.
+    std::string path;
+    /// Comparison.
+    Operator op;
+    /// Whether the result is negated.
+    bool negate;
+    /// Operands.
+    std::vector<Value> values;
+  };
+  /// Decode the value at the iterator.
+  static Value getValue(const bson_iterator* it);
+  /// Check if two values are equal.
+  static bool isEqual(const Value& value1, const Value& value2);
+  /// Compare two numbers or two strings.
+  /// @return false if the values are not comparable.
+  static bool compare(const Value& value1, const Value& value2, int* order);
+  /// Compile a query document into the conditions.
+  bool compileDocument(const char* query, std::string* error);
+  /// Compile the conditions of a field.
+  bool compileField(const std::string& path,
+                    const bson_iterator* it,
+                    bool negate,
+                    std::string* error);
+  /// Add a condition.
+  void addCondition(const std::string& path,
+                    Operator op,
+                    bool negate,
+                    const bson_iterator* it);
+  /// Check if a value satisfies the comparison of a condition.
+  static bool matchValue(const Condition& condition, const Value& value);
+  /// Check if the element at the iterator satisfies a condition, trying
+  /// array elements.
+  static bool matchElement(const Condition& condition,
+                           const bson_iterator* it);
+
+  /// Conditions that must all hold.
+  std::vector<Condition> conditions_;
+};
+
+} // namespace bsonmex
+
+#endif // __PREDICATE_H__
@@ -0,0 +1,116 @@
+/// LRU cache of converted results.
+
+#include "resultcache.h"
+#include <mex.h>
+
+using std::string;
+
+namespace {
+
+/// Fixed overhead of an mxArray header.
+const size_t kArrayOverhead = 64;
+
+} // namespace
+
+namespace ejdbmex {
+
+ResultCache::ResultCache(size_t budget) :
+    bytes_(0), budget_(budget), hits_(0), misses_(0) {}
+
+ResultCache::~ResultCache() {
+  clear();
+}
+
+void ResultCache::setBudget(size_t budget) {
+  budget_ = budget;
+  evict();
+}
+
+mxArray* ResultCache::get(const string& key, uint64_t generation) {
+  Entries::iterator entry = entries_.find(key);
+  if (entry == entries_.end()) {
+    ++misses_;
+    return NULL;
+  }
+  if (entry->second.generation != generation) {
+    erase(entry);
+    ++misses_;
+    return NULL;
+  }
+  ++hits_;
+  order_.splice(order_.begin(), order_, entry->second.position);
+  return mxDuplicateArray(entry->second.value);
+}
+
+void ResultCache::put(const string& key,
+                      uint64_t generation,
+                      const mxArray* value) {
+  size_t bytes = getSize(value) + key.size();
+  if (!value || bytes > budget_)
+    return;
+  erase(key);
+  mxArray* copy = mxDuplicateArray(value);
+  if (!copy)
+    return;
+  mexMakeArrayPersistent(copy);
+  order_.push_front(key);
+  Entry entry = {copy, bytes, generation, order_.begin()};
+  entries_[key] = entry;
+  bytes_ += bytes;
+  evict();
+}
+
+void ResultCache::erase(const string& key) {
+  Entries::iterator entry = entries_.find(key);
+  if (entry != entries_.end())
+    erase(entry);
+}
+
+void ResultCache::erasePrefix(const string& prefix) {
+  Entries::iterator entry = entries_.lower_bound(prefix);
+  while (entry != entries_.end() &&
+         entry->first.compare(0, prefix.size(), prefix) == 0)
+    erase(entry++);
+}
+
+void ResultCache::clear() {
+  while (!entries_.empty())
+    erase(entries_.begin());
+}
+
+size_t ResultCache::getSize(const mxArray* value) {
+  if (!value)
+    return 0;
+  size_t bytes = kArrayOverhead;
+  size_t num_elements = mxGetNumberOfElements(value);
+  if (mxIsCell(value)) {
+    for (size_t i = 0; i < num_elements; ++i)
+      bytes += getSize(mxGetCell(value, i));
+  }
+  else if (mxIsStruct(value)) {
+    int num_fields = mxGetNumberOfFields(value);
+    for (size_t i = 0; i < num_elements; ++i)
+      for (int j = 0; j < num_fields; ++j)
+        bytes += getSize(mxGetFieldByNumber(value, i, j));
+  }
+  else if (mxIsSparse(value))
+    bytes += mxGetNzmax(value) * (mxGetElementSize(value) + sizeof(mwIndex));
+  else
+    bytes += num_elements * mxGetElementSize(value) *
+             (mxIsComplex(value) ? 2 : 1);
+  return bytes;
+}
+
+void ResultCache::erase(Entries::iterator entry) {
+  mxDestroyArray(entry->second.value);
+  bytes_ -= entry->second.bytes;
+  order_.erase(entry->second.position);
+  entries_.erase(entry);
+}
+
+void ResultCache::evict() {
+  while (bytes_ > budget_ && !order_.empty())
+    erase(entries_.find(order_.back()));
+}
+
+} // namespace ejdbmex
@@ -0,0 +1,96 @@
+/// LRU cache of converted results.
+
+#ifndef __RESULTCACHE_H__
+#define __RESULTCACHE_H__
+
+#include <matrix.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <list>
+#include <map>
+#include <string>
+
+namespace ejdbmex {
+
+/// Least-recently-used cache of persistent mxArray values in a byte budget.
+/// Each entry records the generation of its source, and an entry of an
+/// older generation is stale. Call only from the Matlab thread.
+class ResultCache {
+public:
+  /// Create an empty cache.
+  /// @param budget maximum number of bytes of the cached values.
+  explicit ResultCache(size_t budget = 0);
+  /// Destructor. Destroys the cached values.
+  virtual ~ResultCache();
+  /// Change the byte budget, evicting entries over the budget.
+  void setBudget(size_t budget);
+  /// Byte budget.
+  size_t budget() const { return budget_; }
+  /// Bytes of the cached values.
+  size_t bytes() const { return bytes_; }
+  /// Number of entries.
+  size_t size() const { return entries_.size(); }
+  /// Number of lookups that found a value.
+  double hits() const { return hits_; }
+  /// Number of lookups that missed.
+  double misses() const { return misses_; }
+  /// Look up a value.
+  /// @param key cache key.
+  /// @param generation current generation of the source.
+  /// @return a new copy of the value, or NULL if missing or stale.
+  mxArray* get(const std::string& key, uint64_t generation);
+  /// Store a copy of a value. Values larger than the budget are skipped.
+  /// @param key cache key.
+  /// @param generation generation of the source of the value.
+  /// @param value value to copy.
+  void put(const std::string& key, uint64_t generation, const mxArray* value);
+  /// Remove a value.
+  void erase(const std::string& key);
+  /// Remove the values of keys starting with the prefix.
+  void erasePrefix(const std::string& prefix);
+  /// Remove all values.
+  void clear();
+  /// Approximate bytes of an mxArray, including nested values.
+  static size_t getSize(const mxArray* value);
+
+private:
+  /// Keys from the most recently used.
+  typedef std::list<std::string> Order;
+  /// Cached value.
+  struct Entry {
+    /// Persistent value.
+    mxArray* value;
+    /// Bytes of the value.
+    size_t bytes;
+    /// Generation of the source.
+    uint64_t generation;
+    /// Position in the order.
+    Order::iterator position;
+  };
+  typedef std::map<std::string, Entry> Entries;
+  /// Disabled copy constructor.
+  ResultCache(const ResultCache&);
+  /// Disabled assignment.
+  ResultCache& operator=(const ResultCache&);
+  /// Remove an entry.
+  void erase(Entries::iterator entry);
+  /// Evict the least recently used entries over the budget.
+  void evict();
+
+  /// Entries by key.
+  Entries entries_;
+  /// Keys from the most recently used.
+  Order order_;
+  /// Bytes of the cached values.
+  size_t bytes_;
+  /// Maximum bytes of the cached values.
+  size_t budget_;
+  /// Number of lookups that found a value.
+  double hits_;
+  /// Number of lookups that missed.
+  double misses_;
+};
+
+} // namespace ejdbmex
+
+#endif // __RESULTCACHE_H__
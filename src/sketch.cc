@@ -0,0 +1,301 @@
+/// Mergeable approximate statistics sketches.
+
+#include "sketch.h"
+#include <limits>
+#include <math.h>
+#include <string.h>
+
+using std::string;
+
+namespace {
+
+/// Version of the serialized format.
+const char kSketchVersion = 1;
+/// Size of the serialized header: type, version and two reserved bytes.
+const size_t kHeaderSize = 4;
+/// Magnitude below which values are counted as zero.
+const double kMinIndexableValue = 1e-300;
+
+/// Append the header of a serialized sketch.
+void AppendHeader(bsonmex::SketchType type, char parameter, string* output) {
+  char header[kHeaderSize] = {static_cast<char>(type),
+                              kSketchVersion,
+                              parameter,
+                              0};
+  output->append(header, kHeaderSize);
+}
+
+/// Append a value in the host byte order.
+template <typename T>
+void AppendValue(const T& value, string* output) {
+  output->append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+/// Read a value in the host byte order, advancing the data.
+template <typename T>
+bool ReadValue(const char** data, const char* end, T* value) {
+  if (static_cast<size_t>(end - *data) < sizeof(T))
+    return false;
+  memcpy(value, *data, sizeof(T));
+  *data += sizeof(T);
+  return true;
+}
+
+/// Read serialized bins.
+bool ReadBins(const char** data,
+              const char* end,
+              int32_t size,
+              std::map<int, double>* bins) {
+  bins->clear();
+  for (int32_t i = 0; i < size; ++i) {
+    int32_t index;
+    double count;
+    if (!ReadValue(data, end, &index) || !ReadValue(data, end, &count))
+      return false;
+    (*bins)[index] += count;
+  }
+  return true;
+}
+
+} // namespace
+
+namespace bsonmex {
+
+SketchType GetSketchType(const char* data, size_t size) {
+  if (size < kHeaderSize || data[1] != kSketchVersion)
+    return SKETCH_INVALID;
+  if (data[0] == SKETCH_HLL)
+    return SKETCH_HLL;
+  if (data[0] == SKETCH_QUANTILES)
+    return SKETCH_QUANTILES;
+  return SKETCH_INVALID;
+}
+
+HyperLogLog::HyperLogLog(int precision) :
+    precision_(precision), registers_(static_cast<size_t>(1) << precision) {}
+
+uint64_t HyperLogLog::hash(const void* data, size_t size) {
+  // FNV-1a followed by the splitmix64 finalizer to spread the bits.
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  uint64_t value = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; ++i)
+    value = (value ^ bytes[i]) * 1099511628211ULL;
+  value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+  return value ^ (value >> 31);
+}
+
+void HyperLogLog::add(uint64_t hash) {
+  size_t index = hash >> (64 - precision_);
+  uint64_t remaining = hash << precision_;
+  uint8_t rank = 1;
+  while (rank <= 64 - precision_ && !(remaining & (1ULL << 63))) {
+    remaining <<= 1;
+    ++rank;
+  }
+  if (registers_[index] < rank)
+    registers_[index] = rank;
+}
+
+bool HyperLogLog::merge(const HyperLogLog& other) {
+  if (precision_ != other.precision_)
+    return false;
+  for (size_t i = 0; i < registers_.size(); ++i)
+    if (registers_[i] < other.registers_[i])
+      registers_[i] = other.registers_[i];
+  return true;
+}
+
+double HyperLogLog::estimate() const {
+  double size = registers_.size();
+  double sum = 0;
+  int num_zeros = 0;
+  for (size_t i = 0; i < registers_.size(); ++i) {
+    sum += ldexp(1.0, -registers_[i]);
+    num_zeros += (registers_[i] == 0);
+  }
+  double alpha = 0.7213 / (1 + 1.079 / size);
+  double estimate = alpha * size * size / sum;
+  // Linear counting is more accurate for small cardinalities.
+  if (estimate <= 2.5 * size && num_zeros > 0)
+    estimate = size * log(size / num_zeros);
+  return estimate;
+}
+
+void HyperLogLog::serialize(string* output) const {
+  output->clear();
+  AppendHeader(SKETCH_HLL, static_cast<char>(precision_), output);
+  output->append(reinterpret_cast<const char*>(&registers_[0]),
+                 registers_.size());
+}
+
+bool HyperLogLog::deserialize(const char* data, size_t size) {
+  if (GetSketchType(data, size) != SKETCH_HLL)
+    return false;
+  int precision = data[2];
+  if (precision < 4 || precision > 18 ||
+      size != kHeaderSize + (static_cast<size_t>(1) << precision))
+    return false;
+  precision_ = precision;
+  registers_.assign(data + kHeaderSize, data + size);
+  return true;
+}
+
+QuantileSketch::QuantileSketch(double accuracy, int max_bins) :
+    accuracy_(accuracy),
+    gamma_((1 + accuracy) / (1 - accuracy)),
+    max_bins_(max_bins),
+    zero_count_(0),
+    count_(0),
+    min_(0),
+    max_(0) {}
+
+int QuantileSketch::index(double magnitude) const {
+  return static_cast<int>(ceil(log(magnitude) / log(gamma_)));
+}
+
+double QuantileSketch::value(int index) const {
+  return 2 * pow(gamma_, index) / (gamma_ + 1);
+}
+
+void QuantileSketch::collapse(Bins* bins) {
+  while (bins->size() > static_cast<size_t>(max_bins_)) {
+    Bins::iterator lowest = bins->begin();
+    Bins::iterator next = lowest;
+    ++next;
+    next->second += lowest->second;
+    bins->erase(lowest);
+  }
+}
+
+void QuantileSketch::add(double value) {
+  if (value != value)
+    return;
+  if (count_ == 0 || value < min_)
+    min_ = value;
+  if (count_ == 0 || value > max_)
+    max_ = value;
+  ++count_;
+  if (fabs(value) < kMinIndexableValue)
+    ++zero_count_;
+  else {
+    Bins* bins = (value > 0) ? &positive_ : &negative_;
+    ++(*bins)[index(fabs(value))];
+    collapse(bins);
+  }
+}
+
+bool QuantileSketch::merge(const QuantileSketch& other) {
+  if (accuracy_ != other.accuracy_)
+    return false;
+  if (other.count_ == 0)
+    return true;
+  if (count_ == 0 || other.min_ < min_)
+    min_ = other.min_;
+  if (count_ == 0 || other.max_ > max_)
+    max_ = other.max_;
+  count_ += other.count_;
+  zero_count_ += other.zero_count_;
+  for (Bins::const_iterator it = other.positive_.begin();
+       it != other.positive_.end();
+       ++it)
+    positive_[it->first] += it->second;
+  for (Bins::const_iterator it = other.negative_.begin();
+       it != other.negative_.end();
+       ++it)
+    negative_[it->first] += it->second;
+  collapse(&positive_);
+  collapse(&negative_);
+  return true;
+}
+
+double QuantileSketch::quantile(double probability) const {
+  if (count_ == 0 || probability != probability)
+    return std::numeric_limits<double>::quiet_NaN();
+  if (probability <= 0)
+    return min_;
+  if (probability >= 1)
+    return max_;
+  double rank = probability * (count_ - 1);
+  double estimate = max_;
+  double cumulative = 0;
+  bool found = false;
+  // Negative values from the largest magnitude.
+  for (Bins::const_reverse_iterator it = negative_.rbegin();
+       !found && it != negative_.rend();
+       ++it) {
+    cumulative += it->second;
+    if (cumulative > rank) {
+      estimate = -value(it->first);
+      found = true;
+    }
+  }
+  if (!found) {
+    cumulative += zero_count_;
+    if (cumulative > rank) {
+      estimate = 0;
+      found = true;
+    }
+  }
+  for (Bins::const_iterator it = positive_.begin();
+       !found && it != positive_.end();
+       ++it) {
+    cumulative += it->second;
+    if (cumulative > rank) {
+      estimate = value(it->first);
+      found = true;
+    }
+  }
+  if (estimate < min_)
+    return min_;
+  if (estimate > max_)
+    return max_;
+  return estimate;
+}
+
+void QuantileSketch::serialize(string* output) const {
+  output->clear();
+  AppendHeader(SKETCH_QUANTILES, 0, output);
+  AppendValue(accuracy_, output);
+  AppendValue(static_cast<int32_t>(max_bins_), output);
+  AppendValue(zero_count_, output);
+  AppendValue(count_, output);
+  AppendValue(min_, output);
+  AppendValue(max_, output);
+  const Bins* bins[] = {&positive_, &negative_};
+  for (int i = 0; i < 2; ++i) {
+    AppendValue(static_cast<int32_t>(bins[i]->size()), output);
+    for (Bins::const_iterator it = bins[i]->begin();
+         it != bins[i]->end();
+         ++it) {
+      AppendValue(static_cast<int32_t>(it->first), output);
+      AppendValue(it->second, output);
+    }
+  }
+}
+
+bool QuantileSketch::deserialize(const char* data, size_t size) {
+  if (GetSketchType(data, size) != SKETCH_QUANTILES)
+    return false;
+  const char* end = data + size;
+  data += kHeaderSize;
+  int32_t max_bins, num_bins;
+  if (!ReadValue(&data, end, &accuracy_) ||
+      !(accuracy_ > 0 && accuracy_ < 1) ||
+      !ReadValue(&data, end, &max_bins) ||
+      max_bins < 1 ||
+      !ReadValue(&data, end, &zero_count_) ||
+      !ReadValue(&data, end, &count_) ||
+      !ReadValue(&data, end, &min_) ||
+      !ReadValue(&data, end, &max_) ||
+      !ReadValue(&data, end, &num_bins) ||
+      !ReadBins(&data, end, num_bins, &positive_) ||
+      !ReadValue(&data, end, &num_bins) ||
+      !ReadBins(&data, end, num_bins, &negative_))
+    return false;
+  gamma_ = (1 + accuracy_) / (1 - accuracy_);
+  max_bins_ = max_bins;
+  return data == end;
+}
+
+} // namespace bsonmex
@@ -0,0 +1,116 @@
+/// Mergeable approximate statistics sketches.
+///
+/// Sketches use bounded memory regardless of the number of values, and
+/// serialize to bytes in the host byte order so that sketches of different
+/// queries can be merged later. The classes do not call the Matlab API.
+
+#ifndef __SKETCH_H__
+#define __SKETCH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace bsonmex {
+
+/// Type of a serialized sketch.
+enum SketchType {
+  SKETCH_INVALID = 0,
+  SKETCH_HLL = 'H',
+  SKETCH_QUANTILES = 'Q'
+};
+
+/// Get the type of a serialized sketch.
+/// @param data serialized sketch.
+/// @param size size of the data.
+/// @return type of the sketch, or SKETCH_INVALID.
+SketchType GetSketchType(const char* data, size_t size);
+
+/// HyperLogLog sketch to estimate the number of distinct values.
+class HyperLogLog {
+public:
+  /// Create an empty sketch of 2^precision one-byte registers.
+  /// @param precision number of index bits between 4 and 18.
+  explicit HyperLogLog(int precision = 14);
+  /// Hash bytes of a value to add.
+  static uint64_t hash(const void* data, size_t size);
+  /// Add a hashed value.
+  void add(uint64_t hash);
+  /// Merge another sketch of the same precision.
+  /// @return false if the precision differs.
+  bool merge(const HyperLogLog& other);
+  /// Estimated number of distinct values.
+  double estimate() const;
+  /// Serialize the sketch.
+  void serialize(std::string* output) const;
+  /// Restore a serialized sketch.
+  /// @return false if the data is not a valid sketch.
+  bool deserialize(const char* data, size_t size);
+
+private:
+  /// Number of index bits.
+  int precision_;
+  /// Maximum rank observed for each index.
+  std::vector<uint8_t> registers_;
+};
+
+/// Quantile sketch with relative accuracy (DDSketch).
+/// Values are counted in logarithmic bins, so that every quantile is
+/// estimated within the relative accuracy. When a sign has more than
+/// max_bins bins, bins of the smallest magnitude are collapsed.
+class QuantileSketch {
+public:
+  /// Create an empty sketch.
+  /// @param accuracy relative accuracy in (0, 1).
+  /// @param max_bins maximum number of bins of each sign.
+  explicit QuantileSketch(double accuracy = 0.01, int max_bins = 2048);
+  /// Add a value. NaN is ignored.
+  void add(double value);
+  /// Merge another sketch of the same accuracy.
+  /// @return false if the accuracy differs.
+  bool merge(const QuantileSketch& other);
+  /// Number of values.
+  double count() const { return count_; }
+  /// Estimated value at the probability in [0, 1], or NaN if empty.
+  double quantile(double probability) const;
+  /// Serialize the sketch.
+  void serialize(std::string* output) const;
+  /// Restore a serialized sketch.
+  /// @return false if the data is not a valid sketch.
+  bool deserialize(const char* data, size_t size);
+
+private:
+  /// Bins of logarithmic index to count.
+  typedef std::map<int, double> Bins;
+  /// Bin index of a positive magnitude.
+  int index(double magnitude) const;
+  /// Representative magnitude of the bin index.
+  double value(int index) const;
+  /// Collapse bins of the smallest magnitude to keep max_bins_.
+  void collapse(Bins* bins);
+
+  /// Relative accuracy.
+  double accuracy_;
+  /// Base of the logarithmic bins.
+  double gamma_;
+  /// Maximum number of bins of each sign.
+  int max_bins_;
+  /// Bins of positive values.
+  Bins positive_;
+  /// Bins of negative values by magnitude.
+  Bins negative_;
+  /// Number of values too small to index.
+  double zero_count_;
+  /// Number of values.
+  double count_;
+  /// Minimum value.
+  double min_;
+  /// Maximum value.
+  double max_;
+};
+
+} // namespace bsonmex
+
+#endif // __SKETCH_H__
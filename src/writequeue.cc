@@ -0,0 +1,259 @@
+/// Write-behind queue of EJDB writes.
+
+#include "writequeue.h"
+#include "ejdb.h"
+#include <sched.h>
+#include <algorithm>
+
+using std::string;
+using std::vector;
+
+namespace {
+
+/// Maximum number of writes applied in a batch.
+const size_t kMaxBatchSize = 1024;
+
+} // namespace
+
+namespace ejdbmex {
+
+WriteQueue::WriteQueue() :
+    database_(NULL),
+    head_(&stub_),
+    tail_(&stub_),
+    pushed_(0),
+    applied_(0),
+    idle_(0),
+    stopping_(false),
+    running_(false) {
+  stub_.next = NULL;
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&pushed_cond_, NULL);
+  pthread_cond_init(&applied_cond_, NULL);
+}
+
+WriteQueue::~WriteQueue() {
+  stop();
+  pthread_cond_destroy(&applied_cond_);
+  pthread_cond_destroy(&pushed_cond_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+bool WriteQueue::start(EJDB* database) {
+  if (running_)
+    return false;
+  database_ = database;
+  stopping_ = false;
+  running_ = pthread_create(&thread_, NULL, run, this) == 0;
+  return running_;
+}
+
+void WriteQueue::stop() {
+  if (!running_)
+    return;
+  pthread_mutex_lock(&mutex_);
+  stopping_ = true;
+  pthread_cond_signal(&pushed_cond_);
+  pthread_mutex_unlock(&mutex_);
+  pthread_join(thread_, NULL);
+  running_ = false;
+}
+
+void WriteQueue::save(EJCOLL* collection, bson* value) {
+  Node* node = new Node;
+  node->type = WRITE_SAVE;
+  node->collection = collection;
+  node->value = *value;
+  node->with_hints = false;
+  push(node);
+}
+
+void WriteQueue::update(EJCOLL* collection, bson* query, bson* hints) {
+  Node* node = new Node;
+  node->type = WRITE_UPDATE;
+  node->collection = collection;
+  node->value = *query;
+  node->with_hints = hints != NULL;
+  if (hints)
+    node->hints = *hints;
+  push(node);
+}
+
+void WriteQueue::remove(EJCOLL* collection, const bson_oid_t* object_id) {
+  Node* node = new Node;
+  node->type = WRITE_REMOVE;
+  node->collection = collection;
+  node->object_id = *object_id;
+  node->with_hints = false;
+  push(node);
+}
+
+void WriteQueue::drain() {
+  pthread_mutex_lock(&mutex_);
+  while (running_ && applied_ != pushed_)
+    pthread_cond_wait(&applied_cond_, &mutex_);
+  pthread_mutex_unlock(&mutex_);
+}
+
+bool WriteQueue::isIdle() {
+  pthread_mutex_lock(&mutex_);
+  bool idle = applied_ == pushed_;
+  pthread_mutex_unlock(&mutex_);
+  return idle;
+}
+
+bool WriteQueue::takeError(string* message) {
+  pthread_mutex_lock(&mutex_);
+  bool failed = !error_.empty();
+  message->swap(error_);
+  error_.clear();
+  pthread_mutex_unlock(&mutex_);
+  return failed;
+}
+
+void WriteQueue::deleteNode(Node* node) {
+  if (node->type != WRITE_REMOVE)
+    bson_destroy(&node->value);
+  if (node->with_hints)
+    bson_destroy(&node->hints);
+  delete node;
+}
+
+void WriteQueue::link(Node* node) {
+  node->next = NULL;
+  __sync_synchronize();
+  Node* previous = __sync_lock_test_and_set(&head_, node);
+  previous->next = node;
+}
+
+void WriteQueue::push(Node* node) {
+  __sync_fetch_and_add(&pushed_, 1);
+  link(node);
+  // Pairs with the barrier in run(), so that either the writer sees the
+  // write or this sees the writer idle.
+  __sync_synchronize();
+  if (idle_) {
+    pthread_mutex_lock(&mutex_);
+    pthread_cond_signal(&pushed_cond_);
+    pthread_mutex_unlock(&mutex_);
+  }
+}
+
+WriteQueue::Node* WriteQueue::pop() {
+  Node* tail = tail_;
+  Node* next = tail->next;
+  if (tail == &stub_) {
+    if (!next)
+      return NULL;
+    tail_ = next;
+    tail = next;
+    next = next->next;
+  }
+  if (next) {
+    tail_ = next;
+    return tail;
+  }
+  // The tail is the last node unless a producer is linking another one.
+  if (tail != head_)
+    return NULL;
+  link(&stub_);
+  next = tail->next;
+  if (next) {
+    tail_ = next;
+    return tail;
+  }
+  return NULL;
+}
+
+void WriteQueue::apply(const vector<Node*>& batch) {
+  vector<EJCOLL*> collections;
+  for (size_t i = 0; i < batch.size(); ++i) {
+    Node* node = batch[i];
+    if (std::find(collections.begin(),
+                  collections.end(),
+                  node->collection) == collections.end()) {
+      if (!ejdbtranbegin(node->collection)) {
+        setError(string("Failed to begin a transaction: ") +
+                 ejdberrmsg(ejdbecode(database_)));
+        continue;
+      }
+      collections.push_back(node->collection);
+    }
+    bool success = true;
+    if (node->type == WRITE_SAVE) {
+      bson_oid_t object_id;
+      success = ejdbsavebson(node->collection, &node->value, &object_id);
+    }
+    else if (node->type == WRITE_UPDATE) {
+      // ejdbupdate() reports errors only through the error code, which is
+      // kept from earlier errors, so a failure is a new code.
+      int previous_code = ejdbecode(database_);
+      ejdbupdate(node->collection,
+                 &node->value,
+                 NULL,
+                 0,
+                 (node->with_hints) ? &node->hints : NULL,
+                 NULL);
+      int code = ejdbecode(database_);
+      success = code == TCESUCCESS || code == previous_code;
+    }
+    else
+      success = ejdbrmbson(node->collection, &node->object_id);
+    if (!success)
+      setError(string("Failed to write: ") +
+               ejdberrmsg(ejdbecode(database_)));
+  }
+  for (size_t i = 0; i < collections.size(); ++i)
+    if (!ejdbtrancommit(collections[i]))
+      setError(string("Failed to commit: ") +
+               ejdberrmsg(ejdbecode(database_)));
+}
+
+void WriteQueue::setError(const string& message) {
+  pthread_mutex_lock(&mutex_);
+  if (error_.empty())
+    error_ = message;
+  pthread_mutex_unlock(&mutex_);
+}
+
+void* WriteQueue::run(void* value) {
+  WriteQueue* queue = static_cast<WriteQueue*>(value);
+  vector<Node*> batch;
+  while (true) {
+    batch.clear();
+    Node* node = NULL;
+    while (batch.size() < kMaxBatchSize && (node = queue->pop()) != NULL)
+      batch.push_back(node);
+    if (!batch.empty()) {
+      queue->apply(batch);
+      for (size_t i = 0; i < batch.size(); ++i)
+        deleteNode(batch[i]);
+      pthread_mutex_lock(&queue->mutex_);
+      queue->applied_ += batch.size();
+      pthread_cond_broadcast(&queue->applied_cond_);
+      pthread_mutex_unlock(&queue->mutex_);
+      continue;
+    }
+    pthread_mutex_lock(&queue->mutex_);
+    bool linking = queue->applied_ != queue->pushed_;
+    if (!linking) {
+      if (queue->stopping_) {
+        pthread_mutex_unlock(&queue->mutex_);
+        break;
+      }
+      queue->idle_ = 1;
+      __sync_synchronize();
+      if (queue->applied_ == queue->pushed_)
+        pthread_cond_wait(&queue->pushed_cond_, &queue->mutex_);
+      queue->idle_ = 0;
+    }
+    pthread_mutex_unlock(&queue->mutex_);
+    // A producer is between counting and linking its write. Let it run
+    // instead of spinning on the half-linked queue.
+    if (linking)
+      sched_yield();
+  }
+  return NULL;
+}
+
+} // namespace ejdbmex
@@ -0,0 +1,135 @@
+/// Write-behind queue of EJDB writes.
+///
+/// Writes are pushed to a lock-free multiple-producer single-consumer queue
+/// and applied in order by a writer thread, which does not call the Matlab
+/// API.
+
+#ifndef __WRITEQUEUE_H__
+#define __WRITEQUEUE_H__
+
+#include <bson.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+/// Forward declarations.
+struct EJDB;
+struct EJCOLL;
+
+namespace ejdbmex {
+
+/// Queue of writes applied by a background thread.
+/// Each drained batch is applied in one transaction per collection. The
+/// first failure is kept until taken by takeError().
+class WriteQueue {
+public:
+  /// Empty constructor.
+  WriteQueue();
+  /// Destructor. Applies the pending writes and stops the thread.
+  virtual ~WriteQueue();
+  /// Start the writer thread.
+  /// @param database database to write. Must outlive the queue.
+  /// @return true if success.
+  bool start(EJDB* database);
+  /// Apply the pending writes and stop the writer thread.
+  void stop();
+  /// Queue saving a document.
+  /// @param collection collection to save to.
+  /// @param value finished bson document with _id. The queue takes the
+  ///              ownership.
+  void save(EJCOLL* collection, bson* value);
+  /// Queue an update query.
+  /// @param collection collection to update.
+  /// @param query bson update query. The queue takes the ownership.
+  /// @param hints bson query hint object, or NULL. The queue takes the
+  ///              ownership.
+  void update(EJCOLL* collection, bson* query, bson* hints);
+  /// Queue removing a document.
+  /// @param collection collection to remove from.
+  /// @param object_id object id to be removed.
+  void remove(EJCOLL* collection, const bson_oid_t* object_id);
+  /// Wait until the queued writes are applied.
+  void drain();
+  /// Check if all the queued writes are applied.
+  bool isIdle();
+  /// Take the first error since the last call.
+  /// @param message error message.
+  /// @return true if there was an error.
+  bool takeError(std::string* message);
+
+private:
+  /// Kind of a queued write.
+  enum WriteType {
+    WRITE_SAVE,
+    WRITE_UPDATE,
+    WRITE_REMOVE
+  };
+  /// Queued write.
+  struct Node {
+    /// Next node toward the head.
+    Node* volatile next;
+    /// Kind of the write.
+    WriteType type;
+    /// Collection to write.
+    EJCOLL* collection;
+    /// Document to save, or update query.
+    bson value;
+    /// Update hints.
+    bson hints;
+    /// Whether hints are given.
+    bool with_hints;
+    /// Object id to remove.
+    bson_oid_t object_id;
+  };
+  /// Disabled copy constructor.
+  WriteQueue(const WriteQueue&);
+  /// Disabled assignment.
+  WriteQueue& operator=(const WriteQueue&);
+  /// Release a node.
+  static void deleteNode(Node* node);
+  /// Link a node at the head. Safe to call from multiple threads.
+  void link(Node* node);
+  /// Push a node and wake the writer. Safe to call from multiple threads.
+  void push(Node* node);
+  /// Pop the oldest node, or NULL. Called in the writer thread only.
+  Node* pop();
+  /// Apply a batch of writes.
+  void apply(const std::vector<Node*>& batch);
+  /// Record an error unless one is kept.
+  void setError(const std::string& message);
+  /// Thread entry point.
+  static void* run(void* queue);
+
+  /// Database to write.
+  EJDB* database_;
+  /// Most recently pushed node.
+  Node* volatile head_;
+  /// Oldest node, owned by the writer.
+  Node* tail_;
+  /// Placeholder node keeping the queue non-empty.
+  Node stub_;
+  /// Number of pushed writes.
+  volatile long pushed_;
+  /// Number of applied writes. Guarded by the mutex.
+  long applied_;
+  /// Whether the writer waits for writes.
+  volatile int idle_;
+  /// Whether the writer is to stop. Guarded by the mutex.
+  bool stopping_;
+  /// Whether the writer thread runs.
+  bool running_;
+  /// Writer thread.
+  pthread_t thread_;
+  /// Lock of the writer state.
+  pthread_mutex_t mutex_;
+  /// Signaled when writes are pushed to the idle writer.
+  pthread_cond_t pushed_cond_;
+  /// Signaled when writes are applied.
+  pthread_cond_t applied_cond_;
+  /// First error message. Guarded by the mutex.
+  std::string error_;
+};
+
+} // namespace ejdbmex
+
+#endif // __WRITEQUEUE_H__
@@ -14,6 +14,9 @@ function testBSON
     int32(1:5), ...
     int64(1:5), ...
     true(1, 4), ...
+    (1:150) / 3, ...
+    int32(1:150), ...
+    rand(1, 12) > 0.5, ...
     bson.date('2009-01-01'), ...
     {1, true, 'foo'}, ...
     struct('a', 1, 'b', 2, 'c', 3), ...
@@ -29,4 +32,54 @@ function testBSON
     disp(value2);
   end
 
+  bson_value = bson.encode(struct('a', struct('b', 1), 'c', {{'x', 'y'}}));
+  assert(bson.get(bson_value, 'a.b') == 1);
+  assert(strcmp(bson.get(bson_value, 'c.1'), 'y'));
+  handle = bson.lazy(bson_value);
+  assert(handle.a.b == 1);
+  bson_value = bson.set(bson_value, 'a.b', 'foo');
+  assert(strcmp(bson.get(bson_value, 'a.b'), 'foo'));
+  bson_value = bson.set(bson_value, 'c.2', 'z');
+  assert(strcmp(bson.get(bson_value, 'c.2'), 'z'));
+  bson_value = bson.unset(bson_value, 'c');
+  assert(~isfield(bson.decode(bson_value), 'c'));
+
+  [bson_stream, offsets] = bson.encodeStream(struct('a', {1, 2}, 'b', {'x', 'y'}));
+  assert(numel(offsets) == 2 && offsets(1) == 0);
+  values = bson.decodeStream(bson_stream);
+  assert(values(2).a == 2);
+  columns = bson.decodeStream(bson_stream, 'COLUMNAR', true);
+  assert(isequal(columns.a, [1; 2]));
+  assert(isequal(bson.pluck(bson_stream, 'a'), [1; 2]));
+  assert(isequal(bson.pluck(bson_stream, 'b'), {'x'; 'y'}));
+
+  filename = [tempname, '.bson'];
+  stream = bson.openStream(filename, 'WRITE');
+  bson.writeStream(stream, struct('a', {1, 2, 3}));
+  bson.closeStream(stream);
+  stream = bson.openStream(filename);
+  values = bson.readStream(stream, 2);
+  assert(numel(values) == 2);
+  values = bson.readStream(stream, 2);
+  assert(numel(values) == 1 && values.a == 3);
+  assert(isempty(bson.readStream(stream, 2)));
+  bson.closeStream(stream);
+  delete(filename);
+
+  bson_value = bson.encode(struct('id_', '511c72ae7922641d00000001'));
+  value = bson.decode(bson_value, 'OID', 'uint32');
+  assert(isequal(value.id_, uint32([hex2dec('511c72ae'), ...
+                                    hex2dec('7922641d'), ...
+                                    1])));
+  assert(isequal(bson.decode(bson.encode(value)), ...
+                 bson.decode(bson_value)));
+
+  text = bson.toJSON(struct('a', 1, 'b', {{'x', true}}));
+  assert(strcmp(text, '{"a":1,"b":["x",true]}'));
+  assert(isequal(bson.fromJSON(text), ...
+                 bson.encode(struct('a', 1, 'b', {{'x', true}}))));
+  text = bson.toJSON(struct('a', int32(7)));
+  assert(strcmp(text, '{"a":{"$numberInt":"7"}}'));
+  assert(isa(bson.decode(bson.fromJSON(text)).a, 'int32'));
+
 end
\ No newline at end of file
@@ -35,7 +35,16 @@ function test1
                    }});
   ejdb.save('parrots', parrot2);
 
-  ejdb.save('cows', struct('name', 'moo'));
+  cow_id = ejdb.save('cows', struct('name', 'moo'));
+  cow = ejdb.load('cows', cow_id, 'FIELDS', {'name', 'horns'});
+  assert(strcmp(cow.name, 'moo') && isempty(cow.horns));
+  cow_ids = ejdb.save('cows', struct('name', 'moo2'), ...
+                              struct('name', 'moo3'), 'OID', 'binary');
+  assert(isa(cow_ids, 'uint8') && isequal(size(cow_ids), [2, 12]));
+  cows = ejdb.load('cows', cow_ids, 'OID', 'binary');
+  assert(strcmp(cows{2}.name, 'moo3') && isequal(cows{2}.id_, cow_ids(2, :)));
+  ejdb.remove('cows', cow_ids);
+  assert(all(cellfun(@isempty, ejdb.load('cows', cow_ids))));
 
   results = ejdb.find('parrots', {'name', 'Cacadoo'});
   for i = 1:numel(results)
@@ -56,9 +65,136 @@ function test1
   end
 
   assert(ejdb.count('parrots', {}) == 2);
+
+  results = ejdb.find('parrots', {'name', 'Mamadoo'}, 'LAZY');
+  assert(isa(results, 'bson.lazy'));
+  assert(results(1).size == 666);
+  assert(strcmp(bson.get(results(1), 'likes.1'), 'night'));
+
+  results = ejdb.find('parrots', {}, 'FIELDS', {'name', 'likes.0'});
+  assert(numel(results) == 2 && isfield(results, 'likes_0'));
   assert(numel(ejdb.findOne('parrots', {})) == 1);
 
+  ejdb.save('owners', struct('name', 'Frodo', 'pet', 'Cacadoo'), ...
+                     struct('name', 'Sam', 'pet', 'Mamadoo'));
+  results = ejdb.join('parrots', {}, 'name', 'owners', {}, 'pet', ...
+                      'FIELDS', {'size', 'pet'});
+  assert(numel(results) == 2 && isequal(sort([results.size]), [12, 666]));
+  pairs = ejdb.join('parrots', {}, 'name', 'owners', {}, 'pet', ...
+                    'OUTPUT', 'pairs');
+  assert(isequal(size(pairs), [2, 2]));
+
+  results = ejdb.aggregate('parrots', {}, 'GROUPBY', 'name', ...
+                           'SUM', 'size', 'MAX', 'size');
+  assert(isequal(results.count, [1; 1]));
+  assert(isequal(sort(results.sum_size), [12; 666]));
+  results = ejdb.aggregate('parrots', {}, 'MEAN', 'size');
+  assert(results.count == 2 && results.mean_size == 339);
+  ejdb.save('ravens', struct('tag', int64(2)^53), ...
+                      struct('tag', int64(2)^53 + 1));
+  results = ejdb.aggregate('ravens', {}, 'GROUPBY', 'tag');
+  assert(isequal(results.count, [1; 1]));
+
+  [sizes, mask] = ejdb.findColumn('parrots', {}, 'size', 'TYPE', 'int32');
+  assert(isa(sizes, 'int32') && isequal(sort(sizes), int32([12; 666])));
+  assert(all(mask));
+  columns = ejdb.findColumn('parrots', {}, {'size', 'likes.0'});
+  assert(sum(isnan(columns.likes_0)) == 2 && numel(columns.size) == 2);
+  sizes = ejdb.findColumn('parrots', {}, {'$orderby', {'size', 1}}, ...
+                          {'size'}, 'TYPE', 'logical');
+  assert(islogical(sizes.size) && all(sizes.size));
+
+  state = ejdb.sketch('parrots', {}, 'name');
+  assert(isa(state, 'uint8') && round(ejdb.sketchEstimate(state)) == 2);
+  state = ejdb.sketch('parrots', {}, 'size', 'TYPE', 'quantiles');
+  state = ejdb.sketchMerge(state, state);
+  assert(abs(ejdb.sketchEstimate(state, 1) - 666) < 1e-9);
+
+  ids = ejdb.newId(3, 'OID', 'binary');
+  assert(isequal(size(ids), [3, 12]) && size(unique(ids, 'rows'), 1) == 3);
+  id = ejdb.newId;
+  assert(strcmp(ejdb.save('rooks', struct('id_', id, 'name', 'Ash')), id));
+
+  ejdb.setCache('QUERYBYTES', 2^20, 'DOCUMENTBYTES', 2^20);
+  count = ejdb.count('parrots', {});
+  assert(ejdb.count('parrots', {}) == count);
+  polly_id = ejdb.save('parrots', struct('name', 'Polly'));
+  assert(ejdb.count('parrots', {}) == count + 1);
+  ejdb.load('parrots', polly_id);
+  polly = ejdb.load('parrots', polly_id);
+  assert(strcmp(polly.name, 'Polly'));
+  ejdb.remove('parrots', polly_id);
+  assert(isempty(ejdb.load('parrots', polly_id)));
+  stats = ejdb.cacheStats;
+  assert(stats.query.hits == 1 && stats.document.hits == 1);
+  ejdb.setCache('QUERYBYTES', 0);
+  stats = ejdb.cacheStats;
+  assert(stats.query.budget == 0 && stats.document.budget == 2^20);
+  ejdb.setCache('DOCUMENTBYTES', 0);
+
+  results = ejdb.scan('parrots', {'size', {'$gt', 100}}, 'THREADS', 2);
+  assert(numel(results) == 1 && results(1).size == 666);
+  results = ejdb.scan('parrots', {'name', {'$begin', 'Ca'}}, ...
+                      'FIELDS', {'size'});
+  assert(numel(results) == 1 && results.size == 12);
+
+  results = ejdb.batch({{'save', 'crows', struct('name', 'Russell')}, ...
+                        {'count', 'crows', {}}}, 'ATOMIC', true);
+  assert(numel(results) == 2 && results{2} == 1);
+
+  future = ejdb.findAsync('parrots', {}, 'FIELDS', 'name');
+  future2 = ejdb.findAsync('parrots', {'name', 'Bounty'});
+  ejdb.cancel(future2);
+  results = ejdb.fetch(future);
+  assert(numel(results) == 2);
+
+  filename = [tempname, '.jsonl'];
+  fid = fopen(filename, 'w');
+  fprintf(fid, '{"name": "Hedwig", "age": 3}\n\n{"name": "Errol"}\n');
+  fclose(fid);
+  assert(ejdb.import('owls', filename) == 2);
+  assert(ejdb.count('owls', {'age', 3}) == 1);
+  stats = ejdb.export('owls', {}, filename);
+  assert(stats.count == 2 && stats.bytes > 0);
+  assert(ejdb.import('owls2', filename) == 2);
+  delete(filename);
+
+  ejdb.close(db_id);
+
+  db_id = ejdb.open('zoo', 'WRITER', true, 'WRITEBEHIND', true);
+  id = ejdb.save(db_id, 'owls', struct('name', 'Pigwidgeon'));
+  ejdb.sync(db_id);
+  assert(~isempty(ejdb.load(db_id, 'owls', id)));
+  futures = [ejdb.findAsync(db_id, 'owls', {}), ...
+             ejdb.findAsync(db_id, 'owls', {'name', 'Pigwidgeon'})];
+  assert(numel(ejdb.fetch(futures(2))) == 1);
+  assert(numel(ejdb.fetch(futures(1))) >= 1);
+  ejdb.close(db_id);
+
+  [db_id, shard_ids] = ejdb.openSharded('aviary', 3, 'KEY', 'kind');
+  assert(numel(shard_ids) == 3);
+  kinds = {'owl', 'crow', 'wren', 'kite'};
+  for i = 1:numel(kinds)
+    id = ejdb.save(db_id, 'birds', struct('kind', kinds{i}, 'size', i));
+  end
+  assert(ejdb.count(db_id, 'birds', {}) == 4);
+  assert(ejdb.count(db_id, 'birds', {'kind', 'owl'}) == 1);
+  results = ejdb.find(db_id, 'birds', {}, ...
+                      {'$orderby', {'size', -1}, '$max', 2});
+  assert(isequal([results.size], [4, 3]));
+  ejdb.save(db_id, 'birds', struct('id_', id, 'kind', 'hawk', 'size', 4));
+  assert(ejdb.count(db_id, 'birds', {}) == 4);
+  bird = ejdb.load(db_id, 'birds', id);
+  assert(strcmp(bird.kind, 'hawk'));
+  bird = ejdb.findOne(db_id, 'birds', {}, ...
+                      {'$orderby', {'size', 1}, '$skip', 1});
+  assert(bird.size == 2);
+  ejdb.remove(db_id, 'birds', id);
+  results = ejdb.aggregate(db_id, 'birds', {}, 'SUM', 'size');
+  assert(results.count == 3 && results.sum_size == 6);
+  ejdb.sync(shard_ids(1));
   ejdb.close(db_id);
+  assert(~ejdb.isopen(shard_ids(1)));
 
   disp('CONGRATULATIONS!!! Test batch 1 has passed completely!');
 